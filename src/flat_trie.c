@@ -0,0 +1,256 @@
+/** @file
+ * Implementation of the flat image of the trees storing number redirections
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#include <string.h>
+#include "flat_trie.h"
+
+/** @brief Aligns an offset.
+ *
+ * @param[in] offset - an offset within an image.
+ * @return The smallest offset not smaller than @p offset, aligned to
+ *         @ref FLAT_TRIE_ALIGNMENT.
+ */
+static uint64_t alignOffset(uint64_t offset) {
+    return (offset + FLAT_TRIE_ALIGNMENT - 1)
+           / FLAT_TRIE_ALIGNMENT * FLAT_TRIE_ALIGNMENT;
+}
+
+size_t flatTrieLayout(FlatTrieHeader * header, uint32_t numInitial,
+                      uint32_t numForwarded, uint32_t numInbound,
+                      uint64_t poolLength) {
+    memset(header, 0, sizeof(FlatTrieHeader));
+    memcpy(header->magic, FLAT_TRIE_MAGIC, FLAT_TRIE_MAGIC_LENGTH);
+    header->version = FLAT_TRIE_VERSION;
+    header->numInitial = numInitial;
+    header->numForwarded = numForwarded;
+    header->numInbound = numInbound;
+    header->poolLength = poolLength;
+
+    header->initialOffset = alignOffset(sizeof(FlatTrieHeader));
+    header->forwardedOffset = alignOffset(header->initialOffset
+                                          + (uint64_t) numInitial
+                                            * sizeof(FlatInitialNode));
+    header->inboundOffset = alignOffset(header->forwardedOffset
+                                        + (uint64_t) numForwarded
+                                          * sizeof(FlatForwardedNode));
+    header->poolOffset = alignOffset(header->inboundOffset
+                                     + (uint64_t) numInbound
+                                       * sizeof(uint32_t));
+    header->totalLength = alignOffset(header->poolOffset + poolLength);
+
+    return (size_t) header->totalLength;
+}
+
+bool flatTrieOpen(FlatTrie * trie, void const * image, size_t length) {
+    FlatTrieHeader const * header = image;
+
+    if (!image || length < sizeof(FlatTrieHeader)
+        || (uintptr_t) image % FLAT_TRIE_ALIGNMENT != 0
+        || memcmp(header->magic, FLAT_TRIE_MAGIC, FLAT_TRIE_MAGIC_LENGTH) != 0
+        || header->version != FLAT_TRIE_VERSION
+        || header->numInitial == 0 || header->numForwarded == 0) {
+        return false;
+    }
+
+    // The offsets have to be exactly the ones of a freshly computed layout
+    FlatTrieHeader expected;
+    flatTrieLayout(&expected, header->numInitial, header->numForwarded,
+                   header->numInbound, header->poolLength);
+
+    if (memcmp(&expected, header, sizeof(FlatTrieHeader)) != 0
+        || expected.totalLength > length) {
+        return false;
+    }
+
+    char const * bytes = image;
+    trie->header = header;
+    trie->initial = (FlatInitialNode const *) (bytes + header->initialOffset);
+    trie->forwarded = (FlatForwardedNode const *) (bytes
+                                                   + header->forwardedOffset);
+    trie->inbound = (uint32_t const *) (bytes + header->inboundOffset);
+    trie->pool = bytes + header->poolOffset;
+
+    return true;
+}
+
+/** @brief Checks a prefix of an image.
+ *
+ * @param[in] trie - a pointer to the view of an opened image;
+ * @param[in] offset - the offset of the prefix within the prefixes;
+ * @param[in] depth - the number of the digits of the prefix.
+ * @return @p True if the prefix lies within the prefixes and is followed by
+ *         the terminating null character, @p false otherwise.
+ */
+static bool isPrefixValid(FlatTrie const * trie, uint32_t offset,
+                          uint32_t depth) {
+    uint64_t poolLength = trie->header->poolLength;
+
+    return offset < poolLength && depth < poolLength - offset
+           && memchr(trie->pool + offset, '\0', (size_t) depth + 1)
+              == trie->pool + offset + depth;
+}
+
+/** @brief Checks the position of the children of a node.
+ * The children of the nodes are numbered consecutively in breadth-first
+ * order, so the first child of every node with children has to be the next
+ * node not yet claimed as a child, placed after the node itself.
+ *
+ * @param[in] index - the index of the node;
+ * @param[in] firstChild - the index of the first child of the node;
+ * @param[in] childMask - the bitmap of the edges leaving the node;
+ * @param[in] numNodes - the number of the nodes of the tree;
+ * @param[in, out] nextChild - the index of the next node not yet claimed
+ *                             as a child.
+ * @return @p True if the children of the node lie within the tree where
+ *         expected, @p false otherwise.
+ */
+static bool areChildrenPlaced(uint32_t index, uint32_t firstChild,
+                              uint16_t childMask, uint32_t numNodes,
+                              uint64_t * nextChild) {
+    uint32_t numChildren = (uint32_t) __builtin_popcount(childMask);
+
+    if (numChildren == 0) {
+        return true;
+    }
+
+    if (firstChild != *nextChild || firstChild <= index
+        || numChildren > numNodes - firstChild) {
+        return false;
+    }
+
+    *nextChild += numChildren;
+
+    return true;
+}
+
+/** @brief Checks the edge leading to a node.
+ *
+ * @param[in] depth - the depth of the node;
+ * @param[in] labelLength - the number of the digits labeling the edge
+ *                          leading to the node;
+ * @param[in] parentDepth - the depth of the parent of the node.
+ * @return @p True if the label is not empty, fits in a label and leads from
+ *         the depth of the parent to the depth of the node, @p false
+ *         otherwise.
+ */
+static bool isEdgeValid(uint32_t depth, uint8_t labelLength,
+                        uint32_t parentDepth) {
+    return labelLength > 0 && labelLength <= FLAT_MAX_LABEL_LENGTH
+           && (uint64_t) depth == (uint64_t) parentDepth + labelLength;
+}
+
+/** @brief Checks the nodes of the tree storing the redirected prefixes.
+ *
+ * @param[in] trie - a pointer to the view of an opened image.
+ * @return @p True if the nodes are consistent, @p false otherwise.
+ */
+static bool areInitialNodesValid(FlatTrie const * trie) {
+    uint32_t numInitial = trie->header->numInitial;
+    uint32_t numForwarded = trie->header->numForwarded;
+    FlatInitialNode const * root = &(trie->initial[0]);
+    uint64_t nextChild = 1;
+
+    if (root->depth != 0 || root->labelLength != 0 || root->isForwarded
+        || root->nearestForwarded != FLAT_NONE) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < numInitial; i++) {
+        FlatInitialNode const * node = &(trie->initial[i]);
+
+        if (node->isForwarded
+            && (node->target >= numForwarded
+                || !trie->forwarded[node->target].isForwarding
+                || !isPrefixValid(trie, node->prefix, node->depth))) {
+            return false;
+        }
+
+        uint64_t firstChild = nextChild;
+        if (!areChildrenPlaced(i, node->firstChild, node->childMask,
+                               numInitial, &nextChild)) {
+            return false;
+        }
+
+        for (uint32_t j = (uint32_t) firstChild; j < nextChild; j++) {
+            FlatInitialNode const * child = &(trie->initial[j]);
+            uint32_t nearest = child->isForwarded ? j
+                                                  : node->nearestForwarded;
+
+            if (!isEdgeValid(child->depth, child->labelLength, node->depth)
+                || child->nearestForwarded != nearest) {
+                return false;
+            }
+        }
+    }
+
+    return nextChild == numInitial;
+}
+
+/** @brief Checks the nodes of the tree storing the final prefixes.
+ * Also checks the indices of the redirected nodes of every final prefix,
+ * which have to point back to the prefix.
+ *
+ * @param[in] trie - a pointer to the view of an opened image.
+ * @return @p True if the nodes are consistent, @p false otherwise.
+ */
+static bool areForwardedNodesValid(FlatTrie const * trie) {
+    uint32_t numInitial = trie->header->numInitial;
+    uint32_t numForwarded = trie->header->numForwarded;
+    uint32_t numInbound = trie->header->numInbound;
+    FlatForwardedNode const * root = &(trie->forwarded[0]);
+    uint64_t nextChild = 1;
+    uint64_t nextInbound = 0;
+
+    if (root->depth != 0 || root->labelLength != 0 || root->isForwarding) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < numForwarded; i++) {
+        FlatForwardedNode const * node = &(trie->forwarded[i]);
+
+        if (node->isForwarding) {
+            if (!isPrefixValid(trie, node->prefix, node->depth)
+                || node->firstInbound != nextInbound
+                || node->numInbound > numInbound - nextInbound) {
+                return false;
+            }
+
+            nextInbound += node->numInbound;
+
+            for (uint32_t j = node->firstInbound; j < nextInbound; j++) {
+                uint32_t redirected = trie->inbound[j];
+
+                if (redirected >= numInitial
+                    || !trie->initial[redirected].isForwarded
+                    || trie->initial[redirected].target != i) {
+                    return false;
+                }
+            }
+        }
+
+        uint64_t firstChild = nextChild;
+        if (!areChildrenPlaced(i, node->firstChild, node->childMask,
+                               numForwarded, &nextChild)) {
+            return false;
+        }
+
+        for (uint32_t j = (uint32_t) firstChild; j < nextChild; j++) {
+            FlatForwardedNode const * child = &(trie->forwarded[j]);
+
+            if (!isEdgeValid(child->depth, child->labelLength, node->depth)) {
+                return false;
+            }
+        }
+    }
+
+    return nextChild == numForwarded;
+}
+
+bool flatTrieVerify(FlatTrie const * trie) {
+    return areInitialNodesValid(trie) && areForwardedNodesValid(trie);
+}
@@ -0,0 +1,237 @@
+/** @file
+ * Interface of the flat image of the trees storing number redirections
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __FLAT_TRIE_H__
+#define __FLAT_TRIE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The characters identifying an image, placed at its beginning.
+ */
+#define FLAT_TRIE_MAGIC         "PHFWDIMG"
+
+/**
+ * The number of the characters identifying an image.
+ */
+#define FLAT_TRIE_MAGIC_LENGTH  8
+
+/**
+ * The version of the layout of an image.
+ */
+#define FLAT_TRIE_VERSION       2
+
+/**
+ * The alignment of an image and of every part of it, equal to the size of
+ * a cache line. The nodes take 32 bytes, so no node spans two cache lines.
+ */
+#define FLAT_TRIE_ALIGNMENT     64
+
+/**
+ * The value of an index or an offset which does not point to anything.
+ */
+#define FLAT_NONE               UINT32_MAX
+
+/**
+ * The largest number of the digits labeling an edge of an image.
+ */
+#define FLAT_MAX_LABEL_LENGTH   16
+
+/** @struct FlatTrieHeader
+ * @brief The beginning of an image, describing its layout. All offsets are
+ *      counted in bytes from the beginning of the image.
+ * @var FlatTrieHeader::magic
+ *      The characters @ref FLAT_TRIE_MAGIC, without the terminating null
+ *      character.
+ * @var FlatTrieHeader::version
+ *      The version of the layout, @ref FLAT_TRIE_VERSION.
+ * @var FlatTrieHeader::numInitial
+ *      The number of the nodes of the tree storing the redirected prefixes.
+ * @var FlatTrieHeader::numForwarded
+ *      The number of the nodes of the tree storing the final prefixes.
+ * @var FlatTrieHeader::numInbound
+ *      The number of the redirections.
+ * @var FlatTrieHeader::poolLength
+ *      The number of the bytes storing the prefixes.
+ * @var FlatTrieHeader::initialOffset
+ *      The offset of the array of @ref FlatInitialNode.
+ * @var FlatTrieHeader::forwardedOffset
+ *      The offset of the array of @ref FlatForwardedNode.
+ * @var FlatTrieHeader::inboundOffset
+ *      The offset of the array of the indices of the redirected nodes.
+ * @var FlatTrieHeader::poolOffset
+ *      The offset of the prefixes.
+ * @var FlatTrieHeader::totalLength
+ *      The size of the whole image in bytes.
+ */
+typedef struct FlatTrieHeader {
+    char magic[FLAT_TRIE_MAGIC_LENGTH];
+    uint32_t version;
+    uint32_t numInitial;
+    uint32_t numForwarded;
+    uint32_t numInbound;
+    uint64_t poolLength;
+    uint64_t initialOffset;
+    uint64_t forwardedOffset;
+    uint64_t inboundOffset;
+    uint64_t poolOffset;
+    uint64_t totalLength;
+} FlatTrieHeader;  ///< Layout of an image
+
+/** @struct FlatInitialNode
+ * @brief A node of the tree storing the redirected prefixes in an image.
+ *      The nodes are numbered in breadth-first order starting from the root,
+ *      therefore the children of a node have consecutive indices, ordered by
+ *      the labels of the edges leading to them.
+ * @var FlatInitialNode::label
+ *      The packed digits labeling the edge leading to the node, as in
+ *      the tree the image has been built from.
+ * @var FlatInitialNode::firstChild
+ *      The index of the first child of the node.
+ * @var FlatInitialNode::nearestForwarded
+ *      The index of the deepest node on the path from the root to the node,
+ *      inclusively, which is a terminal node of a redirected prefix;
+ *      @ref FLAT_NONE if there is none.
+ * @var FlatInitialNode::target
+ *      The index of the @ref FlatForwardedNode representing the final prefix
+ *      if the node is a terminal node of a redirected prefix, @ref FLAT_NONE
+ *      otherwise.
+ * @var FlatInitialNode::prefix
+ *      The offset of the redirected prefix within the prefixes if the node is
+ *      a terminal node of a redirected prefix, @ref FLAT_NONE otherwise.
+ * @var FlatInitialNode::depth
+ *      The number of the digits on the path from the root to the node.
+ * @var FlatInitialNode::childMask
+ *      A bitmap of the edges leaving the node.
+ * @var FlatInitialNode::labelLength
+ *      The number of the digits in \link FlatInitialNode::label label
+ *      \endlink.
+ * @var FlatInitialNode::isForwarded
+ *      1 if the node is a terminal node of a redirected prefix, 0 otherwise.
+ */
+typedef struct FlatInitialNode {
+    uint64_t label;
+    uint32_t firstChild;
+    uint32_t nearestForwarded;
+    uint32_t target;
+    uint32_t prefix;
+    uint32_t depth;
+    uint16_t childMask;
+    uint8_t labelLength;
+    uint8_t isForwarded;
+} FlatInitialNode;  ///< Node of the redirected prefixes in an image
+
+/** @struct FlatForwardedNode
+ * @brief A node of the tree storing the final prefixes in an image,
+ *      numbered in the same way as @ref FlatInitialNode.
+ * @var FlatForwardedNode::label
+ *      The packed digits labeling the edge leading to the node.
+ * @var FlatForwardedNode::firstChild
+ *      The index of the first child of the node.
+ * @var FlatForwardedNode::prefix
+ *      The offset of the final prefix within the prefixes if the node is
+ *      a terminal node of a final prefix, @ref FLAT_NONE otherwise.
+ * @var FlatForwardedNode::firstInbound
+ *      The index of the first of the redirected nodes of the node in
+ *      the array of the indices of the redirected nodes.
+ * @var FlatForwardedNode::numInbound
+ *      The number of the prefixes redirected to the prefix of the node,
+ *      whose indices are stored sorted by the prefixes.
+ * @var FlatForwardedNode::depth
+ *      The number of the digits on the path from the root to the node.
+ * @var FlatForwardedNode::childMask
+ *      A bitmap of the edges leaving the node.
+ * @var FlatForwardedNode::labelLength
+ *      The number of the digits in \link FlatForwardedNode::label label
+ *      \endlink.
+ * @var FlatForwardedNode::isForwarding
+ *      1 if the node is a terminal node of a final prefix, 0 otherwise.
+ */
+typedef struct FlatForwardedNode {
+    uint64_t label;
+    uint32_t firstChild;
+    uint32_t prefix;
+    uint32_t firstInbound;
+    uint32_t numInbound;
+    uint32_t depth;
+    uint16_t childMask;
+    uint8_t labelLength;
+    uint8_t isForwarding;
+} FlatForwardedNode;  ///< Node of the final prefixes in an image
+
+/** @struct FlatTrie
+ * @brief A view of an image, pointing to its parts.
+ * @var FlatTrie::header
+ *      The beginning of the image or NULL if the view is empty.
+ * @var FlatTrie::initial
+ *      The nodes of the tree storing the redirected prefixes.
+ * @var FlatTrie::forwarded
+ *      The nodes of the tree storing the final prefixes.
+ * @var FlatTrie::inbound
+ *      The indices of the redirected nodes.
+ * @var FlatTrie::pool
+ *      The prefixes, each followed by the terminating null character.
+ */
+typedef struct FlatTrie {
+    FlatTrieHeader const * header;
+    FlatInitialNode const * initial;
+    FlatForwardedNode const * forwarded;
+    uint32_t const * inbound;
+    char const * pool;
+} FlatTrie;  ///< View of an image of the trees
+
+/** @brief Computes the layout of an image.
+ * Fills the header of an image with the given sizes, places the parts of
+ * the image one after another, aligned for their types, and computes their
+ * offsets.
+ *
+ * @param[out] header - a pointer to the header to be filled;
+ * @param[in] numInitial - the number of the nodes of the tree storing
+ *                         the redirected prefixes;
+ * @param[in] numForwarded - the number of the nodes of the tree storing
+ *                           the final prefixes;
+ * @param[in] numInbound - the number of the redirections;
+ * @param[in] poolLength - the number of the bytes storing the prefixes.
+ * @return The size of the whole image in bytes.
+ */
+size_t flatTrieLayout(FlatTrieHeader * header, uint32_t numInitial,
+                      uint32_t numForwarded, uint32_t numInbound,
+                      uint64_t poolLength);
+
+/** @brief Opens an image.
+ * Checks whether the memory contains an image of the current version with
+ * a consistent layout and fits in @p length bytes, then fills the view.
+ * Only the header is checked, the nodes of an image coming from outside
+ * the process need to be checked by @ref flatTrieVerify before use.
+ *
+ * @param[out] trie - a pointer to the view, left unchanged if the image is
+ *                    rejected;
+ * @param[in] image - a pointer to the memory, aligned for any type;
+ * @param[in] length - the size of the memory in bytes.
+ * @return @p True if the image has been accepted, @p false otherwise.
+ */
+bool flatTrieOpen(FlatTrie * trie, void const * image, size_t length);
+
+/** @brief Checks the nodes of an image.
+ * Checks in a single pass over an opened image that every index and offset
+ * stored in it points inside the image and that the nodes form the trees
+ * the lookups expect: the children of every node follow it in
+ * breadth-first order, the depths agree with the labels, the nearest
+ * redirected nodes lie on the paths from the root, the redirected nodes and
+ * the final prefixes point to each other and every prefix ends with
+ * the terminating null character within the prefixes.
+ *
+ * @param[in] trie - a pointer to the view of an opened image.
+ * @return @p True if the image can be used by the lookups, @p false
+ *         otherwise.
+ */
+bool flatTrieVerify(FlatTrie const * trie);
+
+#endif /* __FLAT_TRIE_H__ */
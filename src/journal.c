@@ -0,0 +1,340 @@
+/** @file
+ * Implementation of the journal of the modifications of number redirections
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+/** @brief Continues the checksum of a record.
+ * Computes the FNV-1a hash of the bytes, starting from the given value.
+ *
+ * @param[in] hash - the hash of the preceding bytes;
+ * @param[in] bytes - the bytes;
+ * @param[in] length - the number of the bytes.
+ * @return The hash of the preceding bytes followed by @p bytes.
+ */
+static uint32_t hashBytes(uint32_t hash, void const* bytes, size_t length) {
+    unsigned char const * current = bytes;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ current[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+/** @brief Computes the checksum of a record.
+ *
+ * @param[in] header - the beginning of the record;
+ * @param[in] payload - the numbers of the record;
+ * @param[in] payloadLength - the number of the bytes of @p payload.
+ * @return The checksum of the record.
+ */
+static uint32_t recordChecksum(JournalRecordHeader const* header,
+                               char const* payload, size_t payloadLength) {
+    uint32_t hash = 2166136261u;
+
+    hash = hashBytes(hash, &(header->type), sizeof(header->type));
+    hash = hashBytes(hash, &(header->length1), sizeof(header->length1));
+    hash = hashBytes(hash, &(header->length2), sizeof(header->length2));
+
+    return hashBytes(hash, payload, payloadLength);
+}
+
+/** @brief Computes the length of the numbers of a record.
+ *
+ * @param[in] header - the beginning of the record.
+ * @return The number of the bytes of the numbers with their terminating null
+ *         characters.
+ */
+static size_t payloadLength(JournalRecordHeader const* header) {
+    size_t length = (size_t) header->length1 + 1;
+
+    if (header->type == JOURNAL_ADD) {
+        length += (size_t) header->length2 + 1;
+    }
+
+    return length;
+}
+
+/** @brief Writes the beginning of a journal.
+ *
+ * @param[out] header - the memory for the @ref JOURNAL_HEADER_LENGTH bytes
+ *                      of the beginning of a journal.
+ */
+static void fillHeader(char* header) {
+    uint32_t version = JOURNAL_VERSION;
+
+    memcpy(header, JOURNAL_MAGIC, JOURNAL_MAGIC_LENGTH);
+    memcpy(header + JOURNAL_MAGIC_LENGTH, &version, sizeof(version));
+}
+
+bool journalCheckHeader(char const* data, size_t length) {
+    char header[JOURNAL_HEADER_LENGTH];
+    fillHeader(header);
+
+    // A crash while the beginning was written leaves a part of it
+    if (length < JOURNAL_HEADER_LENGTH) {
+        return length == 0 || memcmp(data, header, length) == 0;
+    }
+
+    return memcmp(data, header, JOURNAL_HEADER_LENGTH) == 0;
+}
+
+size_t journalReadRecord(char const* data, size_t length,
+                         JournalRecord* record) {
+    JournalRecordHeader header;
+
+    if (length < sizeof(JournalRecordHeader)) {
+        return 0;
+    }
+
+    // The records are not aligned in the file
+    memcpy(&header, data, sizeof(JournalRecordHeader));
+
+    bool isAdd = header.type == JOURNAL_ADD;
+    if ((!isAdd && header.type != JOURNAL_REMOVE) || header.length1 == 0
+        || (isAdd != (header.length2 > 0))) {
+        return 0;
+    }
+
+    size_t payload = payloadLength(&header);
+    char const * num1 = data + sizeof(JournalRecordHeader);
+
+    if (length - sizeof(JournalRecordHeader) < payload
+        || num1[header.length1] != '\0'
+        || (isAdd && num1[header.length1 + 1 + header.length2] != '\0')
+        || recordChecksum(&header, num1, payload) != header.checksum) {
+        return 0;
+    }
+
+    record->type = header.type;
+    record->num1 = num1;
+    record->num2 = isAdd ? num1 + header.length1 + 1 : NULL;
+
+    return sizeof(JournalRecordHeader) + payload;
+}
+
+/** @brief Finds the end of the complete records.
+ *
+ * @param[in] descriptor - the descriptor of the file with a journal;
+ * @param[out] validLength - the number of the bytes of the beginning of
+ *                           the file and of its complete records, 0 if
+ *                           the beginning is not complete.
+ * @return @p False if the file cannot be read or is not a journal,
+ *         @p true otherwise.
+ */
+static bool findValidLength(int descriptor, size_t* validLength) {
+    struct stat status;
+
+    if (fstat(descriptor, &status) != 0) {
+        return false;
+    }
+
+    size_t length = (size_t) status.st_size;
+    *validLength = 0;
+
+    if (length == 0) {
+        return true;
+    }
+
+    char * data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+
+    bool isJournal = journalCheckHeader(data, length);
+
+    if (isJournal && length >= JOURNAL_HEADER_LENGTH) {
+        JournalRecord record;
+        size_t offset = JOURNAL_HEADER_LENGTH;
+        size_t recordLength;
+
+        while ((recordLength = journalReadRecord(data + offset,
+                                                 length - offset,
+                                                 &record)) > 0) {
+            offset += recordLength;
+        }
+
+        *validLength = offset;
+    }
+
+    munmap(data, length);
+
+    return isJournal;
+}
+
+/** @brief Writes bytes to a file.
+ * Repeats the writing until all the bytes are written.
+ *
+ * @param[in] descriptor - the descriptor of the file;
+ * @param[in] bytes - the bytes;
+ * @param[in] length - the number of the bytes.
+ * @return @p False in case of a failure of writing, @p true otherwise.
+ */
+static bool writeAll(int descriptor, char const* bytes, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(descriptor, bytes, length);
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+
+        bytes += written;
+        length -= (size_t) written;
+    }
+
+    return true;
+}
+
+bool journalOpen(Journal* journal, char const* path, size_t syncInterval) {
+    int descriptor = open(path, O_RDWR | O_CREAT, 0644);
+    if (descriptor < 0) {
+        return false;
+    }
+
+    size_t validLength;
+    bool isOpened = findValidLength(descriptor, &validLength);
+
+    // A new journal gets its beginning, a damaged one loses its last record
+    if (isOpened && validLength == 0) {
+        char header[JOURNAL_HEADER_LENGTH];
+        fillHeader(header);
+
+        isOpened = ftruncate(descriptor, 0) == 0
+                   && writeAll(descriptor, header, JOURNAL_HEADER_LENGTH)
+                   && fdatasync(descriptor) == 0;
+    }
+    else if (isOpened) {
+        isOpened = ftruncate(descriptor, (off_t) validLength) == 0
+                   && lseek(descriptor, 0, SEEK_END) >= 0;
+    }
+
+    if (!isOpened) {
+        close(descriptor);
+
+        return false;
+    }
+
+    journal->descriptor = descriptor;
+    journal->buffer = NULL;
+    journal->length = 0;
+    journal->slots = 0;
+    journal->pendingRecords = 0;
+    journal->syncInterval = syncInterval;
+    journal->isFailed = false;
+
+    return true;
+}
+
+bool journalSync(Journal* journal) {
+    if (journal->isFailed) {
+        return false;
+    }
+
+    if (journal->pendingRecords == 0) {
+        return true;
+    }
+
+    if (!writeAll(journal->descriptor, journal->buffer, journal->length)
+        || fdatasync(journal->descriptor) != 0) {
+        journalFail(journal);
+
+        return false;
+    }
+
+    journal->length = 0;
+    journal->pendingRecords = 0;
+
+    return true;
+}
+
+bool journalClose(Journal* journal) {
+    bool isSynced = journalSync(journal);
+
+    if (close(journal->descriptor) != 0) {
+        isSynced = false;
+    }
+
+    free(journal->buffer);
+
+    return isSynced;
+}
+
+void journalFail(Journal* journal) {
+    journal->isFailed = true;
+}
+
+bool journalAppend(Journal* journal, JournalRecordType type, char const* num1,
+                   size_t length1, char const* num2, size_t length2) {
+    if (journal->isFailed) {
+        return false;
+    }
+
+    if (length1 > UINT32_MAX || length2 > UINT32_MAX) {
+        journalFail(journal);
+
+        return false;
+    }
+
+    JournalRecordHeader header;
+    header.type = type;
+    header.length1 = (uint32_t) length1;
+    header.length2 = type == JOURNAL_ADD ? (uint32_t) length2 : 0;
+
+    size_t payload = payloadLength(&header);
+    size_t needed = journal->length + sizeof(JournalRecordHeader) + payload;
+
+    if (journal->slots < needed) {
+        size_t slots = journal->slots * 2 > needed ? journal->slots * 2
+                                                   : needed;
+        char * buffer = realloc(journal->buffer, slots);
+
+        if (!buffer) {
+            journalFail(journal);
+
+            return false;
+        }
+
+        journal->buffer = buffer;
+        journal->slots = slots;
+    }
+
+    char * record = journal->buffer + journal->length;
+    char * numbers = record + sizeof(JournalRecordHeader);
+
+    memcpy(numbers, num1, length1);
+    numbers[length1] = '\0';
+
+    if (type == JOURNAL_ADD) {
+        memcpy(numbers + length1 + 1, num2, length2);
+        numbers[length1 + 1 + length2] = '\0';
+    }
+
+    header.checksum = recordChecksum(&header, numbers, payload);
+    memcpy(record, &header, sizeof(JournalRecordHeader));
+    journal->length = needed;
+    journal->pendingRecords++;
+
+    if (journal->syncInterval > 0
+        && journal->pendingRecords >= journal->syncInterval) {
+        return journalSync(journal);
+    }
+
+    return true;
+}
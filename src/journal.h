@@ -0,0 +1,198 @@
+/** @file
+ * Interface of the journal of the modifications of number redirections
+ *
+ * A journal is a file starting with @ref JOURNAL_MAGIC and the version,
+ * followed by the records of the modifications in the order they have been
+ * made. A record consists of a @ref JournalRecordHeader and the numbers of
+ * the modification, each followed by the terminating null character.
+ * The checksum of every record lets a reader find the end of the records
+ * written completely before a crash.
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The characters identifying a journal, placed at its beginning.
+ */
+#define JOURNAL_MAGIC           "PHFWDJNL"
+
+/**
+ * The number of the characters identifying a journal.
+ */
+#define JOURNAL_MAGIC_LENGTH    8
+
+/**
+ * The version of the layout of the records.
+ */
+#define JOURNAL_VERSION         1
+
+/**
+ * The number of the bytes of the beginning of a journal, preceding
+ * the records.
+ */
+#define JOURNAL_HEADER_LENGTH   (JOURNAL_MAGIC_LENGTH + sizeof(uint32_t))
+
+/** @enum JournalRecordType
+ * @brief The kinds of the recorded modifications.
+ */
+typedef enum JournalRecordType {
+    JOURNAL_ADD = 1,     ///< An addition of a redirection, with two numbers
+    JOURNAL_REMOVE = 2   ///< A removal of the redirections, with one number
+} JournalRecordType;  ///< The kind of a recorded modification
+
+/** @struct JournalRecordHeader
+ * @brief The beginning of a record, stored in the byte order of the machine.
+ * @var JournalRecordHeader::checksum
+ *      The FNV-1a hash of the rest of the record.
+ * @var JournalRecordHeader::type
+ *      The kind of the modification, one of @ref JournalRecordType.
+ * @var JournalRecordHeader::length1
+ *      The length of the first number.
+ * @var JournalRecordHeader::length2
+ *      The length of the second number, 0 if there is none.
+ */
+typedef struct JournalRecordHeader {
+    uint32_t checksum;
+    uint32_t type;
+    uint32_t length1;
+    uint32_t length2;
+} JournalRecordHeader;  ///< The beginning of a record
+
+/** @struct JournalRecord
+ * @brief A record read from a journal. The numbers point to the memory
+ *      the journal has been read into.
+ * @var JournalRecord::type
+ *      The kind of the modification.
+ * @var JournalRecord::num1
+ *      The first number.
+ * @var JournalRecord::num2
+ *      The second number or NULL if there is none.
+ */
+typedef struct JournalRecord {
+    JournalRecordType type;
+    char const* num1;
+    char const* num2;
+} JournalRecord;  ///< A record read from a journal
+
+/** @struct Journal
+ * @brief A journal open for appending records, which are kept in memory
+ *      and written to the file in batches.
+ * @var Journal::descriptor
+ *      The descriptor of the file.
+ * @var Journal::buffer
+ *      The records not written to the file yet.
+ * @var Journal::length
+ *      The number of the bytes of \link Journal::buffer buffer \endlink.
+ * @var Journal::slots
+ *      The number of the bytes allocated for
+ *      \link Journal::buffer buffer \endlink.
+ * @var Journal::pendingRecords
+ *      The number of the records appended since the file has been last
+ *      synchronized.
+ * @var Journal::syncInterval
+ *      The number of the records after which the file is synchronized,
+ *      0 if it is synchronized only on demand.
+ * @var Journal::isFailed
+ *      A flag indicating that a record could not be stored; no records are
+ *      appended after such a failure.
+ */
+typedef struct Journal {
+    int descriptor;
+    char* buffer;
+    size_t length;
+    size_t slots;
+    size_t pendingRecords;
+    size_t syncInterval;
+    bool isFailed;
+} Journal;  ///< A journal open for appending records
+
+/** @brief Opens a journal.
+ * Opens the journal in the given file, creating it if it does not exist.
+ * The records following the last complete one, left by a crash, are cut
+ * off, and the new records are appended after it.
+ *
+ * @param[out] journal - a pointer to the journal to be opened;
+ * @param[in] path - the path of the file;
+ * @param[in] syncInterval - the number of the records after which the file
+ *                           is synchronized, 0 if it is synchronized only by
+ *                           @ref journalSync and @ref journalClose.
+ * @return @p False if the file cannot be opened or is not a journal,
+ *         @p true otherwise.
+ */
+bool journalOpen(Journal* journal, char const* path, size_t syncInterval);
+
+/** @brief Closes a journal.
+ * Writes the remaining records, synchronizes the file and releases
+ * the journal.
+ *
+ * @param[in, out] journal - a pointer to the journal.
+ * @return @p False if any record could not be stored, @p true otherwise.
+ */
+bool journalClose(Journal* journal);
+
+/** @brief Appends a record.
+ * Appends the record of the modification to the journal and synchronizes
+ * the file if the number of the records given when opening has been reached.
+ *
+ * @param[in, out] journal - a pointer to the journal;
+ * @param[in] type - the kind of the modification;
+ * @param[in] num1 - the first number;
+ * @param[in] length1 - the length of the first number;
+ * @param[in] num2 - the second number, ignored by a removal;
+ * @param[in] length2 - the length of the second number, 0 for a removal.
+ * @return @p False if the record or an earlier one could not be stored,
+ *         @p true otherwise.
+ */
+bool journalAppend(Journal* journal, JournalRecordType type, char const* num1,
+                   size_t length1, char const* num2, size_t length2);
+
+/** @brief Marks a journal as failed.
+ * Stops appending the records, e.g. after a modification which cannot be
+ * recorded.
+ *
+ * @param[in, out] journal - a pointer to the journal.
+ */
+void journalFail(Journal* journal);
+
+/** @brief Synchronizes a journal.
+ * Writes the records kept in memory to the file and waits until they reach
+ * the storage.
+ *
+ * @param[in, out] journal - a pointer to the journal.
+ * @return @p False if any record could not be stored, @p true otherwise.
+ */
+bool journalSync(Journal* journal);
+
+/** @brief Checks the beginning of a journal.
+ *
+ * @param[in] data - the contents of the file;
+ * @param[in] length - the number of the bytes of @p data.
+ * @return @p True if the contents are a journal, also an empty one or
+ *         a part of the beginning of one, left by a crash while it was
+ *         written, @p false otherwise.
+ */
+bool journalCheckHeader(char const* data, size_t length);
+
+/** @brief Reads a record.
+ * Decodes the record at the beginning of the memory, if it is complete and
+ * its checksum matches.
+ *
+ * @param[in] data - the memory following the previous record;
+ * @param[in] length - the number of the bytes of @p data;
+ * @param[out] record - the decoded record.
+ * @return The number of the bytes of the record or 0 if @p data does not
+ *         start with a complete record.
+ */
+size_t journalReadRecord(char const* data, size_t length,
+                         JournalRecord* record);
+
+#endif /* __JOURNAL_H__ */
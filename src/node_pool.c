@@ -0,0 +1,147 @@
+/** @file
+ * Implementation of the slab allocator for tree nodes
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "node_pool.h"
+
+/**
+ * The number of nodes in the first chunk allocated by a pool.
+ */
+#define FIRST_CHUNK_CAPACITY    16
+
+/**
+ * The maximal number of nodes in a single chunk. Subsequent chunks double
+ * their capacity until reaching this value.
+ */
+#define MAX_CHUNK_CAPACITY      4096
+
+/** @struct PoolChunk
+ * @brief A single block of memory storing consecutive nodes.
+ * @var PoolChunk::next
+ *      The previously allocated chunk.
+ * @var PoolChunk::used
+ *      The number of slots which have ever been handed out from the chunk.
+ * @var PoolChunk::nodes
+ *      The memory of the nodes, aligned for any type.
+ */
+typedef struct PoolChunk {
+    struct PoolChunk* next;
+    size_t used;
+    max_align_t nodes[];
+} PoolChunk;  ///< Block of memory storing nodes
+
+void poolInit(NodePool* pool, size_t nodeSize) {
+    pool->chunks = NULL;
+    pool->freeList = NULL;
+    pool->nodeSize = nodeSize < sizeof(void*) ? sizeof(void*) : nodeSize;
+    pool->usedInChunk = 0;
+    pool->chunkCapacity = 0;
+}
+
+/** @brief Allocates a new chunk.
+ * Allocates a new chunk, twice as large as the previous one, up to
+ * @ref MAX_CHUNK_CAPACITY nodes, and places it at the front of the list.
+ *
+ * @param[in, out] pool - a pointer to the pool.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool addChunk(NodePool* pool) {
+    size_t capacity = pool->chunkCapacity * 2;
+    if (capacity < FIRST_CHUNK_CAPACITY) {
+        capacity = FIRST_CHUNK_CAPACITY;
+    }
+    else if (capacity > MAX_CHUNK_CAPACITY) {
+        capacity = MAX_CHUNK_CAPACITY;
+    }
+
+    PoolChunk * chunk = calloc(1, sizeof(PoolChunk)
+                                  + capacity * pool->nodeSize);
+    if (!chunk) {
+        return false;
+    }
+
+    if (pool->chunks) {
+        pool->chunks->used = pool->usedInChunk;
+    }
+
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+    pool->chunkCapacity = capacity;
+    pool->usedInChunk = 0;
+
+    return true;
+}
+
+void * poolAlloc(NodePool* pool) {
+    if (pool->freeList) {
+        void * result = pool->freeList;
+        memcpy(&(pool->freeList), result, sizeof(void*));
+        memset(result, 0, sizeof(void*));
+
+        return result;
+    }
+
+    if (!pool->chunks || pool->usedInChunk == pool->chunkCapacity) {
+        if (!addChunk(pool)) {
+            return NULL;
+        }
+    }
+
+    char * slots = (char*) pool->chunks->nodes;
+
+    return slots + (pool->usedInChunk++) * pool->nodeSize;
+}
+
+void poolFree(NodePool* pool, void* node) {
+    if (node) {
+        memset(node, 0, pool->nodeSize);
+        memcpy(node, &(pool->freeList), sizeof(void*));
+        pool->freeList = node;
+    }
+}
+
+void poolForEach(NodePool const* pool, void (*visit)(void*)) {
+    for (PoolChunk * chunk = pool->chunks; chunk; chunk = chunk->next) {
+        size_t used = (chunk == pool->chunks) ? pool->usedInChunk : chunk->used;
+        char * slots = (char*) chunk->nodes;
+
+        for (size_t i = 0; i < used; i++) {
+            visit(slots + i * pool->nodeSize);
+        }
+    }
+}
+
+size_t poolBytes(NodePool const* pool) {
+    size_t bytes = 0;
+
+    // Every chunk but the most recent one is full
+    for (PoolChunk * chunk = pool->chunks; chunk; chunk = chunk->next) {
+        size_t capacity = (chunk == pool->chunks) ? pool->chunkCapacity
+                                                  : chunk->used;
+        bytes += sizeof(PoolChunk) + capacity * pool->nodeSize;
+    }
+
+    return bytes;
+}
+
+void poolRelease(NodePool* pool) {
+    PoolChunk * chunk = pool->chunks;
+
+    while (chunk) {
+        PoolChunk * next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    pool->chunks = NULL;
+    pool->freeList = NULL;
+    pool->usedInChunk = 0;
+    pool->chunkCapacity = 0;
+}
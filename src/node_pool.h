@@ -0,0 +1,100 @@
+/** @file
+ * Interface of the slab allocator for tree nodes
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __NODE_POOL_H__
+#define __NODE_POOL_H__
+
+#include <stddef.h>
+
+/**
+ * This is the structure storing a single chunk of nodes.
+ */
+struct PoolChunk;
+
+/** @struct NodePool
+ * @brief A pool handing out fixed-size nodes from large chunks.
+ * @var NodePool::chunks
+ *      A list of allocated chunks, the most recently allocated first.
+ * @var NodePool::freeList
+ *      A list of released nodes, ready to be handed out again. The link
+ *      to the next released node is stored in the first bytes of the node.
+ * @var NodePool::nodeSize
+ *      The size of a single node in bytes.
+ * @var NodePool::usedInChunk
+ *      The number of nodes handed out from the most recent chunk.
+ * @var NodePool::chunkCapacity
+ *      The number of nodes which fit in the most recent chunk.
+ */
+typedef struct NodePool {
+    struct PoolChunk* chunks;
+    void* freeList;
+    size_t nodeSize;
+    size_t usedInChunk;
+    size_t chunkCapacity;
+} NodePool;  ///< Slab allocator for the nodes of a single type
+
+/** @brief Initializes a pool.
+ * Initializes an empty pool of nodes of the given size. No memory is
+ * allocated until the first node is requested.
+ *
+ * @param[out] pool - a pointer to the pool to be initialized;
+ * @param[in] nodeSize - the size of a single node in bytes, at least the size
+ *                       of a pointer.
+ */
+void poolInit(NodePool* pool, size_t nodeSize);
+
+/** @brief Hands out a node.
+ * Provides zeroed memory for a single node, reusing a released node if there
+ * is one.
+ *
+ * @param[in, out] pool - a pointer to the pool.
+ * @return A pointer to the memory for the node or NULL in case of memory
+ *         allocation failure.
+ */
+void * poolAlloc(NodePool* pool);
+
+/** @brief Releases a node.
+ * Returns a node to the pool so that it can be handed out again. The memory
+ * of the released node is zeroed, except for the first pointer-sized bytes
+ * storing the link to the next released node. It does nothing if the pointer
+ * is NULL.
+ *
+ * @param[in, out] pool - a pointer to the pool;
+ * @param[in] node - a pointer to the node previously obtained from @p pool.
+ */
+void poolFree(NodePool* pool, void* node);
+
+/** @brief Visits all nodes.
+ * Calls @p visit for every slot which has ever been handed out by the pool,
+ * including released ones. Used for freeing memory owned by the nodes before
+ * the whole pool is dropped; the pointers owned by a released node are NULL
+ * unless they are placed at the beginning of the node.
+ *
+ * @param[in] pool - a pointer to the pool;
+ * @param[in] visit - a function called with a pointer to each slot.
+ */
+void poolForEach(NodePool const* pool, void (*visit)(void*));
+
+/** @brief Measures a pool.
+ * Determines the memory allocated for the chunks of the pool, including
+ * the released nodes and the nodes not handed out yet.
+ *
+ * @param[in] pool - a pointer to the pool.
+ * @return The number of bytes allocated for the chunks.
+ */
+size_t poolBytes(NodePool const* pool);
+
+/** @brief Drops a pool.
+ * Frees all chunks of the pool at once, regardless of the nodes still being
+ * handed out. The pool is left empty and can be used again.
+ *
+ * @param[in, out] pool - a pointer to the pool.
+ */
+void poolRelease(NodePool* pool);
+
+#endif /* __NODE_POOL_H__ */
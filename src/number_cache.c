@@ -0,0 +1,237 @@
+/** @file
+ * Implementation of the cache of the redirections of single numbers
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "number_cache.h"
+
+/** @brief Hashes a number.
+ * Computes the FNV-1a hash of the digits.
+ *
+ * @param[in] number - the number;
+ * @param[in] length - the length of the number.
+ * @return The hash of the number.
+ */
+static uint64_t hashNumber(char const* number, size_t length) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) number[i]) * 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+bool cacheInit(NumberCache* cache, uint32_t capacity) {
+    uint32_t numBuckets = 1;
+    while (numBuckets < capacity && numBuckets < (1u << 31)) {
+        numBuckets <<= 1;
+    }
+
+    cache->entries = calloc(capacity, sizeof(NumberCacheEntry));
+    cache->buckets = malloc(numBuckets * sizeof(uint32_t));
+
+    if (!cache->entries || !cache->buckets) {
+        free(cache->entries);
+        free(cache->buckets);
+
+        return false;
+    }
+
+    // Every byte of NUMBER_CACHE_NONE is set
+    memset(cache->buckets, 0xFF, numBuckets * sizeof(uint32_t));
+    cache->capacity = capacity;
+    cache->used = 0;
+    cache->bucketMask = numBuckets - 1;
+    cache->newest = NUMBER_CACHE_NONE;
+    cache->oldest = NUMBER_CACHE_NONE;
+
+    return true;
+}
+
+void cacheRelease(NumberCache* cache) {
+    for (uint32_t i = 0; i < cache->used; i++) {
+        free(cache->entries[i].text);
+    }
+
+    free(cache->entries);
+    free(cache->buckets);
+}
+
+/** @brief Removes an entry from the order of use.
+ *
+ * @param[in, out] cache - a pointer to the cache;
+ * @param[in] index - the index of the entry.
+ */
+static void unlinkUse(NumberCache* cache, uint32_t index) {
+    NumberCacheEntry * entry = &(cache->entries[index]);
+
+    if (entry->newer != NUMBER_CACHE_NONE) {
+        cache->entries[entry->newer].older = entry->older;
+    }
+    else {
+        cache->newest = entry->older;
+    }
+
+    if (entry->older != NUMBER_CACHE_NONE) {
+        cache->entries[entry->older].newer = entry->newer;
+    }
+    else {
+        cache->oldest = entry->newer;
+    }
+}
+
+/** @brief Marks an entry as the most recently used one.
+ * The entry must not be present in the order of use.
+ *
+ * @param[in, out] cache - a pointer to the cache;
+ * @param[in] index - the index of the entry.
+ */
+static void linkNewest(NumberCache* cache, uint32_t index) {
+    NumberCacheEntry * entry = &(cache->entries[index]);
+
+    entry->newer = NUMBER_CACHE_NONE;
+    entry->older = cache->newest;
+
+    if (cache->newest != NUMBER_CACHE_NONE) {
+        cache->entries[cache->newest].newer = index;
+    }
+    else {
+        cache->oldest = index;
+    }
+
+    cache->newest = index;
+}
+
+/** @brief Removes an entry from its bucket.
+ *
+ * @param[in, out] cache - a pointer to the cache;
+ * @param[in] index - the index of the entry.
+ */
+static void unlinkBucket(NumberCache* cache, uint32_t index) {
+    uint32_t * link = &(cache->buckets[cache->entries[index].hash
+                                       & cache->bucketMask]);
+
+    while (*link != index) {
+        link = &(cache->entries[*link].nextInBucket);
+    }
+
+    *link = cache->entries[index].nextInBucket;
+}
+
+/** @brief Finds the entry of a number.
+ * Looks for the entry regardless of its generation.
+ *
+ * @param[in] cache - a pointer to the cache;
+ * @param[in] number - the number;
+ * @param[in] length - the length of the number;
+ * @param[in] hash - the hash of the number.
+ * @return The index of the entry or @ref NUMBER_CACHE_NONE if the number is
+ *         not cached.
+ */
+static uint32_t findEntry(NumberCache const* cache, char const* number,
+                          size_t length, uint64_t hash) {
+    uint32_t index = cache->buckets[hash & cache->bucketMask];
+
+    while (index != NUMBER_CACHE_NONE) {
+        NumberCacheEntry const * entry = &(cache->entries[index]);
+
+        if (entry->hash == hash && entry->numberLength == length
+            && memcmp(entry->text, number, length) == 0) {
+            return index;
+        }
+
+        index = entry->nextInBucket;
+    }
+
+    return NUMBER_CACHE_NONE;
+}
+
+char const * cacheFind(NumberCache* cache, char const* number, size_t length,
+                       uint64_t generation, size_t* forwardedLength) {
+    uint32_t index = findEntry(cache, number, length,
+                               hashNumber(number, length));
+
+    if (index == NUMBER_CACHE_NONE
+        || cache->entries[index].generation != generation) {
+        return NULL;
+    }
+
+    if (cache->newest != index) {
+        unlinkUse(cache, index);
+        linkNewest(cache, index);
+    }
+
+    NumberCacheEntry const * entry = &(cache->entries[index]);
+    *forwardedLength = entry->forwardedLength;
+
+    return entry->text + entry->numberLength + 1;
+}
+
+char * cacheReserve(NumberCache* cache, char const* number, size_t length,
+                    size_t forwardedLength, uint64_t generation) {
+    uint64_t hash = hashNumber(number, length);
+    uint32_t index = findEntry(cache, number, length, hash);
+    bool isFound = index != NUMBER_CACHE_NONE;
+
+    // A never used entry is taken first, then the least recently used one
+    if (!isFound) {
+        index = cache->used < cache->capacity ? cache->used : cache->oldest;
+    }
+
+    NumberCacheEntry * entry = &(cache->entries[index]);
+    size_t needed = length + forwardedLength + 2;
+
+    // The memory is ensured first, so a failure leaves the cache unchanged
+    if (entry->textSlots < needed) {
+        char * text = realloc(entry->text, needed);
+        if (!text) {
+            return NULL;
+        }
+
+        entry->text = text;
+        entry->textSlots = needed;
+    }
+
+    if (isFound) {
+        unlinkUse(cache, index);
+    }
+    else {
+        if (index == cache->used) {
+            cache->used++;
+        }
+        else {
+            unlinkUse(cache, index);
+            unlinkBucket(cache, index);
+        }
+
+        entry->hash = hash;
+        entry->numberLength = length;
+        entry->nextInBucket = cache->buckets[hash & cache->bucketMask];
+        cache->buckets[hash & cache->bucketMask] = index;
+    }
+
+    memcpy(entry->text, number, length);
+    entry->text[length] = '\0';
+    entry->forwardedLength = forwardedLength;
+    entry->generation = generation;
+    linkNewest(cache, index);
+
+    return entry->text + length + 1;
+}
+
+size_t cacheBytes(NumberCache const* cache) {
+    size_t bytes = cache->capacity * sizeof(NumberCacheEntry)
+                   + (cache->bucketMask + (size_t) 1) * sizeof(uint32_t);
+
+    for (uint32_t i = 0; i < cache->used; i++) {
+        bytes += cache->entries[i].textSlots;
+    }
+
+    return bytes;
+}
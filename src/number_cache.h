@@ -0,0 +1,147 @@
+/** @file
+ * Interface of the cache of the redirections of single numbers
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __NUMBER_CACHE_H__
+#define __NUMBER_CACHE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/** @struct NumberCacheEntry
+ * @brief A cached number together with its redirection.
+ * @var NumberCacheEntry::text
+ *      The number followed by the terminating null character and
+ *      the redirected number with its own terminating null character,
+ *      NULL for an unused entry.
+ * @var NumberCacheEntry::textSlots
+ *      The number of the bytes allocated for \link NumberCacheEntry::text
+ *      text \endlink.
+ * @var NumberCacheEntry::numberLength
+ *      The length of the number.
+ * @var NumberCacheEntry::forwardedLength
+ *      The length of the redirected number.
+ * @var NumberCacheEntry::hash
+ *      The hash of the number.
+ * @var NumberCacheEntry::generation
+ *      The generation of the structure the redirection has been computed
+ *      for; the entry is valid only for the same generation.
+ * @var NumberCacheEntry::newer
+ *      The index of the entry used more recently or @ref NUMBER_CACHE_NONE.
+ * @var NumberCacheEntry::older
+ *      The index of the entry used less recently or @ref NUMBER_CACHE_NONE.
+ * @var NumberCacheEntry::nextInBucket
+ *      The index of the next entry with the same bucket or
+ *      @ref NUMBER_CACHE_NONE.
+ */
+typedef struct NumberCacheEntry {
+    char* text;
+    size_t textSlots;
+    size_t numberLength;
+    size_t forwardedLength;
+    uint64_t hash;
+    uint64_t generation;
+    uint32_t newer;
+    uint32_t older;
+    uint32_t nextInBucket;
+} NumberCacheEntry;  ///< A cached number with its redirection
+
+/**
+ * The value of an index which does not point to any entry.
+ */
+#define NUMBER_CACHE_NONE   UINT32_MAX
+
+/** @struct NumberCache
+ * @brief A fixed number of the most recently used numbers with their
+ *      redirections, found by a hash table and evicted in the order of
+ *      the last use.
+ * @var NumberCache::entries
+ *      The entries.
+ * @var NumberCache::buckets
+ *      The indices of the first entries of the buckets of the hash table or
+ *      @ref NUMBER_CACHE_NONE.
+ * @var NumberCache::capacity
+ *      The number of the entries.
+ * @var NumberCache::used
+ *      The number of the entries which have ever been used.
+ * @var NumberCache::bucketMask
+ *      The number of the buckets decreased by one; the number of the buckets
+ *      is a power of two.
+ * @var NumberCache::newest
+ *      The index of the most recently used entry or @ref NUMBER_CACHE_NONE.
+ * @var NumberCache::oldest
+ *      The index of the least recently used entry or @ref NUMBER_CACHE_NONE.
+ */
+typedef struct NumberCache {
+    NumberCacheEntry* entries;
+    uint32_t* buckets;
+    uint32_t capacity;
+    uint32_t used;
+    uint32_t bucketMask;
+    uint32_t newest;
+    uint32_t oldest;
+} NumberCache;  ///< Most recently used redirections of numbers
+
+/** @brief Initializes a cache.
+ * Allocates an empty cache of the given number of entries.
+ *
+ * @param[out] cache - a pointer to the cache to be initialized;
+ * @param[in] capacity - the number of the entries, positive and smaller than
+ *                       @ref NUMBER_CACHE_NONE.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+bool cacheInit(NumberCache* cache, uint32_t capacity);
+
+/** @brief Releases a cache.
+ * Frees the memory of the cache and of its entries.
+ *
+ * @param[in, out] cache - a pointer to the cache.
+ */
+void cacheRelease(NumberCache* cache);
+
+/** @brief Finds a redirection.
+ * Looks for a valid entry of the number and marks it as the most recently
+ * used one.
+ *
+ * @param[in, out] cache - a pointer to the cache;
+ * @param[in] number - the number;
+ * @param[in] length - the length of the number;
+ * @param[in] generation - the current generation of the structure;
+ * @param[out] forwardedLength - the length of the redirected number.
+ * @return A pointer to the redirected number, valid until the next change of
+ *         the cache, or NULL if the number is not cached for @p generation.
+ */
+char const * cacheFind(NumberCache* cache, char const* number, size_t length,
+                       uint64_t generation, size_t* forwardedLength);
+
+/** @brief Reserves an entry for a redirection.
+ * Provides the memory for the redirected number of the given number, reusing
+ * the entry of this number or the least recently used one, and marks it as
+ * the most recently used one. The caller writes the redirected number,
+ * followed by the terminating null character, into the provided memory.
+ *
+ * @param[in, out] cache - a pointer to the cache;
+ * @param[in] number - the number;
+ * @param[in] length - the length of the number;
+ * @param[in] forwardedLength - the length of the redirected number;
+ * @param[in] generation - the current generation of the structure.
+ * @return A pointer to the memory for the redirected number or NULL in case
+ *         of memory allocation failure, in which case the number is not
+ *         cached.
+ */
+char * cacheReserve(NumberCache* cache, char const* number, size_t length,
+                    size_t forwardedLength, uint64_t generation);
+
+/** @brief Measures a cache.
+ *
+ * @param[in] cache - a pointer to the cache.
+ * @return The number of bytes allocated for the cache and its entries.
+ */
+size_t cacheBytes(NumberCache const* cache);
+
+#endif /* __NUMBER_CACHE_H__ */
@@ -14,9 +14,23 @@
 #include <stdlib.h>
 #include <string.h>
 #include "phone_forward.h"
+#include "node_pool.h"
+#include "flat_trie.h"
+#include "number_cache.h"
+#include "journal.h"
 #include <stdint.h>
 #include <stdbool.h>
-#include <ctype.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /**
  * The size of the alphabet of the telephone numbers, counting
@@ -25,18 +39,11 @@
 #define ALPHABET_SIZE       12
 
 /**
- * ASCII code for the character representing the digit zero, corresponding to
- * the beginning of the sequence encoding characters representing digits
- * in ASCII table.
+ * The number of the size classes of the packed arrays of children, holding
+ * 1, 2, 4, 8 and 16 pointers, the last one enough for @ref ALPHABET_SIZE
+ * children.
  */
-#define DIGIT_ASCII_START   48
-
-/**
- * ASCII code for the character representing the digit nine, corresponding to
- * the end of the sequence encoding characters representing digits
- * in ASCII table.
- */
-#define DIGIT_ASCII_END     57
+#define CHILDREN_CLASSES    5
 
 /**
  * The character representing the number ten.
@@ -58,6 +65,53 @@
  */
 #define ELEVEN_VALUE 11
 
+/**
+ * The maximal number of digits labeling a single edge of a tree. A label
+ * is packed into a 64-bit integer, the first digit in the lowest bits.
+ */
+#define MAX_LABEL_LENGTH    16
+
+/**
+ * The number of bits storing a single digit of a packed edge label.
+ */
+#define BITS_PER_DIGIT      4
+
+/**
+ * The mask extracting a single digit of a packed edge label.
+ */
+#define DIGIT_MASK          0xF
+
+/**
+ * The maximal number of redirected nodes moved to make room for a new one
+ * in a sorted array of the redirected nodes before the nodes around the new
+ * one are spread out.
+ */
+#define MAX_FORWARDED_SHIFT 64
+
+/**
+ * The ratio of the used slots to the redirected nodes in an array of
+ * the redirected nodes above which the array is compacted.
+ */
+#define COMPACTION_RATIO    4
+
+/**
+ * The number of the used slots in an array of the redirected nodes below
+ * which the array is never compacted.
+ */
+#define MIN_COMPACTED_SLOTS 16
+
+/**
+ * The suffix of the path of the file an image is written to before it
+ * replaces the file with the requested path.
+ */
+#define TEMPORARY_SUFFIX    ".tmp"
+
+/**
+ * The number of the nodes a compilation copies in the time a snapshot
+ * replays a single change made after the image has been compiled.
+ */
+#define REPLAY_COST         8
+
 struct ForwardedNode;
 
 /** @struct InitialNode
@@ -67,13 +121,16 @@ struct ForwardedNode;
  *      A parent node of the current node.
  * @var InitialNode::forwardingNode
  *      A pointer to the node which stores the information about redirection.
- * @var InitialNode::alphabet
- *      An array storing pointers to children nodes which are sorted according
- *      to the label of the edge leading to the subsequent node. The value
- *      of an index in range from 0 to 9 unambiguously labels the edge.
+ * @var InitialNode::children
+ *      A packed array storing pointers to children nodes which are sorted
+ *      according to the label of the edge leading to the subsequent node.
+ *      The position of a child is the number of the bits set in
+ *      \link InitialNode::childMask childMask \endlink below the bit
+ *      of its label. NULL if the node has no children.
  * @var InitialNode::depth
  *      Depth of the node in a tree, related to the accurate length
- *      of the redirected prefix.
+ *      of the redirected prefix: the number of the digits on the path from
+ *      the root to the end of the edge leading to the node.
  * @var InitialNode::isForwarded
  *      A flag indicating whether the given node is a terminal node for
  *      a prefix which should be redirected; therefore it is the first node
@@ -85,33 +142,43 @@ struct ForwardedNode;
  *      indexForward stores the index in the array of terminal nodes
  *      for forwarded prefixes contained in a node which is responsible
  *      for the final redirection.
- * @var InitialNode::filledEdges
- *      The number of edges leaving the node, equivalent to the number
- *      of the children and the number of indices in
- *      \link InitialNode::alphabet alphabet \endlink which do not indicate NULL.
- * @var InitialNode::edgeLeadingTo
- *      The label of the edge leading to the current node, equivalent to
- *      the index value in \link InitialNode::alphabet alphabet array \endlink
- *      of the parent. // For root is -1
- * @var InitialNode::lastChecked
- *      The index of the last checked element in \link InitialNode::alphabet
- *      alphabet array \endlink, used in the iterative tree traversal.
- * @var InitialNode::initialPrefix
- *      The string associated with the prefix terminating in the current node,
- *      saved for speed-up of redirection lookup and for the future
- *      implementation of phfwdReverse.
+ * @var InitialNode::childMask
+ *      A bitmap of the edges leaving the node: the bit with the number equal
+ *      to the label of an edge is set if the edge exists. The number of
+ *      the bits set is the number of the children.
+ * @var InitialNode::childrenClass
+ *      The size class of \link InitialNode::children children \endlink:
+ *      the array has 2 to the power of childrenClass slots.
+ * @var InitialNode::label
+ *      The packed digits labeling the edge leading to the current node.
+ *      Chains of nodes with single children are collapsed into one edge,
+ *      therefore an edge is labeled with up to @ref MAX_LABEL_LENGTH digits.
+ *      The first digit is equivalent to the number of the bit in
+ *      \link InitialNode::childMask childMask \endlink of the parent.
+ * @var InitialNode::labelLength
+ *      The number of digits in \link InitialNode::label label \endlink.
+ *      For root is 0.
+ * @var InitialNode::prefixKey
+ *      The first @ref MAX_LABEL_LENGTH digits of the prefix terminating in
+ *      the node, packed as by @ref prefixKeyOf; fixed when the node is
+ *      created, as the prefix of a node never changes.
+ *
+ * The prefix terminating in a node is not stored as a string, it is read
+ * from \link InitialNode::prefixKey prefixKey \endlink or from the labels
+ * of the path leading to the node, see @ref writeInitialPath.
  */
 typedef struct InitialNode {
     struct InitialNode* ancestor;
     struct ForwardedNode* forwardingNode;
-    struct InitialNode* alphabet[ALPHABET_SIZE];
+    struct InitialNode** children;
     uint64_t depth;
-    uint8_t isForwarded;
     uint64_t indexForward;
-    uint8_t filledEdges;
-    int edgeLeadingTo; // For root is -1
-    uint32_t lastChecked;
-    char* initialPrefix;
+    uint64_t prefixKey;
+    uint64_t label;
+    uint16_t childMask;
+    uint8_t childrenClass;
+    uint8_t labelLength;
+    uint8_t isForwarded;
 } InitialNode;  ///< Compound struct for storing data about redirected prefixes
 
 /** @struct ForwardedNode
@@ -119,11 +186,12 @@ typedef struct InitialNode {
  *          redirection.
  *  @var ForwardedNode::ancestor
  *          A parental node of the current node.
- *  @var ForwardedNode::alphabet
- *          An array storing pointers to children nodes which are sorted
+ *  @var ForwardedNode::children
+ *          A packed array storing pointers to children nodes which are sorted
  *          according to the label of the edge leading to the subsequent node.
- *          The value of an index in range from 0 to 9 unambiguously labels
- *          the edge.
+ *          The position of a child is the number of the bits set in
+ *          \link ForwardedNode::childMask childMask \endlink below the bit
+ *          of its label. NULL if the node has no children.
  *  @var ForwardedNode::isForwarding
  *          A flag indicating whether the given node is a terminal node for
  *          a prefix describing the final substitution, therefore it is
@@ -139,51 +207,82 @@ typedef struct InitialNode {
  *          removal.
  *  @var ForwardedNode::depth
  *          Depth of the node in a tree, related to the accurate length
- *          of the redirected prefix.
+ *          of the redirected prefix: the number of the digits on the path
+ *          from the root to the end of the edge leading to the node.
  *  @var ForwardedNode::numSlotsForNodes
  *          The number of available slots for storing the pointers to
  *          the redirected nodes, regarding the size of the memory allocated
  *          for \link ForwardedNode::forwardedNodes redirected nodes array
  *          \endlink - includes both non-occupied and assigned slots.
- *  @var ForwardedNode::edgeLeadingTo
- *          The label of the edge leading to the current node, equivalent to
- *          the index value in \link ForwardedNode::alphabet alphabet array
- *          \endlink of the parent. For root is -1.
- *  @var ForwardedNode::lastChecked
- *          The index of the last checked element in \link
- *          ForwardedNode::alphabet alphabet array \endlink, used in the
- *          iterative tree traversal.
+ *  @var ForwardedNode::label
+ *          The packed digits labeling the edge leading to the current node.
+ *          Chains of nodes with single children are collapsed into one edge,
+ *          therefore an edge is labeled with up to @ref MAX_LABEL_LENGTH
+ *          digits. The first digit is equivalent to the number of the bit in
+ *          \link ForwardedNode::childMask childMask \endlink of the parent.
+ *  @var ForwardedNode::labelLength
+ *          The number of digits in \link ForwardedNode::label label
+ *          \endlink. For root is 0.
  *  @var ForwardedNode::forwardedNodes
  *          If the given node is terminal for the given final prefix,
  *          it stores an array of pointers to InitialNode nodes,
  *          which are terminal for the prefixes supposed to be redirected.
  *          If the redirection is removed, NULL is placed at the index
  *          indicating the pointer to a given node.
- *  @var ForwardedNode::forwardedPrefix
- *          The string associated with the prefix terminating in the current
- *          node, saved for speed-up of redirection lookup and for the future
- *          implementation of phfwdReverse.
- *  @var ForwardedNode::filledEdges
- *          The number of edges leaving the node, equivalent to the number
- *          of the children and the number of indices in
- *          \link ForwardedNode::alphabet alphabet \endlink which do not
- *          indicate NULL.
+ *  @var ForwardedNode::childMask
+ *          A bitmap of the edges leaving the node: the bit with the number
+ *          equal to the label of an edge is set if the edge exists. The number
+ *          of the bits set is the number of the children.
+ *  @var ForwardedNode::childrenClass
+ *          The size class of \link ForwardedNode::children children
+ *          \endlink: the array has 2 to the power of childrenClass slots.
+ *
+ *  The prefix terminating in a node is not stored, it is read from the labels
+ *  of the path leading to the node, see @ref writeForwardedPath.
  */
 typedef struct ForwardedNode {
     struct ForwardedNode* ancestor;
-    struct ForwardedNode* alphabet[ALPHABET_SIZE];
-    uint8_t isForwarding;
+    struct ForwardedNode** children;
     uint64_t numForwardedNodes;
     uint64_t sumForwarded;
     uint64_t depth;
     uint64_t numSlotsForNodes;
-    int edgeLeadingTo; // For root is -1
-    uint32_t lastChecked;
     InitialNode** forwardedNodes;
-    char* forwardedPrefix;
-    uint8_t filledEdges;
+    uint64_t label;
+    uint16_t childMask;
+    uint8_t childrenClass;
+    uint8_t labelLength;
+    uint8_t isForwarding;
 } ForwardedNode; ///< Compound struct for storing data about forwarding prefixes
 
+/** @struct SharedImage
+ *  @brief An image of the trees shared by a structure and its snapshots.
+ *
+ *  @var SharedImage::image
+ *      The image, aligned to cache lines.
+ *  @var SharedImage::references
+ *      The number of the structures using the image.
+ */
+typedef struct SharedImage {
+    void* image;
+    atomic_size_t references;
+} SharedImage;  ///< An image shared by the structures using it
+
+/** @struct TreePool
+ *  @brief Pools handing out the memory of the nodes of a single tree.
+ *
+ *  @var TreePool::nodes
+ *      A pool handing out the nodes.
+ *  @var TreePool::children
+ *      Pools handing out the packed arrays of children, one for every size
+ *      class: the pool with index c hands out arrays of 2 to the power of c
+ *      pointers.
+ */
+typedef struct TreePool {
+    NodePool nodes;
+    NodePool children[CHILDREN_CLASSES];
+} TreePool;  ///< Slab allocators for the nodes and arrays of a tree
+
 /** @struct PhoneForward
  *  @brief A storage for root nodes - trees responsible for storing
  *  information about forwarded and forwarding prefixes.
@@ -194,27 +293,118 @@ typedef struct ForwardedNode {
  *  @var PhoneForward::initialRoot
  *      A root of the tree responsible for storing data related to
  *      the redirected prefixes.
+ *  @var PhoneForward::initialPool
+ *      Pools handing out the nodes and the arrays of children of the tree
+ *      rooted in
+ *      \link PhoneForward::initialRoot initialRoot \endlink.
+ *  @var PhoneForward::forwardedPool
+ *      Pools handing out the nodes and the arrays of children of the tree
+ *      rooted in
+ *      \link PhoneForward::forwardedRoot forwardedRoot \endlink.
+ *  @var PhoneForward::flat
+ *      A view of the image of the trees which serves the lookups instead of
+ *      the trees if it is not empty.
+ *  @var PhoneForward::mapping
+ *      The file mapped into memory with the image viewed by
+ *      \link PhoneForward::flat flat \endlink or NULL. The structure with
+ *      a mapped file is read-only and its trees are empty.
+ *  @var PhoneForward::mappingLength
+ *      The size of \link PhoneForward::mapping mapping \endlink in bytes.
+ *  @var PhoneForward::compiled
+ *      The image built from the trees by @ref phfwdCompile and shared with
+ *      the snapshots, or NULL. It is viewed by \link PhoneForward::flat flat
+ *      \endlink until the first modification, after which it is kept
+ *      together with \link PhoneForward::changes changes \endlink only if
+ *      a snapshot has shared it.
+ *  @var PhoneForward::changes
+ *      The modifications made since \link PhoneForward::compiled compiled
+ *      \endlink has been built, in their order, or NULL if there are none.
+ *  @var PhoneForward::replayedChanges
+ *      The number of the changes replayed by the snapshots taken since
+ *      \link PhoneForward::compiled compiled \endlink has been built.
+ *  @var PhoneForward::isShared
+ *      A flag indicating whether a snapshot has shared
+ *      \link PhoneForward::compiled compiled \endlink.
+ *  @var PhoneForward::cache
+ *      The recently found redirections of single numbers or NULL if
+ *      the cache is disabled.
+ *  @var PhoneForward::generation
+ *      The number of the modifications of the structure, changed by every
+ *      call which may modify it; the cached redirections found for another
+ *      generation are outdated.
+ *  @var PhoneForward::journal
+ *      The journal the modifications are recorded in or NULL if it is
+ *      disabled.
+ *  @var PhoneForward::isReadOnly
+ *      A flag indicating a structure serving a mapped file or a snapshot,
+ *      which cannot be modified.
+ *  @var PhoneForward::isOverlaid
+ *      A flag indicating a snapshot whose trees hold the changes made after
+ *      its image has been built, which are checked before the image.
+ *      The trees of the other read-only structures are empty.
  */
 typedef struct PhoneForward {
     ForwardedNode* forwardedRoot;
     InitialNode* initialRoot;
+    TreePool initialPool;
+    TreePool forwardedPool;
+    FlatTrie flat;
+    void* mapping;
+    size_t mappingLength;
+    SharedImage* compiled;
+    PhoneForwardTransaction* changes;
+    size_t replayedChanges;
+    bool isShared;
+    NumberCache* cache;
+    uint64_t generation;
+    Journal* journal;
+    bool isReadOnly;
+    bool isOverlaid;
 } PhoneForward;  ///< Final struct for storing data about forwarding
 
+/**
+ * The offset of a missing number in a sequence of numbers.
+ */
+#define NO_NUMBER           SIZE_MAX
+
 /** @struct PhoneNumbers
  * @brief Struct for storing the full phone numbers retrieved from PhoneForward.
- * @var PhoneNumbers::numbers
- *      An array storing full phone numbers
+ * @var PhoneNumbers::offsets
+ *      An array storing the offsets of the numbers in
+ *      \link PhoneNumbers::text text \endlink, @ref NO_NUMBER for a missing
+ *      number.
+ * @var PhoneNumbers::text
+ *      The numbers, each followed by the terminating null character, placed
+ *      one after another.
  * @var PhoneNumbers::slots
- *      Number of available slots in \link PhoneNumbers::numbers number array
+ *      Number of available slots in \link PhoneNumbers::offsets offset array
  *      \endlink, resulting from memory allocation.
  * @var PhoneNumbers::lastAvailableIndex
- *      The last non-occupied index in \link PhoneNumbers::numbers number array
- *      \endlink
+ *      The last non-occupied index in \link PhoneNumbers::offsets offset
+ *      array \endlink
+ * @var PhoneNumbers::textLength
+ *      The number of the used bytes of \link PhoneNumbers::text text
+ *      \endlink.
+ * @var PhoneNumbers::textSlots
+ *      The number of the bytes allocated for \link PhoneNumbers::text text
+ *      \endlink.
+ * @var PhoneNumbers::isSingleBlock
+ *      A flag indicating whether the structure, the array of offsets and
+ *      the numbers themselves have been allocated as one block of memory,
+ *      which is freed at once.
+ * @var PhoneNumbers::reverseIter
+ *      The cursor which has filled the structure in @ref phfwdReverseReuse,
+ *      kept together with its memory for the next call, or NULL.
  */
 typedef struct PhoneNumbers {
-    char** numbers;
+    size_t* offsets;
+    char* text;
     uint64_t slots;
     uint64_t lastAvailableIndex;
+    size_t textLength;
+    size_t textSlots;
+    uint8_t isSingleBlock;
+    PhoneReverseIter * reverseIter;
 } PhoneNumbers;  ///< Final struct for storing full numbers
 
 /** @brief Sets a flag bit.
@@ -267,234 +457,520 @@ static bool isForwardSet(uint8_t flag) {
     return (flag & (uint8_t) 1) != 0;
 }
 
-/** @brief Creates and initializes a node.
- *  Creates and initializes the node responsible for storing the information
- *  about the prefixes supposed to be redirected.
+/** @brief Sets the pin bit of a flag.
+ * Marks a node reached by a staged redirection of a transaction, which must
+ * not be removed nor merged with its child until the transaction ends, see
+ * @ref phfwdTransactionCommit.
  *
- * @param[in] ancestor - a parental node of the initialized node.
- * @param[in] depth - depth of the level at which the node is supposed to be
- *                    assigned to the tree
- * @param[in] edgeLeadingTo - the label of the edge leading to the initialized
- *                            node
- *
- * @return An initialized node or NULL in case of memory allocation failure.
+ * @param[in, out] flag - a pointer to isForwarding or isForwarded struct field.
  */
-static InitialNode * initInitialNode(InitialNode* ancestor, uint64_t depth,
-                              int edgeLeadingTo) {
-    InitialNode * result = malloc(sizeof (InitialNode));
-    if (!result) {
-        return NULL;
-    }
+static void setBitPinned(uint8_t * flag) {
+    *flag |= (uint8_t) 2;
+}
 
-    result->ancestor = ancestor;
-    result->forwardingNode = NULL;
-    result->depth = depth;
-    result->isForwarded = 0;
-    result->indexForward = 0;
-    result->filledEdges = 0;
-    result->lastChecked = 0;
-    result->initialPrefix = NULL;
-    result->edgeLeadingTo = edgeLeadingTo;
+/** @brief Clears the pin bit of a flag.
+ *
+ * @param[in, out] flag - a pointer to isForwarding or isForwarded struct field.
+ */
+static void clearBitPinned(uint8_t * flag) {
+    *flag &= ~(uint8_t) 2;
+}
 
-    for (int i = 0; i < ALPHABET_SIZE; i++) {
-        result->alphabet[i] = NULL;
-    }
+/** @brief Checks the pin bit of a flag.
+ *
+ * @param[in] flag  - the value of a isForwarding or isForwarded struct field.
+ *
+ * @return True if the node is pinned by a transaction, false otherwise.
+ */
+static bool isPinnedSet(uint8_t flag) {
+    return (flag & (uint8_t) 2) != 0;
+}
 
-    return result;
+/** @brief Sets the removal bit of a flag.
+ * Marks the node of a prefix removed after the image of a snapshot has been
+ * built, which hides the redirections of the image starting with the prefix.
+ * The node is pinned as well, so it is never removed from the snapshot.
+ *
+ * @param[in, out] flag - a pointer to isForwarded struct field.
+ */
+static void setBitRemoved(uint8_t * flag) {
+    *flag |= (uint8_t) 6;
 }
 
-/** @brief Creates and initializes a node.
- *  Creates and initializes the node responsible for storing the information
- *  about the prefixes supposed to represent the final redirection.
+/** @brief Checks the removal bit of a flag.
  *
- * @param[in] ancestor - a parental node of the initialized node.
- * @param[in] depth - depth of the level at which the node is supposed to be
- *                    assigned to the tree
- * @param[in] edgeLeadingTo - the label of the edge leading to the initialized
- *                            node
+ * @param[in] flag  - the value of a isForwarded struct field.
  *
- * @return An initialized node or NULL in case of memory allocation failure.
+ * @return True if the node marks a removed prefix, false otherwise.
  */
-static ForwardedNode * initForwardedNode(ForwardedNode* ancestor,
-                                         uint64_t depth, int edgeLeadingTo) {
-    ForwardedNode * result = malloc(sizeof (ForwardedNode));
-    if (!result) {
-        return NULL;
-    }
+static bool isRemovedSet(uint8_t flag) {
+    return (flag & (uint8_t) 4) != 0;
+}
 
-    result->isForwarding = 0;
+/** @brief Provides a digit of an edge label.
+ *
+ * @param[in] label - the packed label of an edge;
+ * @param[in] position - the position of the digit in the label, counting
+ *                       from zero.
+ * @return The value of the digit at the given position.
+ */
+static uint32_t labelDigit(uint64_t label, uint32_t position) {
+    return (uint32_t) (label >> (position * BITS_PER_DIGIT)) & DIGIT_MASK;
+}
 
-    result->ancestor = ancestor;
-    result->forwardedPrefix = NULL;
-    result->filledEdges = 0;
-    result->depth = depth;
-    result->sumForwarded = 0;
-    result->edgeLeadingTo = edgeLeadingTo;
-    result->lastChecked = 0;
+/** @brief Counts the children of a node.
+ * Counts the bits set in the bitmap of the edges leaving a node.
+ *
+ * @param[in] mask - the value of a childMask struct field.
+ * @return The number of the children of the node.
+ */
+static uint32_t countChildren(uint16_t mask) {
+    return (uint32_t) __builtin_popcount(mask);
+}
 
-    result->numForwardedNodes = 0;
-    result->numSlotsForNodes = 0;
-    result->forwardedNodes = NULL;
+/** @brief Finds the position of a child.
+ * Finds the position of the child reached through the edge labeled with
+ * @p digit in the packed array of children: the number of the edges leaving
+ * the node with smaller labels.
+ *
+ * @param[in] mask - the value of a childMask struct field;
+ * @param[in] digit - the label of the edge leading to the child.
+ * @return The index of the child in the packed array of children.
+ */
+static uint32_t childPosition(uint16_t mask, uint32_t digit) {
+    return countChildren(mask & (uint16_t) ((1u << digit) - 1));
+}
 
-    for (int i = 0; i < ALPHABET_SIZE; i++) {
-        result->alphabet[i] = NULL;
-    }
+/** @brief Checks whether an edge exists.
+ *
+ * @param[in] mask - the value of a childMask struct field;
+ * @param[in] digit - the label of the edge.
+ * @return @p True if the edge labeled with @p digit leaves the node,
+ *         @p false otherwise.
+ */
+static bool hasChild(uint16_t mask, uint32_t digit) {
+    return (mask & (1u << digit)) != 0;
+}
 
-    return result;
-};
+/** @brief Provides the size class of an array of children.
+ *
+ * @param[in] count - the number of the children, at least 1.
+ * @return The smallest size class with at least @p count slots.
+ */
+static uint32_t childrenClassOf(uint32_t count) {
+    return count <= 1 ? 0 : 32 - (uint32_t) __builtin_clz(count - 1);
+}
 
-PhoneForward * phfwdNew(void) {
-    PhoneForward * result = malloc(sizeof(PhoneForward));
+/** @brief Moves a packed array of children to another size class.
+ * Hands out an array of the size class @p newClass and copies the pointers
+ * of @p children to it, leaving a free slot at @p position if the array
+ * grows or omitting the pointer at @p position if it shrinks. The old array
+ * is returned to the pool of its size class.
+ *
+ * @param[in, out] pool - pools handing out the memory of the tree;
+ * @param[in] children - the packed array of children or NULL;
+ * @param[in] oldClass - the size class of @p children;
+ * @param[in] count - the number of the pointers in @p children;
+ * @param[in] newCount - the number of the pointers after the change, one
+ *                       more or one less than @p count;
+ * @param[in] newClass - the size class of the new array;
+ * @param[in] position - the index of the inserted or removed pointer.
+ * @return The new array or NULL in case of memory allocation failure,
+ *         in which case @p children is left unchanged.
+ */
+static void * moveChildren(TreePool * pool, void * children,
+                           uint32_t oldClass, uint32_t count,
+                           uint32_t newCount, uint32_t newClass,
+                           uint32_t position) {
+    char * result = poolAlloc(&(pool->children[newClass]));
     if (!result) {
         return NULL;
     }
 
-    result->forwardedRoot = initForwardedNode(NULL, 0, -1);
-    if (!result->forwardedRoot) {
-        free(result);
-
-        return NULL;
-    }
-
-    result->initialRoot = initInitialNode(NULL, 0, -1);
-    if (!result->initialRoot) {
-        free(result->forwardedRoot);
-        free(result);
+    if (children) {
+        uint32_t skipped = newCount < count ? 1 : 0;
+        uint32_t gap = newCount > count ? 1 : 0;
 
-        return NULL;
+        memcpy(result, children, position * sizeof(void*));
+        memcpy(result + (position + gap) * sizeof(void*),
+               (char*) children + (position + skipped) * sizeof(void*),
+               (count - position - skipped) * sizeof(void*));
+        poolFree(&(pool->children[oldClass]), children);
     }
 
     return result;
 }
 
-/** @brief Adds a node to an array.
- *  Adds a node storing information about a redirected prefix - to the array
- *  of terminal nodes for redirected prefixes. An array is contained in
- *  the specific node to whom the prefixes are redirected.
+/** @brief Returns a packed array of children to its pool.
  *
- * @param[in, out] toBeForwarded - a terminal node for a redirected prefix
- * @param[in, out] finalForward - a terminal node for the final redirection.
+ * @param[in, out] pool - pools handing out the memory of the tree;
+ * @param[in] children - the packed array of children or NULL;
+ * @param[in] childrenClass - the size class of @p children.
+ */
+static void freeChildren(TreePool * pool, void * children,
+                         uint32_t childrenClass) {
+    if (children) {
+        poolFree(&(pool->children[childrenClass]), children);
+    }
+}
+
+/** @brief Inserts a child into a node.
+ * Places @p child at the position corresponding to its label in the packed
+ * array of children, moving the array to the next size class if it is full.
  *
+ * @param[in, out] pool - pools handing out the memory of the tree;
+ * @param[in, out] node - a node of the tree storing the redirected prefixes;
+ * @param[in] child - a pointer to the inserted child, with the label
+ *                    of the edge leading to it already set.
  * @return @p False in case of memory allocation failure, @p true otherwise.
  */
-static bool addForwardedNode(InitialNode* toBeForwarded, ForwardedNode*
-                            finalForward) {
-    uint64_t * slots = &(finalForward->numSlotsForNodes);
-    uint64_t * numNodes = &(finalForward->numForwardedNodes);
-
-    if (*slots <= *numNodes) {
-        uint64_t newSlots = (*slots)*2 + 1;
-        InitialNode ** newNodeArray = realloc(finalForward->forwardedNodes,
-                                              newSlots * sizeof(InitialNode*));
-
-        if (!newNodeArray) {
+static bool insertInitialChild(TreePool * pool, InitialNode * node,
+                               InitialNode * child) {
+    uint32_t digit = labelDigit(child->label, 0);
+    uint32_t count = countChildren(node->childMask);
+    uint32_t position = childPosition(node->childMask, digit);
+
+    if (!node->children || count == (1u << node->childrenClass)) {
+        uint32_t newClass = childrenClassOf(count + 1);
+        InitialNode ** newChildren = moveChildren(pool, node->children,
+                                                  node->childrenClass, count,
+                                                  count + 1, newClass,
+                                                  position);
+        if (!newChildren) {
             return false;
         }
 
-        finalForward->forwardedNodes = newNodeArray;
-        *slots = newSlots;
+        node->children = newChildren;
+        node->childrenClass = (uint8_t) newClass;
     }
-
-    if (isForwardSet(toBeForwarded->isForwarded)) {
-        ForwardedNode * previousForward = toBeForwarded->forwardingNode;
-        uint64_t previousIndex = toBeForwarded->indexForward;
-
-        previousForward->forwardedNodes[previousIndex] = NULL;
-        (previousForward->sumForwarded)--;
+    else {
+        memmove(node->children + position + 1, node->children + position,
+                (count - position) * sizeof(InitialNode*));
     }
 
-    finalForward->forwardedNodes[(*numNodes)] = toBeForwarded;
-    toBeForwarded->indexForward = (*numNodes)++;
-    toBeForwarded->forwardingNode = finalForward;
-    (finalForward->sumForwarded)++;
+    node->children[position] = child;
+    node->childMask |= (uint16_t) (1u << digit);
 
     return true;
 }
 
-/** @brief Adds prefix to a node and sets a flag.
- * Adds a final prefix to the terminal node corresponding to the given prefix
- * and set isForwarding flag in order to indicate that the passed node
- * participates in the redirection.
- *
- * @param[in, out] finalForward - the terminal node corresponding to the final
- *                                prefix
- * @param[in] prefix - the final prefix associated with the given node.
+/** @brief Inserts a child into a node.
+ * Places @p child at the position corresponding to its label in the packed
+ * array of children, moving the array to the next size class if it is full.
  *
+ * @param[in, out] pool - pools handing out the memory of the tree;
+ * @param[in, out] node - a node of the tree storing the final prefixes;
+ * @param[in] child - a pointer to the inserted child, with the label
+ *                    of the edge leading to it already set.
  * @return @p False in case of memory allocation failure, @p true otherwise.
  */
-static bool addPrefixForwardAndSetForward(ForwardedNode* finalForward,
-                                          const char* prefix) {
-    // If it has been previously set - the value of the string is the same
-    if (!isForwardSet(finalForward->isForwarding)) {
-        finalForward->forwardedPrefix = strdup(prefix);
-
-        if (!(finalForward->forwardedPrefix)) {
+static bool insertForwardedChild(TreePool * pool, ForwardedNode * node,
+                                 ForwardedNode * child) {
+    uint32_t digit = labelDigit(child->label, 0);
+    uint32_t count = countChildren(node->childMask);
+    uint32_t position = childPosition(node->childMask, digit);
+
+    if (!node->children || count == (1u << node->childrenClass)) {
+        uint32_t newClass = childrenClassOf(count + 1);
+        ForwardedNode ** newChildren = moveChildren(pool, node->children,
+                                                    node->childrenClass,
+                                                    count, count + 1,
+                                                    newClass, position);
+        if (!newChildren) {
             return false;
         }
 
-        setBitForward(&(finalForward->isForwarding));
+        node->children = newChildren;
+        node->childrenClass = (uint8_t) newClass;
+    }
+    else {
+        memmove(node->children + position + 1, node->children + position,
+                (count - position) * sizeof(ForwardedNode*));
     }
 
+    node->children[position] = child;
+    node->childMask |= (uint16_t) (1u << digit);
+
     return true;
 }
 
-/** @brief Adds prefix to a node and sets a flag.
- *  Adds a final prefix to the terminal node corresponding to the given
- *  original prefix and sets isForwarded flag in order to indicate that
- *  the passed node participates in the redirection.
+/** @brief Removes a child from a node.
+ * Removes the child reached through the edge labeled with @p digit from
+ * the packed array. The array is moved to a smaller size class once it is
+ * at most a quarter full, so that alternating insertions and removals do not
+ * move it every time, and returned to its pool after removing the last child.
  *
- *  @param[in, out] init - the terminal node corresponding to the redirected
- *                         prefix
- *
- *  @param[in] prefix - the final prefix associated with the given node.
- *
- *  @return @p False in case of memory allocation failure, @p true otherwise.
+ * @param[in, out] pool - pools handing out the memory of the tree;
+ * @param[in, out] node - a node of the tree storing the redirected prefixes;
+ * @param[in] digit - the label of the edge leading to the removed child.
  */
-static bool addPrefixInitialAndSetForward(InitialNode * init,
-                                          const char* prefix) {
-    // Temporary array enables saving the previous content
-    char* copiedPrefix = strdup(prefix);
+static void removeInitialChild(TreePool * pool, InitialNode * node,
+                               uint32_t digit) {
+    uint32_t count = countChildren(node->childMask);
+    uint32_t position = childPosition(node->childMask, digit);
 
-    if (!(copiedPrefix)) {
-        return false;
+    node->childMask &= (uint16_t) ~(1u << digit);
+
+    if (count == 1) {
+        freeChildren(pool, node->children, node->childrenClass);
+        node->children = NULL;
+        node->childrenClass = 0;
+
+        return;
     }
 
-    if (isForwardSet(init->isForwarded)) {
-        free(init->initialPrefix);
+    // A failed move leaves the larger array, which is still valid
+    if (4 * (count - 1) <= (1u << node->childrenClass)) {
+        uint32_t newClass = childrenClassOf(count - 1);
+        InitialNode ** newChildren = moveChildren(pool, node->children,
+                                                  node->childrenClass, count,
+                                                  count - 1, newClass,
+                                                  position);
+        if (newChildren) {
+            node->children = newChildren;
+            node->childrenClass = (uint8_t) newClass;
+
+            return;
+        }
     }
-    else {
-        setBitForward(&(init->isForwarded));
+
+    memmove(node->children + position, node->children + position + 1,
+            (count - position - 1) * sizeof(InitialNode*));
+}
+
+/** @brief Removes a child from a node.
+ * Removes the child reached through the edge labeled with @p digit from
+ * the packed array. The array is moved to a smaller size class once it is
+ * at most a quarter full, so that alternating insertions and removals do not
+ * move it every time, and returned to its pool after removing the last child.
+ *
+ * @param[in, out] pool - pools handing out the memory of the tree;
+ * @param[in, out] node - a node of the tree storing the final prefixes;
+ * @param[in] digit - the label of the edge leading to the removed child.
+ */
+static void removeForwardedChild(TreePool * pool, ForwardedNode * node,
+                                 uint32_t digit) {
+    uint32_t count = countChildren(node->childMask);
+    uint32_t position = childPosition(node->childMask, digit);
+
+    node->childMask &= (uint16_t) ~(1u << digit);
+
+    if (count == 1) {
+        freeChildren(pool, node->children, node->childrenClass);
+        node->children = NULL;
+        node->childrenClass = 0;
+
+        return;
     }
 
-    init->initialPrefix = copiedPrefix;
+    // A failed move leaves the larger array, which is still valid
+    if (4 * (count - 1) <= (1u << node->childrenClass)) {
+        uint32_t newClass = childrenClassOf(count - 1);
+        ForwardedNode ** newChildren = moveChildren(pool, node->children,
+                                                    node->childrenClass,
+                                                    count, count - 1,
+                                                    newClass, position);
+        if (newChildren) {
+            node->children = newChildren;
+            node->childrenClass = (uint8_t) newClass;
 
-    return true;
+            return;
+        }
+    }
+
+    memmove(node->children + position, node->children + position + 1,
+            (count - position - 1) * sizeof(ForwardedNode*));
 }
 
-/** @brief Evaluates alphabetical compatibility of the given character.
- * Checks whether the given character belongs to the alphabet of phone numbers.
+/** @brief Provides a child of a node.
  *
- * @param[in] c - the character to be validated.
- * @return @p True if the character belongs to the phone numbers alphabet,
- * @p false otherwise.
+ * @param[in] node - a node of the tree storing the redirected prefixes;
+ * @param[in] digit - the label of the edge leading to the child.
+ * @return A pointer to the child or NULL if there is no such edge.
  */
-static bool isPhoneDigit(char c) {
-    if (isdigit(c)) {
-        return true;
+static InitialNode * getInitialChild(InitialNode const * node,
+                                     uint32_t digit) {
+    if (!hasChild(node->childMask, digit)) {
+        return NULL;
     }
-    else {
-        if (c == TEN || c == ELEVEN) {
-            return true;
-        }
-        else{
-            return false;
+
+    return node->children[childPosition(node->childMask, digit)];
+}
+
+/** @brief Provides a child of a node.
+ *
+ * @param[in] node - a node of the tree storing the final prefixes;
+ * @param[in] digit - the label of the edge leading to the child.
+ * @return A pointer to the child or NULL if there is no such edge.
+ */
+static ForwardedNode * getForwardedChild(ForwardedNode const * node,
+                                         uint32_t digit) {
+    if (!hasChild(node->childMask, digit)) {
+        return NULL;
+    }
+
+    return node->children[childPosition(node->childMask, digit)];
+}
+
+/** @brief Replaces a child of a node.
+ * Places @p child in the slot of the packed array of children occupied by
+ * the previous child reached through the edge with the same first digit.
+ *
+ * @param[in, out] node - a node of the tree storing the redirected prefixes;
+ * @param[in] child - a pointer to the child taking the slot.
+ */
+static void replaceInitialChild(InitialNode * node, InitialNode * child) {
+    uint32_t digit = labelDigit(child->label, 0);
+
+    node->children[childPosition(node->childMask, digit)] = child;
+}
+
+/** @brief Replaces a child of a node.
+ * Places @p child in the slot of the packed array of children occupied by
+ * the previous child reached through the edge with the same first digit.
+ *
+ * @param[in, out] node - a node of the tree storing the final prefixes;
+ * @param[in] child - a pointer to the child taking the slot.
+ */
+static void replaceForwardedChild(ForwardedNode * node, ForwardedNode * child) {
+    uint32_t digit = labelDigit(child->label, 0);
+
+    node->children[childPosition(node->childMask, digit)] = child;
+}
+
+/**
+ * The codes of the characters: the value of a digit increased by one for
+ * the characters of the alphabet of phone numbers, 0 for the other ones,
+ * including the terminating null character.
+ */
+static uint8_t const DIGIT_CODES[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    [TEN] = TEN_VALUE + 1, [ELEVEN] = ELEVEN_VALUE + 1
+};
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#if defined(__AVX2__)
+/**
+ * The number of the characters validated at once.
+ */
+#define VECTOR_SIZE         32
+
+/**
+ * A vector of @ref VECTOR_SIZE characters.
+ */
+typedef __m256i CharVector;
+
+/** @brief Finds the characters which are not digits.
+ *
+ * @param[in] block - a pointer to @ref VECTOR_SIZE characters of a string.
+ * @return The bitmap of the characters of @p block which do not belong to
+ *         the alphabet of phone numbers, the first character in the lowest
+ *         bit.
+ */
+static uint32_t findNonDigits(char const * block) {
+    __m256i chars = _mm256_loadu_si256((CharVector const *) block);
+
+    // The digits are the only characters below '0' + 10 after the shift
+    __m256i shifted = _mm256_xor_si256(
+            _mm256_sub_epi8(chars, _mm256_set1_epi8('0')),
+            _mm256_set1_epi8((char) 0x80));
+    __m256i isDigit = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (0x80 + 10)),
+                                        shifted);
+    __m256i isValid = _mm256_or_si256(
+            isDigit,
+            _mm256_or_si256(_mm256_cmpeq_epi8(chars, _mm256_set1_epi8(TEN)),
+                            _mm256_cmpeq_epi8(chars,
+                                              _mm256_set1_epi8(ELEVEN))));
+
+    return ~(uint32_t) _mm256_movemask_epi8(isValid);
+}
+#else
+/**
+ * The number of the characters validated at once.
+ */
+#define VECTOR_SIZE         16
+
+/**
+ * A vector of @ref VECTOR_SIZE characters.
+ */
+typedef __m128i CharVector;
+
+/** @brief Finds the characters which are not digits.
+ *
+ * @param[in] block - a pointer to @ref VECTOR_SIZE characters of a string.
+ * @return The bitmap of the characters of @p block which do not belong to
+ *         the alphabet of phone numbers, the first character in the lowest
+ *         bit.
+ */
+static uint32_t findNonDigits(char const * block) {
+    __m128i chars = _mm_loadu_si128((CharVector const *) block);
+
+    // The digits are the only characters below '0' + 10 after the shift
+    __m128i shifted = _mm_xor_si128(_mm_sub_epi8(chars, _mm_set1_epi8('0')),
+                                    _mm_set1_epi8((char) 0x80));
+    __m128i isDigit = _mm_cmplt_epi8(shifted,
+                                     _mm_set1_epi8((char) (0x80 + 10)));
+    __m128i isValid = _mm_or_si128(
+            isDigit,
+            _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(TEN)),
+                         _mm_cmpeq_epi8(chars, _mm_set1_epi8(ELEVEN))));
+
+    return ~(uint32_t) _mm_movemask_epi8(isValid) & 0xFFFF;
+}
+#endif
+
+/** @brief Counts the digits at the beginning of a string.
+ * Validates @ref VECTOR_SIZE characters at once. Only the blocks lying
+ * inside the string are loaded, the rest is validated character by
+ * character.
+ *
+ * @param[in] number - a pointer to the string.
+ * @return The index of the first character of @p number which is not
+ *         a digit, possibly the terminating null character.
+ */
+static size_t countDigits(char const * number) {
+    size_t length = strlen(number);
+    size_t index = 0;
+
+    while (length - index >= VECTOR_SIZE) {
+        uint32_t nonDigits = findNonDigits(number + index);
+
+        if (nonDigits != 0) {
+            return index + (size_t) __builtin_ctz(nonDigits);
         }
+
+        index += VECTOR_SIZE;
+    }
+
+    // The terminating null character is never a digit
+    while (DIGIT_CODES[(unsigned char) number[index]] != 0) {
+        index++;
+    }
+
+    return index;
+}
+#else
+/** @brief Counts the digits at the beginning of a string.
+ *
+ * @param[in] number - a pointer to the string.
+ * @return The index of the first character of @p number which is not
+ *         a digit, possibly the terminating null character.
+ */
+static size_t countDigits(char const * number) {
+    size_t index = 0;
+
+    while (DIGIT_CODES[(unsigned char) number[index]] != 0) {
+        index++;
     }
+
+    return index;
 }
+#endif
 
 /** @brief Checks the length of a string.
  *  Checks the length of a string and validates the correctness of the passed
- *  argument.
+ *  argument in a single pass.
  *
  * @param[in] number - char * array containing the phone number
  *
@@ -506,9 +982,7 @@ static size_t checkLength(const char * number) {
         return 0;
     }
 
-    size_t index = 0;
-
-    while (isPhoneDigit(number[index]) && number[index] != '\0') index++;
+    size_t index = countDigits(number);
 
     if (number[index] != '\0') {
         return 0;
@@ -519,7 +993,8 @@ static size_t checkLength(const char * number) {
 }
 
 /** @brief Converts a char to an int
- * Converts a char to the integer value of the number it represents graphically.
+ * Converts a char to the integer value of the number it represents graphically,
+ * reading it from @ref DIGIT_CODES without branching.
  *
  * @param[in] c - a char to convert
  * @return The integer value of the number the passed char represents
@@ -527,837 +1002,5166 @@ static size_t checkLength(const char * number) {
  * not overflow.
  */
 static uint32_t getIndex(char c) {
-    if (c >= DIGIT_ASCII_START && c <= DIGIT_ASCII_END) {
-        return c - '0';
-    }
-    else {
-        if (c == TEN) {
-            return TEN_VALUE;
-        }
-        else {
-            return ELEVEN_VALUE;
-        }
-    }
+    return (uint32_t) DIGIT_CODES[(unsigned char) c] - 1;
 }
 
-bool phfwdAdd(PhoneForward *pfd, char const *num1, char const *num2) {
-    if (!pfd) {
-        return false;
-    }
-
-    size_t len1 = checkLength(num1);
-    if (len1 == 0) {
-        return false;
-    }
-
-    size_t len2 = checkLength(num2);
-    if (len2 == 0) {
-        return false;
-    }
+/** @brief Packs a part of a number into an edge label.
+ * Packs the digits of a validated number into an edge label, the first digit
+ * in the lowest bits.
+ *
+ * @param[in] digits - a pointer to the first digit to be packed;
+ * @param[in] length - the number of digits to be packed, at most
+ *                     @ref MAX_LABEL_LENGTH.
+ * @return The packed label.
+ */
+static uint64_t packLabel(char const * digits, uint32_t length) {
+    uint64_t label = 0;
 
-    if (strcmp(num1, num2) == 0) {
-        return false;
+    for (uint32_t i = 0; i < length; i++) {
+        label |= (uint64_t) getIndex(digits[i]) << (i * BITS_PER_DIGIT);
     }
 
-    uint64_t depth = 0;
-    InitialNode * currentInitial = pfd->initialRoot;
-    uint32_t digit;
+    return label;
+}
 
-    // Extending the path for redirected prefix
-    while (depth < len1) {
-        digit = getIndex(num1[depth]);
-        
-        if (!(currentInitial->alphabet[digit])) {
-            InitialNode * newNode = initInitialNode(currentInitial,
-                                                    ++depth, digit);
-            if (!newNode) {
-                return false;
-            }
+#if defined(__SSE2__)
+/** @brief Packs the longest possible edge label.
+ * Decodes and packs @ref MAX_LABEL_LENGTH digits at once: the values of
+ * the digits are computed in parallel and the neighbouring ones are merged
+ * into bytes.
+ *
+ * @param[in] digits - a pointer to the first digit to be packed, followed by
+ *                     at least @ref MAX_LABEL_LENGTH - 1 digits.
+ * @return The packed label.
+ */
+static uint64_t packFullLabel(char const * digits) {
+    __m128i chars = _mm_loadu_si128((__m128i const *) digits);
+    __m128i values = _mm_sub_epi8(chars, _mm_set1_epi8('0'));
+
+    // The characters of ten and eleven precede '0' in ASCII
+    __m128i isTen = _mm_cmpeq_epi8(chars, _mm_set1_epi8(TEN));
+    __m128i isEleven = _mm_cmpeq_epi8(chars, _mm_set1_epi8(ELEVEN));
+    values = _mm_add_epi8(values, _mm_and_si128(
+            isTen, _mm_set1_epi8(TEN_VALUE - (TEN - '0'))));
+    values = _mm_add_epi8(values, _mm_and_si128(
+            isEleven, _mm_set1_epi8(ELEVEN_VALUE - (ELEVEN - '0'))));
+
+    // Every 16-bit lane of two digits becomes a byte, the first one lower
+    __m128i pairs = _mm_or_si128(values, _mm_srli_epi16(values, 4));
+    pairs = _mm_and_si128(pairs, _mm_set1_epi16(0xFF));
+
+    return (uint64_t) _mm_cvtsi128_si64(_mm_packus_epi16(pairs, pairs));
+}
+#else
+/** @brief Packs the longest possible edge label.
+ *
+ * @param[in] digits - a pointer to the first digit to be packed, followed by
+ *                     at least @ref MAX_LABEL_LENGTH - 1 digits.
+ * @return The packed label.
+ */
+static uint64_t packFullLabel(char const * digits) {
+    return packLabel(digits, MAX_LABEL_LENGTH);
+}
+#endif
+
+/** @brief Cuts an edge label.
+ * Leaves the given number of the first digits of an edge label.
+ *
+ * @param[in] label - the packed label of an edge;
+ * @param[in] length - the number of the digits to be left.
+ * @return The packed label consisting of the first @p length digits.
+ */
+static uint64_t labelPrefix(uint64_t label, uint32_t length) {
+    if (length >= MAX_LABEL_LENGTH) {
+        return label;
+    }
+
+    return label & ((UINT64_C(1) << (length * BITS_PER_DIGIT)) - 1);
+}
+
+/** @brief Matches an edge label against a number.
+ * Counts the digits at the beginning of an edge label which are equal to
+ * the subsequent digits of a number. The digits are compared all at once,
+ * the first difference is found as the lowest bit set in the exclusive or
+ * of the packed labels.
+ *
+ * @param[in] label - the packed label of an edge;
+ * @param[in] labelLength - the number of digits in the label;
+ * @param[in] digits - a pointer to the first digit of the number to be
+ *                     matched;
+ * @param[in] available - the number of the digits of the number left.
+ * @return The number of the matching digits.
+ */
+static uint32_t matchLabel(uint64_t label, uint8_t labelLength,
+                           char const * digits, size_t available) {
+    uint32_t length = labelLength;
+    if (available < length) {
+        length = (uint32_t) available;
+    }
+
+    uint64_t packed = available >= MAX_LABEL_LENGTH ? packFullLabel(digits)
+                                                    : packLabel(digits, length);
+    uint64_t difference = labelPrefix(label ^ packed, length);
+    if (difference == 0) {
+        return length;
+    }
+
+    return (uint32_t) __builtin_ctzll(difference) / BITS_PER_DIGIT;
+}
+
+/**
+ * The characters representing the digits, indexed by their values.
+ */
+static char const DIGIT_CHARACTERS[ALPHABET_SIZE] = {
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', TEN, ELEVEN
+};
+
+/** @brief Writes down an edge label.
+ * Writes the digits of a label so that its last digit is placed right before
+ * @p end.
+ *
+ * @param[in] label - the packed label of an edge;
+ * @param[in] labelLength - the number of digits in the label;
+ * @param[out] end - a pointer to the memory after the place of the label.
+ */
+static void unpackLabel(uint64_t label, uint8_t labelLength, char * end) {
+    char * digits = end - labelLength;
+
+    for (uint32_t i = 0; i < labelLength; i++) {
+        digits[i] = DIGIT_CHARACTERS[labelDigit(label, i)];
+    }
+}
+
+/** @brief Extends the key of a prefix.
+ * Appends the digits of an edge label to the packed first
+ * @ref MAX_LABEL_LENGTH digits of a prefix, the first digit in the highest
+ * bits, each increased by one so that the missing digits of a short prefix
+ * are smaller than all digits. The keys of two prefixes compare as
+ * @ref customStrcmp compares the prefixes, unless the keys are equal.
+ *
+ * @param[in] key - the key of the prefix;
+ * @param[in] length - the length of the prefix;
+ * @param[in] label - the packed label of an edge;
+ * @param[in] labelLength - the number of digits in the label.
+ * @return The key of the prefix followed by the label.
+ */
+static uint64_t prefixKeyOf(uint64_t key, uint64_t length, uint64_t label,
+                            uint8_t labelLength) {
+    for (uint32_t i = 0; i < labelLength && length + i < MAX_LABEL_LENGTH;
+         i++) {
+        uint32_t shift = (MAX_LABEL_LENGTH - 1 - (uint32_t) (length + i))
+                         * BITS_PER_DIGIT;
+
+        key |= (uint64_t) (labelDigit(label, i) + 1) << shift;
+    }
+
+    return key;
+}
+
+/** @brief Writes down the beginning of a prefix.
+ *
+ * @param[in] key - the key of the prefix, see @ref prefixKeyOf;
+ * @param[in] length - the number of the digits to be written, not greater
+ *                     than the length of the prefix and
+ *                     @ref MAX_LABEL_LENGTH;
+ * @param[out] destination - the memory for the digits.
+ */
+static void unpackPrefixKey(uint64_t key, uint64_t length,
+                            char * destination) {
+    for (uint32_t i = 0; i < length; i++) {
+        uint32_t shift = (MAX_LABEL_LENGTH - 1 - i) * BITS_PER_DIGIT;
 
-            currentInitial->alphabet[digit] = newNode;
-            currentInitial->filledEdges++;
+        destination[i] = DIGIT_CHARACTERS[((key >> shift) & DIGIT_MASK) - 1];
+    }
+}
 
-            currentInitial = newNode;
+/** @brief Writes down the prefix of a node.
+ * Reads the prefix terminating in a node of the tree storing the redirected
+ * prefixes from its key and, for a prefix longer than the key, from
+ * the labels of the edges on the way to the root. If the memory already
+ * holds the prefix of another node, only the labels below the node where
+ * the paths of both nodes meet are read.
+ *
+ * @param[in] node - a node;
+ * @param[in] written - a node of the same tree whose prefix is written in
+ *                      @p destination or NULL;
+ * @param[in, out] destination - the memory for \link InitialNode::depth
+ *                               depth \endlink digits of the prefix, which
+ *                               is not terminated with the null character.
+ */
+static void writeInitialPath(InitialNode const * node,
+                             InitialNode const * written, char * destination) {
+    while (node != written && node->depth > MAX_LABEL_LENGTH) {
+        uint64_t nodeDepth = node->depth;
+        uint64_t writtenDepth = written ? written->depth : 0;
+
+        if (nodeDepth >= writtenDepth) {
+            unpackLabel(node->label, node->labelLength,
+                        destination + nodeDepth);
+            node = node->ancestor;
         }
-        else {
-            currentInitial = currentInitial->alphabet[digit];
-            depth++;
+
+        if (written && writtenDepth >= nodeDepth) {
+            written = written->ancestor;
         }
     }
 
-    depth = 0;
-    ForwardedNode * currentForward = pfd->forwardedRoot;
+    if (node != written) {
+        unpackPrefixKey(node->prefixKey, node->depth, destination);
+    }
+}
 
-    //Extending the path for the final prefix
-    while (depth < len2) {
-        digit = getIndex(num2[depth]);
-        
-        if (!(currentForward->alphabet[digit])) {
-            ForwardedNode * newNode = initForwardedNode(currentForward,
-                                                        ++depth, digit);
-            if (!newNode) {
-                return false;
-            }
+/** @brief Writes down the prefix of a node.
+ * Reads the prefix terminating in a node of the tree storing the final
+ * prefixes from the labels of the edges on the way to the root.
+ *
+ * @param[in] node - a node;
+ * @param[out] destination - the memory for \link ForwardedNode::depth depth
+ *                           \endlink digits of the prefix, which is not
+ *                           terminated with the null character.
+ */
+static void writeForwardedPath(ForwardedNode const * node,
+                               char * destination) {
+    while (node && node->labelLength > 0) {
+        unpackLabel(node->label, node->labelLength,
+                    destination + node->depth);
+        node = node->ancestor;
+    }
+}
+
+/** @brief Compares the prefixes of two nodes.
+ * Compares the prefixes terminating in two nodes of the same tree storing
+ * the redirected prefixes as @ref customStrcmp does, without writing them
+ * down. The keys of the prefixes decide unless they are equal; then
+ * the paths are followed up to the node where they meet and the first
+ * digits of the edges leaving it decide, unless one node lies on the path of
+ * the other and so represents the shorter prefix.
+ *
+ * @param[in] first - the first node;
+ * @param[in] second - the second node.
+ * @return A negative value if the prefix of @p first is smaller, a positive
+ *         value if it is greater, zero if the nodes are the same.
+ */
+static int compareInitialNodes(InitialNode const * first,
+                               InitialNode const * second) {
+    InitialNode const * firstBelow = NULL;
+    InitialNode const * secondBelow = NULL;
 
-            currentForward->alphabet[digit] = newNode;
-            currentForward->filledEdges++;
-            
-            currentForward = newNode;
+    if (first->prefixKey != second->prefixKey) {
+        return first->prefixKey < second->prefixKey ? -1 : 1;
+    }
+
+    while (first != second) {
+        uint64_t firstDepth = first->depth;
+        uint64_t secondDepth = second->depth;
+
+        if (firstDepth >= secondDepth) {
+            firstBelow = first;
+            first = first->ancestor;
         }
-        else {
-            currentForward = currentForward->alphabet[digit];
-            depth++;
+
+        if (secondDepth >= firstDepth) {
+            secondBelow = second;
+            second = second->ancestor;
         }
     }
 
-    if (!addForwardedNode(currentInitial, currentForward)) {
-        return false;
+    if (!firstBelow || !secondBelow) {
+        return (firstBelow != NULL) - (secondBelow != NULL);
     }
 
-    if (!(addPrefixForwardAndSetForward(currentForward, num2))
-        || !(addPrefixInitialAndSetForward(currentInitial, num1))) {
-            return false;
+    return (int) labelDigit(firstBelow->label, 0)
+           - (int) labelDigit(secondBelow->label, 0);
+}
+
+/** @brief Creates and initializes a node.
+ *  Creates and initializes the node responsible for storing the information
+ *  about the prefixes supposed to be redirected. Memory handed out by the pool
+ *  is zeroed, therefore only non-zero fields are assigned.
+ *
+ * @param[in, out] pool - pools handing out the nodes;
+ * @param[in] ancestor - a parental node of the initialized node.
+ * @param[in] depth - depth of the level at which the edge leading to the node
+ *                    ends
+ * @param[in] label - the packed label of the edge leading to the initialized
+ *                    node
+ * @param[in] labelLength - the number of digits in @p label
+ *
+ * @return An initialized node or NULL in case of memory allocation failure.
+ */
+static InitialNode * initInitialNode(TreePool* pool, InitialNode* ancestor,
+                                     uint64_t depth, uint64_t label,
+                                     uint32_t labelLength) {
+    InitialNode * result = poolAlloc(&(pool->nodes));
+    if (!result) {
+        return NULL;
     }
 
-    return true;
+    result->ancestor = ancestor;
+    result->depth = depth;
+    result->label = label;
+    result->labelLength = (uint8_t) labelLength;
+
+    if (ancestor) {
+        result->prefixKey = prefixKeyOf(ancestor->prefixKey,
+                                        depth - labelLength, label,
+                                        (uint8_t) labelLength);
+    }
+
+    return result;
+}
+
+/** @brief Creates and initializes a node.
+ *  Creates and initializes the node responsible for storing the information
+ *  about the prefixes supposed to represent the final redirection. Memory
+ *  handed out by the pool is zeroed, therefore only non-zero fields
+ *  are assigned.
+ *
+ * @param[in, out] pool - pools handing out the nodes;
+ * @param[in] ancestor - a parental node of the initialized node.
+ * @param[in] depth - depth of the level at which the edge leading to the node
+ *                    ends
+ * @param[in] label - the packed label of the edge leading to the initialized
+ *                    node
+ * @param[in] labelLength - the number of digits in @p label
+ *
+ * @return An initialized node or NULL in case of memory allocation failure.
+ */
+static ForwardedNode * initForwardedNode(TreePool* pool,
+                                         ForwardedNode* ancestor,
+                                         uint64_t depth, uint64_t label,
+                                         uint32_t labelLength) {
+    ForwardedNode * result = poolAlloc(&(pool->nodes));
+    if (!result) {
+        return NULL;
+    }
+
+    result->ancestor = ancestor;
+    result->depth = depth;
+    result->label = label;
+    result->labelLength = (uint8_t) labelLength;
+
+    return result;
+}
+
+/** @brief Initializes the pools of a tree.
+ * Initializes empty pools of the nodes of the given size and of the arrays
+ * of children of every size class. No memory is allocated.
+ *
+ * @param[out] pool - pools to be initialized;
+ * @param[in] nodeSize - the size of a single node in bytes.
+ */
+static void initTreePool(TreePool * pool, size_t nodeSize) {
+    poolInit(&(pool->nodes), nodeSize);
+
+    for (uint32_t c = 0; c < CHILDREN_CLASSES; c++) {
+        poolInit(&(pool->children[c]), ((size_t) 1 << c) * sizeof(void*));
+    }
+}
+
+/** @brief Releases the pools of a tree.
+ * Frees all the nodes and arrays of children handed out by the pools.
+ *
+ * @param[in, out] pool - pools to be released.
+ */
+static void releaseTreePool(TreePool * pool) {
+    poolRelease(&(pool->nodes));
+
+    for (uint32_t c = 0; c < CHILDREN_CLASSES; c++) {
+        poolRelease(&(pool->children[c]));
+    }
+}
+
+/** @brief Counts the memory of the arrays of children of a tree.
+ *
+ * @param[in] pool - pools of the tree.
+ * @return The number of the bytes allocated by the pools of the arrays.
+ */
+static size_t childrenBytes(TreePool const * pool) {
+    size_t result = 0;
+
+    for (uint32_t c = 0; c < CHILDREN_CLASSES; c++) {
+        result += poolBytes(&(pool->children[c]));
+    }
+
+    return result;
+}
+
+PhoneForward * phfwdNew(void) {
+    PhoneForward * result = malloc(sizeof(PhoneForward));
+    if (!result) {
+        return NULL;
+    }
+
+    initTreePool(&(result->initialPool), sizeof(InitialNode));
+    initTreePool(&(result->forwardedPool), sizeof(ForwardedNode));
+
+    result->forwardedRoot = initForwardedNode(&(result->forwardedPool),
+                                              NULL, 0, 0, 0);
+    if (!result->forwardedRoot) {
+        free(result);
+
+        return NULL;
+    }
+
+    result->initialRoot = initInitialNode(&(result->initialPool), NULL,
+                                          0, 0, 0);
+    if (!result->initialRoot) {
+        releaseTreePool(&(result->forwardedPool));
+        free(result);
+
+        return NULL;
+    }
+
+    result->flat.header = NULL;
+    result->mapping = NULL;
+    result->mappingLength = 0;
+    result->compiled = NULL;
+    result->changes = NULL;
+    result->replayedChanges = 0;
+    result->isShared = false;
+    result->cache = NULL;
+    result->generation = 0;
+    result->journal = NULL;
+    result->isReadOnly = false;
+    result->isOverlaid = false;
+
+    return result;
 }
 
 /** @brief Removes a node.
  *  Removes a node responsible for storing information about the final prefix
  *  and updates information about the children in the parental node.
  *
+ * @param[in, out] pool - pools which have handed out the node;
  * @param[in, out] toDelete - a node to be removed from a tree.
  */
-static void removeForwardedNode(ForwardedNode * toDelete) {
+static void removeForwardedNode(TreePool * pool, ForwardedNode * toDelete) {
     if (toDelete) {
         ForwardedNode * ancestor = toDelete->ancestor;
 
         if (ancestor) {
-            ancestor->alphabet[toDelete->edgeLeadingTo] = NULL;
-            (ancestor->filledEdges)--;
+            removeForwardedChild(pool, ancestor,
+                                 labelDigit(toDelete->label, 0));
         }
 
-        free(toDelete->forwardedPrefix);
+        freeChildren(pool, toDelete->children, toDelete->childrenClass);
         free(toDelete->forwardedNodes);
-        free(toDelete);    
+        poolFree(&(pool->nodes), toDelete);
+    }
+}
+
+/** @brief Merges a node with its only child.
+ *  Collapses a node which does not participate in the redirection and has
+ *  a single child into the edge leading to the child, provided that
+ *  the joined label fits in @ref MAX_LABEL_LENGTH digits. The child takes
+ *  the place of the node, which is removed, therefore the terminal nodes
+ *  are never moved.
+ *
+ * @param[in, out] pool - pools which have handed out the node;
+ * @param[in, out] node - a non-root node to be merged with its child.
+ */
+static void mergeForwardedNodeWithChild(TreePool * pool, ForwardedNode * node) {
+    if (countChildren(node->childMask) != 1) {
+        return;
+    }
+
+    ForwardedNode * child = node->children[0];
+    if (node->labelLength + child->labelLength > MAX_LABEL_LENGTH) {
+        return;
     }
+
+    child->label = node->label
+                   | (child->label << (node->labelLength * BITS_PER_DIGIT));
+    child->labelLength += node->labelLength;
+    child->ancestor = node->ancestor;
+    replaceForwardedChild(node->ancestor, child);
+
+    freeChildren(pool, node->children, node->childrenClass);
+    free(node->forwardedNodes);
+    poolFree(&(pool->nodes), node);
 }
 
 /** @brief Removes unnecessary nodes.
  *  Removes unnecessary nodes from a tree: nodes which are not on the path
- *  ending with a node regarded as terminal for the given prefix.
+ *  ending with a node regarded as terminal for the given prefix. The first
+ *  node left which does not participate in the redirection is merged with
+ *  its child if it has only one.
  *
+ * @param[in, out] pool - pools which have handed out the nodes;
  * @param[in, out] currentForward - a node responsible for storing data about
  *                         the final prefix, which starts the chain of nodes
  *                         removal.
  */
-static void removeStumpsForwardedNode(ForwardedNode * currentForward) {
-    while (currentForward && currentForward->filledEdges == 0
-            && currentForward->sumForwarded == 0) {
+static void removeStumpsForwardedNode(TreePool * pool,
+                                      ForwardedNode * currentForward) {
+    while (currentForward && currentForward->ancestor
+           && currentForward->sumForwarded == 0
+           && !isPinnedSet(currentForward->isForwarding)) {
                 ForwardedNode * currentAncestor = currentForward->ancestor;
 
-                if (currentAncestor) {
-                    removeForwardedNode(currentForward);
+                if (currentForward->childMask != 0) {
+                    mergeForwardedNodeWithChild(pool, currentForward);
+
+                    return;
                 }
 
+                removeForwardedNode(pool, currentForward);
                 currentForward = currentAncestor;
     }
 }
 
+/** @brief Removes a node from an array.
+ * Places NULL in the slot of the array of the redirected nodes of
+ * @p finalForward at the given index. If the NULL slots outnumber
+ * the redirected nodes @ref COMPACTION_RATIO times, the remaining nodes are
+ * moved to the beginning of the array, their indices are updated and
+ * the unnecessary memory is released.
+ *
+ * @param[in, out] finalForward - a terminal node for the final redirection;
+ * @param[in] index - the index of the removed node in the array.
+ */
+static void excludeForwardedNode(ForwardedNode * finalForward,
+                                 uint64_t index) {
+    InitialNode ** nodes = finalForward->forwardedNodes;
+
+    nodes[index] = NULL;
+    (finalForward->sumForwarded)--;
+
+    // The slots reserved for a transaction are kept until it ends
+    if (finalForward->sumForwarded == 0
+        || isPinnedSet(finalForward->isForwarding)
+        || finalForward->numForwardedNodes < MIN_COMPACTED_SLOTS
+        || finalForward->numForwardedNodes
+           <= COMPACTION_RATIO * finalForward->sumForwarded) {
+        return;
+    }
+
+    uint64_t numPresent = 0;
+    for (uint64_t i = 0; i < finalForward->numForwardedNodes; i++) {
+        if (nodes[i]) {
+            nodes[numPresent] = nodes[i];
+            nodes[numPresent]->indexForward = numPresent;
+            numPresent++;
+        }
+    }
+
+    finalForward->numForwardedNodes = numPresent;
+
+    // Keeping the larger array is harmless if it cannot be shrunk
+    uint64_t newSlots = 2 * numPresent;
+    InitialNode ** newNodeArray = realloc(nodes,
+                                          newSlots * sizeof(InitialNode*));
+    if (newNodeArray) {
+        finalForward->forwardedNodes = newNodeArray;
+        finalForward->numSlotsForNodes = newSlots;
+    }
+}
+
+/** @brief Releases a final node.
+ *  Clears the flag and frees the array of redirected nodes
+ *  of a node to whom no prefix is redirected anymore, then removes
+ *  the potentially unnecessary nodes in the final redirection tree.
+ *  A node pinned by a transaction is kept.
+ *
+ * @param[in, out] pool - pools which have handed out the nodes of the final
+ *                        redirection tree;
+ * @param[in, out] finalForward - a terminal node for the final redirection.
+ */
+static void releaseUnusedForwardedNode(TreePool * pool,
+                                       ForwardedNode * finalForward) {
+    if (finalForward->sumForwarded == 0
+        && !isPinnedSet(finalForward->isForwarding)) {
+        clearBitForward(&(finalForward->isForwarding));
+        free(finalForward->forwardedNodes);
+        finalForward->forwardedNodes = NULL;
+        finalForward->numForwardedNodes = 0;
+        finalForward->numSlotsForNodes = 0;
+
+        removeStumpsForwardedNode(pool, finalForward);
+    }
+}
+
 /** @brief Removes a redirection.
  * Removes a redirection, which includes dereference the forwarding node
  * in the redirected node, exclusion of the redirected node from an array
  * of the redirected nodes, clearing the flags and removal of the potentially
  * unnecessary nodes in the final redirection tree.
  *
+ * @param[in, out] pool - pools which have handed out the nodes of the final
+ *                        redirection tree;
  * @param[in, out] toDeforward - a node storing information about the redirected
  *                               prefix
  */
 static void removeForwardedNodeFromInitialAndRemoveInitialFromForward(
-                                                InitialNode* toDeforward) {
+                            TreePool * pool, InitialNode* toDeforward) {
     ForwardedNode * finalForward = toDeforward->forwardingNode;
     uint64_t index = toDeforward->indexForward;
 
-    finalForward->forwardedNodes[index] = NULL;
-    (finalForward->sumForwarded)--;
+    excludeForwardedNode(finalForward, index);
     toDeforward->forwardingNode = NULL;
     toDeforward->indexForward = 0;
 
     clearBitForward(&(toDeforward->isForwarded));
-    if (finalForward->sumForwarded == 0) {
-        clearBitForward(&(finalForward->isForwarding));
-        free(finalForward->forwardedPrefix);
-        finalForward->forwardedPrefix = NULL;
-    }
-
-    removeStumpsForwardedNode(finalForward);
+    releaseUnusedForwardedNode(pool, finalForward);
 }
 
 /** @brief Removes a node.
  * Removes a node responsible for storing information about the redirected
  * prefix and updates information about the children in the parental node.
  *
+ * @param[in, out] pool - pools which have handed out the node;
  * @param[in, out] init - a node to be removed from a tree.
  */
-static void removeInitialNode(InitialNode* init) {
+static void removeInitialNode(TreePool * pool, InitialNode* init) {
     if (init) {
         InitialNode * ancestor = init->ancestor;
         if (ancestor) {
-            ancestor->alphabet[init->edgeLeadingTo] = NULL;
-            (ancestor->filledEdges)--;
+            removeInitialChild(pool, ancestor, labelDigit(init->label, 0));
         }
 
-        free(init->initialPrefix);
-        free(init);
+        freeChildren(pool, init->children, init->childrenClass);
+        poolFree(&(pool->nodes), init);
+    }
+}
+
+/** @brief Merges a node with its only child.
+ *  Collapses a node which does not participate in the redirection and has
+ *  a single child into the edge leading to the child, provided that
+ *  the joined label fits in @ref MAX_LABEL_LENGTH digits. The child takes
+ *  the place of the node, which is removed, therefore the terminal nodes
+ *  are never moved.
+ *
+ * @param[in, out] pool - pools which have handed out the node;
+ * @param[in, out] init - a non-root node to be merged with its child.
+ */
+static void mergeInitialNodeWithChild(TreePool * pool, InitialNode * init) {
+    if (countChildren(init->childMask) != 1) {
+        return;
+    }
+
+    InitialNode * child = init->children[0];
+    if (init->labelLength + child->labelLength > MAX_LABEL_LENGTH) {
+        return;
     }
+
+    child->label = init->label
+                   | (child->label << (init->labelLength * BITS_PER_DIGIT));
+    child->labelLength += init->labelLength;
+    child->ancestor = init->ancestor;
+    replaceInitialChild(init->ancestor, child);
+
+    freeChildren(pool, init->children, init->childrenClass);
+    poolFree(&(pool->nodes), init);
 }
 
 /** @brief Removes unnecessary nodes.
  *  Removes unnecessary nodes from a tree: nodes which are not on the path
- *  ending with a node regarded as terminal for the given prefix.
+ *  ending with a node regarded as terminal for the given prefix. The first
+ *  node left which does not participate in the redirection is merged with
+ *  its child if it has only one.
  *
+ * @param[in, out] pool - pools which have handed out the nodes;
  * @param[in, out] currentInitial - a node responsible for storing data about
  *                         the redirected prefix, which starts the chain of
  *                         nodes removal.
  */
-static void removeStumpsInitialNode(InitialNode * currentInitial) {
-    while (currentInitial && currentInitial->filledEdges == 0 &&
-           !(isForwardSet(currentInitial->isForwarded))) {
+static void removeStumpsInitialNode(TreePool * pool,
+                                    InitialNode * currentInitial) {
+    while (currentInitial && currentInitial->ancestor &&
+           !(isForwardSet(currentInitial->isForwarded)) &&
+           !(isPinnedSet(currentInitial->isForwarded))) {
                 InitialNode * currentAncestor = currentInitial->ancestor;
-                if (currentAncestor) {
-                    removeInitialNode(currentInitial);
+
+                if (currentInitial->childMask != 0) {
+                    mergeInitialNodeWithChild(pool, currentInitial);
+
+                    return;
                 }
+
+                removeInitialNode(pool, currentInitial);
                 currentInitial = currentAncestor;
     }
 }
 
-void phfwdRemove(PhoneForward * pf, char const * num) {
-    if (pf) {
-        size_t len = checkLength(num);
+/** @brief Splits an edge.
+ *  Inserts a new node in the middle of the edge leading to @p init, so that
+ *  the edge leading to the new node is labeled with the first @p length
+ *  digits of the previous label.
+ *
+ * @param[in, out] pool - pools handing out the nodes;
+ * @param[in, out] init - a non-root node whose edge is split;
+ * @param[in] length - the number of the digits left above the new node,
+ *                     smaller than the length of the label.
+ * @return The inserted node or NULL in case of memory allocation failure.
+ */
+static InitialNode * splitInitialEdge(TreePool * pool, InitialNode * init,
+                                      uint32_t length) {
+    InitialNode * ancestor = init->ancestor;
+    uint64_t depth = init->depth - init->labelLength + length;
+    InitialNode * middle = initInitialNode(pool, ancestor, depth,
+                                           labelPrefix(init->label, length),
+                                           length);
+    if (!middle) {
+        return NULL;
+    }
 
-        if (len == 0) {
-            return;
+    middle->children = poolAlloc(&(pool->children[0]));
+    if (!middle->children) {
+        poolFree(&(pool->nodes), middle);
+
+        return NULL;
+    }
+
+    replaceInitialChild(ancestor, middle);
+
+    init->label >>= length * BITS_PER_DIGIT;
+    init->labelLength -= length;
+    init->ancestor = middle;
+
+    middle->children[0] = init;
+    middle->childMask = (uint16_t) (1u << labelDigit(init->label, 0));
+
+    // The shorter labels may now fit together with their neighbours
+    if (!isForwardSet(init->isForwarded) && !isPinnedSet(init->isForwarded)) {
+        mergeInitialNodeWithChild(pool, init);
+    }
+    if (ancestor->ancestor && !isForwardSet(ancestor->isForwarded)
+        && !isPinnedSet(ancestor->isForwarded)) {
+        mergeInitialNodeWithChild(pool, ancestor);
+    }
+
+    return middle;
+}
+
+/** @brief Splits an edge.
+ *  Inserts a new node in the middle of the edge leading to @p forward, so that
+ *  the edge leading to the new node is labeled with the first @p length
+ *  digits of the previous label.
+ *
+ * @param[in, out] pool - pools handing out the nodes;
+ * @param[in, out] forward - a non-root node whose edge is split;
+ * @param[in] length - the number of the digits left above the new node,
+ *                     smaller than the length of the label.
+ * @return The inserted node or NULL in case of memory allocation failure.
+ */
+static ForwardedNode * splitForwardedEdge(TreePool * pool,
+                                          ForwardedNode * forward,
+                                          uint32_t length) {
+    ForwardedNode * ancestor = forward->ancestor;
+    uint64_t depth = forward->depth - forward->labelLength + length;
+    ForwardedNode * middle = initForwardedNode(pool, ancestor, depth,
+                                               labelPrefix(forward->label,
+                                                           length),
+                                               length);
+    if (!middle) {
+        return NULL;
+    }
+
+    middle->children = poolAlloc(&(pool->children[0]));
+    if (!middle->children) {
+        poolFree(&(pool->nodes), middle);
+
+        return NULL;
+    }
+
+    replaceForwardedChild(ancestor, middle);
+
+    forward->label >>= length * BITS_PER_DIGIT;
+    forward->labelLength -= length;
+    forward->ancestor = middle;
+
+    middle->children[0] = forward;
+    middle->childMask = (uint16_t) (1u << labelDigit(forward->label, 0));
+
+    // The shorter labels may now fit together with their neighbours
+    if (forward->sumForwarded == 0 && !isPinnedSet(forward->isForwarding)) {
+        mergeForwardedNodeWithChild(pool, forward);
+    }
+    if (ancestor->ancestor && ancestor->sumForwarded == 0
+        && !isPinnedSet(ancestor->isForwarding)) {
+        mergeForwardedNodeWithChild(pool, ancestor);
+    }
+
+    return middle;
+}
+
+/** @brief Extends the path for a redirected prefix.
+ *  Walks down the tree from @p start along the given prefix, splitting
+ *  the edges which diverge from the prefix and adding the missing part of
+ *  the path as edges labeled with up to @ref MAX_LABEL_LENGTH digits.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in, out] start - a node of the tree whose path begins the prefix,
+ *                         the root for a walk from the beginning;
+ * @param[in] num - the validated prefix;
+ * @param[in] len - the length of the prefix;
+ * @param[out] reached - the deepest node of the path, the terminal node
+ *                       for the prefix on success.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool extendInitialPath(PhoneForward * pf, InitialNode * start,
+                              char const * num, size_t len,
+                              InitialNode ** reached) {
+    InitialNode * currentInitial = start;
+    *reached = currentInitial;
+
+    while (currentInitial->depth < len) {
+        size_t depth = currentInitial->depth;
+        InitialNode * child = getInitialChild(currentInitial,
+                                              getIndex(num[depth]));
+
+        if (!child) {
+            uint32_t length = MAX_LABEL_LENGTH;
+            if (len - depth < length) {
+                length = (uint32_t) (len - depth);
+            }
+
+            child = initInitialNode(&(pf->initialPool), currentInitial,
+                                    depth + length,
+                                    packLabel(num + depth, length), length);
+            if (!child) {
+                return false;
+            }
+
+            if (!insertInitialChild(&(pf->initialPool), currentInitial,
+                                    child)) {
+                poolFree(&(pf->initialPool.nodes), child);
+
+                return false;
+            }
         }
+        else {
+            uint32_t matched = matchLabel(child->label, child->labelLength,
+                                          num + depth, len - depth);
 
-        uint64_t depth = 0;
-        bool possibleToPass = true;
-        InitialNode *currentInitialCore = pf->initialRoot;
-        uint32_t digit;
-        while (depth < len && possibleToPass) {
-            digit = getIndex(num[depth]);
+            if (matched < child->labelLength) {
+                child = splitInitialEdge(&(pf->initialPool), child, matched);
 
-            if (currentInitialCore->alphabet[digit]) {
-                currentInitialCore = currentInitialCore->alphabet[digit];
-                depth++;
-            } else {
-                possibleToPass = false;
+                if (!child) {
+                    return false;
+                }
             }
         }
-        if (!possibleToPass) {
-            return;
+
+        currentInitial = child;
+        *reached = currentInitial;
+    }
+
+    return true;
+}
+
+/** @brief Extends the path for a final prefix.
+ *  Walks down the tree from @p start along the given prefix, splitting
+ *  the edges which diverge from the prefix and adding the missing part of
+ *  the path as edges labeled with up to @ref MAX_LABEL_LENGTH digits.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in, out] start - a node of the tree whose path begins the prefix,
+ *                         the root for a walk from the beginning;
+ * @param[in] num - the validated prefix;
+ * @param[in] len - the length of the prefix;
+ * @param[out] reached - the deepest node of the path, the terminal node
+ *                       for the prefix on success.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool extendForwardedPath(PhoneForward * pf, ForwardedNode * start,
+                                char const * num, size_t len,
+                                ForwardedNode ** reached) {
+    ForwardedNode * currentForward = start;
+    *reached = currentForward;
+
+    while (currentForward->depth < len) {
+        size_t depth = currentForward->depth;
+        ForwardedNode * child = getForwardedChild(currentForward,
+                                                  getIndex(num[depth]));
+
+        if (!child) {
+            uint32_t length = MAX_LABEL_LENGTH;
+            if (len - depth < length) {
+                length = (uint32_t) (len - depth);
+            }
+
+            child = initForwardedNode(&(pf->forwardedPool), currentForward,
+                                      depth + length,
+                                      packLabel(num + depth, length), length);
+            if (!child) {
+                return false;
+            }
+
+            if (!insertForwardedChild(&(pf->forwardedPool), currentForward,
+                                      child)) {
+                poolFree(&(pf->forwardedPool.nodes), child);
+
+                return false;
+            }
+        }
+        else {
+            uint32_t matched = matchLabel(child->label, child->labelLength,
+                                          num + depth, len - depth);
+
+            if (matched < child->labelLength) {
+                child = splitForwardedEdge(&(pf->forwardedPool), child,
+                                           matched);
+
+                if (!child) {
+                    return false;
+                }
+            }
+        }
+
+        currentForward = child;
+        *reached = currentForward;
+    }
+
+    return true;
+}
+
+/** @brief Descends along a number.
+ *  Provides the child of @p node reached by following the digits of
+ *  the number which come after the path ending in @p node, provided that
+ *  the whole label of the edge leading to the child matches the number.
+ *
+ * @param[in] node - a node of the tree storing the redirected prefixes;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number, greater than the depth
+ *                  of @p node.
+ * @return A pointer to the child or NULL if there is no such child.
+ */
+static InitialNode * matchInitialChild(InitialNode const * node,
+                                       char const * num, size_t len) {
+    size_t depth = node->depth;
+    InitialNode * child = getInitialChild(node, getIndex(num[depth]));
+
+    if (!child || matchLabel(child->label, child->labelLength, num + depth,
+                             len - depth) < child->labelLength) {
+        return NULL;
+    }
+
+    return child;
+}
+
+/** @brief Descends along a number.
+ *  Provides the child of @p node reached by following the digits of
+ *  the number which come after the path ending in @p node, provided that
+ *  the whole label of the edge leading to the child matches the number.
+ *
+ * @param[in] node - a node of the tree storing the final prefixes;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number, greater than the depth
+ *                  of @p node.
+ * @return A pointer to the child or NULL if there is no such child.
+ */
+static ForwardedNode * matchForwardedChild(ForwardedNode const * node,
+                                           char const * num, size_t len) {
+    size_t depth = node->depth;
+    ForwardedNode * child = getForwardedChild(node, getIndex(num[depth]));
+
+    if (!child || matchLabel(child->label, child->labelLength, num + depth,
+                             len - depth) < child->labelLength) {
+        return NULL;
+    }
+
+    return child;
+}
+
+/** @brief Descends along a number in an image.
+ *  Provides the index of the child of the node with the given index in
+ *  the image of the tree storing the redirected prefixes, in the same way as
+ *  @ref matchInitialChild.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] node - the index of a node;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number, greater than the depth
+ *                  of the node.
+ * @return The index of the child or @ref FLAT_NONE if there is no such child.
+ */
+static uint32_t matchFlatInitialChild(FlatTrie const * trie, uint32_t node,
+                                      char const * num, size_t len) {
+    FlatInitialNode const * parent = &(trie->initial[node]);
+    size_t depth = parent->depth;
+    uint32_t digit = getIndex(num[depth]);
+
+    if (!hasChild(parent->childMask, digit)) {
+        return FLAT_NONE;
+    }
+
+    uint32_t child = parent->firstChild
+                     + childPosition(parent->childMask, digit);
+    FlatInitialNode const * childNode = &(trie->initial[child]);
+
+    if (matchLabel(childNode->label, childNode->labelLength, num + depth,
+                   len - depth) < childNode->labelLength) {
+        return FLAT_NONE;
+    }
+
+    return child;
+}
+
+/** @brief Descends along a number in an image.
+ *  Provides the index of the child of the node with the given index in
+ *  the image of the tree storing the final prefixes, in the same way as
+ *  @ref matchForwardedChild.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] node - the index of a node;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number, greater than the depth
+ *                  of the node.
+ * @return The index of the child or @ref FLAT_NONE if there is no such child.
+ */
+static uint32_t matchFlatForwardedChild(FlatTrie const * trie, uint32_t node,
+                                        char const * num, size_t len) {
+    FlatForwardedNode const * parent = &(trie->forwarded[node]);
+    size_t depth = parent->depth;
+    uint32_t digit = getIndex(num[depth]);
+
+    if (!hasChild(parent->childMask, digit)) {
+        return FLAT_NONE;
+    }
+
+    uint32_t child = parent->firstChild
+                     + childPosition(parent->childMask, digit);
+    FlatForwardedNode const * childNode = &(trie->forwarded[child]);
+
+    if (matchLabel(childNode->label, childNode->labelLength, num + depth,
+                   len - depth) < childNode->labelLength) {
+        return FLAT_NONE;
+    }
+
+    return child;
+}
+
+/** @brief Walks down an image along a number.
+ *  Follows the number from the node with the given index of the image of
+ *  the tree storing the redirected prefixes as far as the whole labels match.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] node - the index of the starting node;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number, not smaller than the depth
+ *                  of the starting node.
+ * @return The index of the deepest node reached.
+ */
+static uint32_t descendFlatInitial(FlatTrie const * trie, uint32_t node,
+                                   char const * num, size_t len) {
+    while (trie->initial[node].depth < len) {
+        uint32_t child = matchFlatInitialChild(trie, node, num, len);
+
+        if (child == FLAT_NONE) {
+            break;
+        }
+
+        node = child;
+    }
+
+    return node;
+}
+
+/** @brief Customized strcmp.
+ * Customized version of strcmp string comparing function, which is extended
+ * with additional alphabet numbers and their values
+ *
+ * @param[in] first - the first char array to compare.
+ * @param[in] second - the second char array to compare
+ * @return The result of lexicographic comparison equivalent to the result
+ * of standard strcmp(...): if the first string is smaller lexicographically
+ * it returns negative value; if the first string is greater - it returns
+ * positive value; zero in case of equal strings.
+ */
+static int customStrcmp(const char* first, const char* second) {
+    size_t index = 0;
+
+    // Equal characters do not need to be translated into digit values
+    while (first[index] != '\0' && first[index] == second[index]) {
+        index++;
+    }
+
+    /*
+     * Either the strings are equal, or one of them ended and the shorter one
+     * is smaller lexicographically, or the first differing digits decide.
+     */
+    if (first[index] == '\0' || second[index] == '\0') {
+        return (first[index] != '\0') - (second[index] != '\0');
+    }
+
+    return (int) getIndex(first[index]) - (int) getIndex(second[index]);
+}
+
+/** @brief Finds the place of a redirected node.
+ * Finds the place in the sorted array of the redirected nodes of
+ * @p finalForward where @p node should be inserted. The NULL slots are
+ * skipped.
+ *
+ * @param[in] finalForward - a terminal node for the final redirection;
+ * @param[in] node - a terminal node of a redirected prefix, absent from
+ *                   the array.
+ * @return The index such that all nodes placed before represent smaller
+ *         prefixes than @p node and all nodes placed at or after it
+ *         represent greater ones.
+ */
+static uint64_t findForwardedPosition(ForwardedNode const * finalForward,
+                                      InitialNode const * node) {
+    uint64_t low = 0;
+    uint64_t high = finalForward->numForwardedNodes;
+
+    // Prefixes added in sorted order, as by phfwdAddBulk, go to the end
+    if (high > 0 && finalForward->forwardedNodes[high - 1]
+        && compareInitialNodes(finalForward->forwardedNodes[high - 1],
+                               node) < 0) {
+        return high;
+    }
+
+    while (low < high) {
+        uint64_t middle = low + (high - low) / 2;
+        uint64_t present = middle;
+
+        while (present < high && !finalForward->forwardedNodes[present]) {
+            present++;
+        }
+
+        if (present < high
+            && compareInitialNodes(finalForward->forwardedNodes[present],
+                                   node) < 0) {
+            low = present + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+/** @brief Spreads out the redirected nodes.
+ * Moves the redirected nodes of @p finalForward placed between the indices
+ * @p start and @p end apart, so that they are evenly distributed between
+ * @p start and @p newEnd, keeping their order. The slots between them are
+ * filled with NULL.
+ *
+ * @param[in, out] finalForward - a terminal node for the final redirection;
+ * @param[in] start - the index of the first slot of the spread part;
+ * @param[in] end - the index after the last slot of the part;
+ * @param[in] newEnd - the index after the last slot of the part after
+ *                     spreading, not smaller than @p start increased by
+ *                     the number of the nodes in the part and not greater
+ *                     than the number of the slots of the array.
+ */
+static void spreadForwardedNodes(ForwardedNode * finalForward, uint64_t start,
+                                 uint64_t end, uint64_t newEnd) {
+    InitialNode ** nodes = finalForward->forwardedNodes;
+    uint64_t numPresent = 0;
+
+    for (uint64_t i = start; i < end; i++) {
+        if (nodes[i]) {
+            nodes[start + numPresent++] = nodes[i];
+        }
+    }
+
+    // Moving from the end does not overwrite the nodes which are not moved yet
+    uint64_t width = newEnd - start;
+    uint64_t next = newEnd;
+    for (uint64_t i = numPresent; i > 0; i--) {
+        uint64_t target = start + (i - 1) * width / numPresent;
+
+        while (next > target + 1) {
+            nodes[--next] = NULL;
+        }
+
+        nodes[target] = nodes[start + i - 1];
+        nodes[target]->indexForward = target;
+        next = target;
+    }
+
+    while (next > start) {
+        nodes[--next] = NULL;
+    }
+}
+
+/** @brief Makes room around a slot.
+ * Finds the smallest aligned part of the array of the redirected nodes of
+ * @p finalForward containing the given index, at least twice as long as
+ * @ref MAX_FORWARDED_SHIFT, which would not be too crowded after adding
+ * a node, and spreads the nodes out in this part. As in a packed-memory
+ * array, the limit of the used slots falls with the length of the part, from
+ * fifteen sixteenths of the shortest parts to nine sixteenths of the longest
+ * ones. A spread part is therefore well below the limit of the parts it
+ * consists of, which take many additions before they are spread out again,
+ * so an addition moves a number of nodes polylogarithmic in the length of
+ * the array in the amortized sense, whatever the order of the additions.
+ * If there is no such part, the whole array is spread out, so that each node
+ * is followed by a NULL slot. The array has to have at least twice as many
+ * slots as there are redirected nodes.
+ *
+ * @param[in, out] finalForward - a terminal node for the final redirection;
+ * @param[in] position - an index of a slot of the array.
+ */
+static void rebalanceForwardedNodes(ForwardedNode * finalForward,
+                                    uint64_t position) {
+    uint64_t numNodes = finalForward->numForwardedNodes;
+    uint64_t numLevels = 0;
+
+    for (uint64_t width = 2 * MAX_FORWARDED_SHIFT; width < numNodes;
+         width *= 2) {
+        numLevels++;
+    }
+
+    uint64_t level = 0;
+    for (uint64_t width = 2 * MAX_FORWARDED_SHIFT; width < numNodes;
+         width *= 2, level++) {
+        uint64_t start = position / width * width;
+        uint64_t end = start + width < numNodes ? start + width : numNodes;
+        uint64_t numPresent = 0;
+
+        for (uint64_t i = start; i < end; i++) {
+            numPresent += finalForward->forwardedNodes[i] != NULL;
+        }
+
+        // The limit is 15/16 - 6/16 * level/numLevels of the slots of the part
+        if (16 * numLevels * (numPresent + 1)
+            <= (15 * numLevels - 6 * level) * (end - start)) {
+            spreadForwardedNodes(finalForward, start, end, end);
+
+            return;
+        }
+    }
+
+    spreadForwardedNodes(finalForward, 0, numNodes,
+                         2 * finalForward->sumForwarded);
+    finalForward->numForwardedNodes = 2 * finalForward->sumForwarded;
+}
+
+/** @brief Prepares a slot for a redirected node.
+ * Provides the NULL slot where @p node should be placed to keep
+ * the array of the redirected nodes of @p finalForward sorted. A neighbouring
+ * NULL slot is taken if there is one, otherwise the nodes up to the next NULL
+ * slot or the end of the array are moved by one. If too many nodes would have
+ * to be moved, the nodes around the slot are spread out first, see
+ * @ref rebalanceForwardedNodes. The array has to have a slot after the last
+ * used one and at least twice as many slots as there are redirected nodes
+ * after adding the node.
+ *
+ * @param[in, out] finalForward - a terminal node for the final redirection;
+ * @param[in] node - a terminal node of a redirected prefix, absent from
+ *                   the array.
+ * @return The index of the prepared slot.
+ */
+static uint64_t makeRoomForwarded(ForwardedNode * finalForward,
+                                  InitialNode const * node) {
+    InitialNode ** nodes = finalForward->forwardedNodes;
+    uint64_t * numNodes = &(finalForward->numForwardedNodes);
+    uint64_t position = findForwardedPosition(finalForward, node);
+
+    if (position > 0 && !nodes[position - 1]) {
+        return position - 1;
+    }
+
+    if (position < *numNodes && !nodes[position]) {
+        return position;
+    }
+
+    uint64_t hole = position;
+    while (hole < *numNodes && nodes[hole]
+           && hole - position < MAX_FORWARDED_SHIFT) {
+        hole++;
+    }
+
+    if (hole < *numNodes && nodes[hole]) {
+        rebalanceForwardedNodes(finalForward, position);
+
+        return makeRoomForwarded(finalForward, node);
+    }
+
+    if (hole == *numNodes) {
+        (*numNodes)++;
+    }
+
+    for (uint64_t i = hole; i > position; i--) {
+        nodes[i] = nodes[i - 1];
+        nodes[i]->indexForward = i;
+    }
+
+    return position;
+}
+
+/** @brief Adds a node to an array.
+ *  Adds a node storing information about a redirected prefix - to the array
+ *  of terminal nodes for redirected prefixes. An array is contained in
+ *  the specific node to whom the prefixes are redirected and it is kept sorted
+ *  by the redirected prefixes, see @ref makeRoomForwarded. If the node has
+ *  been redirected elsewhere before, the previous final node is released
+ *  when it is not used anymore.
+ *
+ * @param[in, out] pool - pools which have handed out the nodes of the final
+ *                        redirection tree;
+ * @param[in, out] toBeForwarded - a terminal node for a redirected prefix
+ * @param[in, out] finalForward - a terminal node for the final redirection.
+ *
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool addForwardedNode(TreePool * pool, InitialNode* toBeForwarded,
+                             ForwardedNode* finalForward) {
+    uint64_t * slots = &(finalForward->numSlotsForNodes);
+    uint64_t * numNodes = &(finalForward->numForwardedNodes);
+    uint64_t neededSlots = 2 * (finalForward->sumForwarded + 1);
+
+    if (isForwardSet(toBeForwarded->isForwarded)
+        && toBeForwarded->forwardingNode == finalForward) {
+        return true;
+    }
+
+    if (*slots <= *numNodes || *slots < neededSlots) {
+        uint64_t newSlots = (*slots)*2 + 1;
+        if (newSlots < neededSlots) {
+            newSlots = neededSlots;
+        }
+
+        InitialNode ** newNodeArray = realloc(finalForward->forwardedNodes,
+                                              newSlots * sizeof(InitialNode*));
+
+        if (!newNodeArray) {
+            return false;
+        }
+
+        finalForward->forwardedNodes = newNodeArray;
+        *slots = newSlots;
+    }
+
+    ForwardedNode * previousForward = NULL;
+
+    if (isForwardSet(toBeForwarded->isForwarded)) {
+        uint64_t previousIndex = toBeForwarded->indexForward;
+        previousForward = toBeForwarded->forwardingNode;
+
+        excludeForwardedNode(previousForward, previousIndex);
+    }
+
+    uint64_t position = makeRoomForwarded(finalForward, toBeForwarded);
+
+    finalForward->forwardedNodes[position] = toBeForwarded;
+    toBeForwarded->indexForward = position;
+    toBeForwarded->forwardingNode = finalForward;
+    (finalForward->sumForwarded)++;
+
+    if (previousForward) {
+        releaseUnusedForwardedNode(pool, previousForward);
+    }
+
+    return true;
+}
+
+/** @brief Adds a redirection.
+ * Extends the paths of both prefixes, starting from the given nodes, and
+ * redirects the first prefix to the second one. On failure the nodes added
+ * for the redirection are removed.
+ *
+ * @param[in, out] pfd - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in, out] initialStart - a node whose path begins @p num1;
+ * @param[in] num1 - the validated redirected prefix;
+ * @param[in] len1 - the length of @p num1;
+ * @param[in, out] forwardedStart - a node whose path begins @p num2;
+ * @param[in] num2 - the validated final prefix, different from @p num1;
+ * @param[in] len2 - the length of @p num2;
+ * @param[out] currentInitial - the terminal node of @p num1 on success;
+ * @param[out] currentForward - the terminal node of @p num2 on success.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool addRedirection(PhoneForward * pfd, InitialNode * initialStart,
+                           char const * num1, size_t len1,
+                           ForwardedNode * forwardedStart, char const * num2,
+                           size_t len2, InitialNode ** currentInitial,
+                           ForwardedNode ** currentForward) {
+    // Extending the path for redirected prefix
+    if (!extendInitialPath(pfd, initialStart, num1, len1, currentInitial)) {
+        removeStumpsInitialNode(&(pfd->initialPool), *currentInitial);
+
+        return false;
+    }
+
+    //Extending the path for the final prefix
+    if (!extendForwardedPath(pfd, forwardedStart, num2, len2,
+                             currentForward)) {
+        removeStumpsInitialNode(&(pfd->initialPool), *currentInitial);
+        removeStumpsForwardedNode(&(pfd->forwardedPool), *currentForward);
+
+        return false;
+    }
+
+    if (!addForwardedNode(&(pfd->forwardedPool), *currentInitial,
+                          *currentForward)) {
+        removeStumpsInitialNode(&(pfd->initialPool), *currentInitial);
+        removeStumpsForwardedNode(&(pfd->forwardedPool), *currentForward);
+
+        return false;
+    }
+
+    setBitForward(&((*currentForward)->isForwarding));
+    setBitForward(&((*currentInitial)->isForwarded));
+
+    return true;
+}
+
+/** @struct TransactionOperation
+ * @brief A staged operation of a transaction.
+ * @var TransactionOperation::offset1
+ *      The offset of the first number in
+ *      \link PhoneForwardTransaction::text text \endlink.
+ * @var TransactionOperation::offset2
+ *      The offset of the final prefix of an addition.
+ * @var TransactionOperation::len1
+ *      The length of the first number.
+ * @var TransactionOperation::len2
+ *      The length of the final prefix of an addition, 0 for a removal.
+ */
+typedef struct TransactionOperation {
+    size_t offset1;
+    size_t offset2;
+    size_t len1;
+    size_t len2;
+} TransactionOperation;  ///< Staged addition or removal
+
+/** @struct PhoneForwardTransaction
+ * @brief A sequence of staged additions and removals of redirections.
+ * @var PhoneForwardTransaction::operations
+ *      The operations in the order they have been staged.
+ * @var PhoneForwardTransaction::numOperations
+ *      The number of the staged operations.
+ * @var PhoneForwardTransaction::slots
+ *      The number of the operations the memory has been allocated for.
+ * @var PhoneForwardTransaction::numAdditions
+ *      The number of the staged additions.
+ * @var PhoneForwardTransaction::text
+ *      The copied numbers, each followed by the terminating null character,
+ *      placed one after another.
+ * @var PhoneForwardTransaction::textLength
+ *      The number of the used bytes of
+ *      \link PhoneForwardTransaction::text text \endlink.
+ * @var PhoneForwardTransaction::textSlots
+ *      The number of the bytes allocated for
+ *      \link PhoneForwardTransaction::text text \endlink.
+ */
+typedef struct PhoneForwardTransaction {
+    TransactionOperation* operations;
+    size_t numOperations;
+    size_t slots;
+    size_t numAdditions;
+    char* text;
+    size_t textLength;
+    size_t textSlots;
+} PhoneForwardTransaction;  ///< Staged modifications applied together
+
+PhoneForwardTransaction * phfwdTransactionNew(void) {
+    return calloc(1, sizeof(PhoneForwardTransaction));
+}
+
+void phfwdTransactionDelete(PhoneForwardTransaction *tx) {
+    if (tx) {
+        free(tx->operations);
+        free(tx->text);
+        free(tx);
+    }
+}
+
+/** @brief Stages an operation.
+ * Copies the numbers of the operation to the transaction.
+ *
+ * @param[in, out] tx - a pointer to the transaction;
+ * @param[in] num1 - the validated first number;
+ * @param[in] len1 - the length of @p num1;
+ * @param[in] num2 - the validated final prefix of an addition, ignored by
+ *                   a removal;
+ * @param[in] len2 - the length of @p num2, 0 for a removal.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool stageOperation(PhoneForwardTransaction * tx, char const * num1,
+                           size_t len1, char const * num2, size_t len2) {
+    size_t neededText = tx->textLength + len1 + 1 + (len2 > 0 ? len2 + 1 : 0);
+
+    // The memory is ensured first, so a failure leaves the transaction intact
+    if (tx->numOperations == tx->slots) {
+        size_t slots = 2 * tx->slots + 1;
+        TransactionOperation * operations =
+                realloc(tx->operations, slots * sizeof(TransactionOperation));
+
+        if (!operations) {
+            return false;
+        }
+
+        tx->operations = operations;
+        tx->slots = slots;
+    }
+
+    if (tx->textSlots < neededText) {
+        size_t textSlots = 2 * tx->textSlots > neededText ? 2 * tx->textSlots
+                                                          : neededText;
+        char * text = realloc(tx->text, textSlots);
+
+        if (!text) {
+            return false;
+        }
+
+        tx->text = text;
+        tx->textSlots = textSlots;
+    }
+
+    TransactionOperation * operation = &(tx->operations[tx->numOperations]);
+
+    operation->offset1 = tx->textLength;
+    operation->len1 = len1;
+    memcpy(tx->text + tx->textLength, num1, len1 + 1);
+    tx->textLength += len1 + 1;
+
+    operation->offset2 = tx->textLength;
+    operation->len2 = len2;
+    if (len2 > 0) {
+        memcpy(tx->text + tx->textLength, num2, len2 + 1);
+        tx->textLength += len2 + 1;
+        tx->numAdditions++;
+    }
+
+    tx->numOperations++;
+
+    return true;
+}
+
+/** @brief Releases a shared image.
+ * Frees the image when the last structure using it releases it.
+ *
+ * @param[in, out] shared - a pointer to the shared image or NULL.
+ */
+static void releaseImage(SharedImage * shared) {
+    if (shared && atomic_fetch_sub(&(shared->references), 1) == 1) {
+        free(shared->image);
+        free(shared);
+    }
+}
+
+/** @brief Counts the nodes of a shared image.
+ *
+ * @param[in] shared - a pointer to the shared image.
+ * @return The number of the nodes of both trees in the image.
+ */
+static size_t imageNodes(SharedImage const * shared) {
+    FlatTrieHeader const * header = shared->image;
+
+    return (size_t) header->numInitial + header->numForwarded;
+}
+
+/** @brief Measures a shared image.
+ *
+ * @param[in] shared - a pointer to the shared image.
+ * @return The size of the image in bytes.
+ */
+static size_t imageLength(SharedImage const * shared) {
+    FlatTrieHeader const * header = shared->image;
+
+    return (size_t) header->totalLength;
+}
+
+/** @brief Drops the compiled image of a structure.
+ * Releases the image and the changes made after it has been built.
+ * The snapshots sharing the image keep it.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections, not read-only.
+ */
+static void dropImage(PhoneForward * pf) {
+    releaseImage(pf->compiled);
+    phfwdTransactionDelete(pf->changes);
+    pf->compiled = NULL;
+    pf->changes = NULL;
+    pf->replayedChanges = 0;
+    pf->isShared = false;
+    pf->flat.header = NULL;
+}
+
+/** @brief Prepares a structure for a modification.
+ * Outdates the cached redirections and stops using the compiled image, so
+ * the lookups use the trees again. The image is kept for the snapshots,
+ * which replay the changes recorded by @ref recordChange on top of it.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections, not read-only.
+ */
+static void beginModification(PhoneForward * pf) {
+    pf->generation++;
+    pf->flat.header = NULL;
+}
+
+/** @brief Records a modification.
+ * Appends a made modification to the journal, if it is enabled, and to
+ * the changes made since the compiled image has been built, if a snapshot
+ * has shared the image, as the next snapshots are likely to share it too.
+ * Otherwise the image is dropped, as it is also when the changes cannot be
+ * recorded or when a snapshot would rather compile a new image than replay
+ * them all.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections;
+ * @param[in] num1 - the validated first number;
+ * @param[in] len1 - the length of @p num1;
+ * @param[in] num2 - the validated final prefix of an addition or NULL for
+ *                   a removal;
+ * @param[in] len2 - the length of @p num2, 0 for a removal.
+ */
+static void recordChange(PhoneForward * pf, char const * num1, size_t len1,
+                         char const * num2, size_t len2) {
+    if (pf->journal) {
+        journalAppend(pf->journal, len2 > 0 ? JOURNAL_ADD : JOURNAL_REMOVE,
+                      num1, len1, num2, len2);
+    }
+
+    if (!pf->compiled) {
+        return;
+    }
+
+    // An image no snapshot has shared is not worth its memory nor the records
+    if (!pf->isShared) {
+        dropImage(pf);
+
+        return;
+    }
+
+    if (!pf->changes) {
+        pf->changes = phfwdTransactionNew();
+    }
+
+    if (!pf->changes
+        || pf->changes->numOperations * REPLAY_COST
+           >= imageNodes(pf->compiled)
+        || !stageOperation(pf->changes, num1, len1, num2, len2)) {
+        dropImage(pf);
+    }
+}
+
+bool phfwdAdd(PhoneForward *pfd, char const *num1, char const *num2) {
+    if (!pfd || pfd->isReadOnly) {
+        return false;
+    }
+
+    size_t len1 = checkLength(num1);
+    if (len1 == 0) {
+        return false;
+    }
+
+    size_t len2 = checkLength(num2);
+    if (len2 == 0) {
+        return false;
+    }
+
+    if (strcmp(num1, num2) == 0) {
+        return false;
+    }
+
+    InitialNode * currentInitial;
+    ForwardedNode * currentForward;
+
+    beginModification(pfd);
+
+    bool isAdded = addRedirection(pfd, pfd->initialRoot, num1, len1,
+                                  pfd->forwardedRoot, num2, len2,
+                                  &currentInitial, &currentForward);
+
+    // A failed addition leaves the redirections as they were, nothing to record
+    if (isAdded) {
+        recordChange(pfd, num1, len1, num2, len2);
+    }
+
+    return isAdded;
+}
+
+/** @struct BulkRule
+ * @brief A validated rule of @ref phfwdAddBulk.
+ * @var BulkRule::num1
+ *      The redirected prefix.
+ * @var BulkRule::num2
+ *      The final prefix.
+ * @var BulkRule::key1
+ *      The sort key of \link BulkRule::num1 num1 \endlink, see
+ *      @ref bulkSortKey.
+ * @var BulkRule::len1
+ *      The length of \link BulkRule::num1 num1 \endlink.
+ * @var BulkRule::len2
+ *      The length of \link BulkRule::num2 num2 \endlink.
+ * @var BulkRule::index
+ *      The position of the rule in the array passed to @ref phfwdAddBulk.
+ */
+typedef struct BulkRule {
+    char const * num1;
+    char const * num2;
+    uint64_t key1;
+    size_t len1;
+    size_t len2;
+    size_t index;
+} BulkRule;  ///< Rule of a bulk addition
+
+/** @brief Computes the sort key of a number.
+ * Packs the first @ref MAX_LABEL_LENGTH digits of the number as
+ * @ref prefixKeyOf does. Comparing the keys therefore gives the order of
+ * @ref customStrcmp without reading the numbers, unless the keys are equal.
+ *
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number.
+ * @return The key of the number.
+ */
+static uint64_t bulkSortKey(char const * num, size_t len) {
+    uint32_t length = len < MAX_LABEL_LENGTH ? (uint32_t) len
+                                             : MAX_LABEL_LENGTH;
+
+    return prefixKeyOf(0, 0, packLabel(num, length), (uint8_t) length);
+}
+
+/** @brief Compares two sort keys.
+ *
+ * @param[in] first - the first key;
+ * @param[in] second - the second key.
+ * @return A negative value if the first key is smaller, a positive value if
+ *         it is greater, zero in case of equal keys.
+ */
+static int compareKeys(uint64_t first, uint64_t second) {
+    return (first > second) - (first < second);
+}
+
+/** @brief Compares two rules.
+ * Orders the rules by the redirected prefixes, in the order of
+ * @ref customStrcmp, and the rules with equal prefixes by their positions.
+ *
+ * @param[in] first - a pointer to the first rule;
+ * @param[in] second - a pointer to the second rule.
+ * @return A negative value if the first rule precedes the second one,
+ *         a positive value otherwise.
+ */
+static int compareBulkRules(void const * first, void const * second) {
+    BulkRule const * firstRule = first;
+    BulkRule const * secondRule = second;
+    int result = compareKeys(firstRule->key1, secondRule->key1);
+
+    if (result == 0) {
+        result = customStrcmp(firstRule->num1, secondRule->num1);
+    }
+
+    if (result != 0) {
+        return result;
+    }
+
+    return (firstRule->index > secondRule->index)
+           - (firstRule->index < secondRule->index);
+}
+
+/** @brief Computes the length of the common beginning of two numbers.
+ *
+ * @param[in] first - the first validated number;
+ * @param[in] second - the second validated number.
+ * @return The number of the leading digits the numbers share.
+ */
+static size_t commonPrefixLength(char const * first, char const * second) {
+    size_t length = 0;
+
+    while (first[length] != '\0' && first[length] == second[length]) {
+        length++;
+    }
+
+    return length;
+}
+
+/** @brief Checks whether a rule is overridden.
+ * Only the last of the rules with the same redirected prefix counts, which
+ * is the last one of them in the sorted order.
+ *
+ * @param[in] sorted - the sorted rules;
+ * @param[in] n - the number of the rules;
+ * @param[in] i - the index of the rule in the sorted order.
+ * @return @p True if the next rule has the same redirected prefix,
+ *         @p false otherwise.
+ */
+static bool isOverriddenBulkRule(BulkRule const * sorted, size_t n,
+                                 size_t i) {
+    return i + 1 < n && sorted[i].key1 == sorted[i + 1].key1
+           && strcmp(sorted[i].num1, sorted[i + 1].num1) == 0;
+}
+
+bool phfwdAddBulk(PhoneForward *pf, PhoneForwardRule const *rules, size_t n) {
+    if (!pf || pf->isReadOnly || (!rules && n > 0)) {
+        return false;
+    }
+
+    BulkRule * sorted = malloc((n > 0 ? n : 1) * sizeof(BulkRule));
+    if (!sorted) {
+        return false;
+    }
+
+    // The whole input is validated before the structure is changed
+    for (size_t i = 0; i < n; i++) {
+        BulkRule * rule = &(sorted[i]);
+
+        rule->num1 = rules[i].num1;
+        rule->num2 = rules[i].num2;
+        rule->len1 = checkLength(rule->num1);
+        rule->len2 = checkLength(rule->num2);
+        rule->index = i;
+
+        if (rule->len1 == 0 || rule->len2 == 0
+            || strcmp(rule->num1, rule->num2) == 0) {
+            free(sorted);
+
+            return false;
+        }
+
+        rule->key1 = bulkSortKey(rule->num1, rule->len1);
+    }
+
+    /*
+     * In the sorted order the consecutive prefixes share their beginnings
+     * and every final node receives its redirected nodes at the end of its
+     * sorted array.
+     */
+    qsort(sorted, n, sizeof(BulkRule), compareBulkRules);
+    beginModification(pf);
+
+    InitialNode * currentInitial = pf->initialRoot;
+    ForwardedNode * currentForward = pf->forwardedRoot;
+    char const * previousNum1 = "";
+    char const * previousNum2 = "";
+    bool isSuccessful = true;
+    size_t numApplied = 0;
+
+    for (; numApplied < n && isSuccessful; numApplied++) {
+        BulkRule const * rule = &(sorted[numApplied]);
+
+        if (isOverriddenBulkRule(sorted, n, numApplied)) {
+            continue;
+        }
+
+        /*
+         * The terminal nodes of the previous rule are never merged away, so
+         * the walks start from their ancestors on the common paths.
+         */
+        size_t common1 = commonPrefixLength(previousNum1, rule->num1);
+        while (currentInitial->depth > common1) {
+            currentInitial = currentInitial->ancestor;
+        }
+
+        size_t common2 = commonPrefixLength(previousNum2, rule->num2);
+        while (currentForward->depth > common2) {
+            currentForward = currentForward->ancestor;
+        }
+
+        isSuccessful = addRedirection(pf, currentInitial, rule->num1,
+                                      rule->len1, currentForward, rule->num2,
+                                      rule->len2, &currentInitial,
+                                      &currentForward);
+        previousNum1 = rule->num1;
+        previousNum2 = rule->num2;
+    }
+
+    // The failed rule has changed nothing
+    if (!isSuccessful) {
+        numApplied--;
+    }
+
+    /*
+     * The rules made before a failure stay, so they are recorded as well.
+     * Their redirected prefixes differ, so the order of the records does not
+     * matter.
+     */
+    for (size_t i = 0; i < numApplied && (pf->journal || pf->compiled); i++) {
+        if (!isOverriddenBulkRule(sorted, n, i)) {
+            recordChange(pf, sorted[i].num1, sorted[i].len1, sorted[i].num2,
+                         sorted[i].len2);
+        }
+    }
+
+    free(sorted);
+
+    return isSuccessful;
+}
+
+/** @brief Removes the redirections of a prefix.
+ * Clears the redirections of all the prefixes starting with @p num and
+ * removes their nodes, except for the nodes pinned by a transaction and
+ * the paths leading to them. Never allocates memory.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - the validated prefix;
+ * @param[in] len - the length of the prefix.
+ */
+static void removeRedirections(PhoneForward * pf, char const * num,
+                               size_t len) {
+    /*
+     * The removed subtree starts in the first node whose path is at least
+     * as long as the prefix; the prefix may end inside the edge label.
+     */
+    InitialNode *currentInitialCore = pf->initialRoot;
+    while (currentInitialCore->depth < len) {
+        size_t depth = currentInitialCore->depth;
+        InitialNode *child = getInitialChild(currentInitialCore,
+                                             getIndex(num[depth]));
+
+        if (!child) {
+            return;
+        }
+
+        uint32_t matched = matchLabel(child->label, child->labelLength,
+                                      num + depth, len - depth);
+        // Either the whole label or the whole rest of the prefix matches
+        if (matched < child->labelLength && depth + matched < len) {
+            return;
+        }
+
+        currentInitialCore = child;
+    }
+
+    InitialNode *coreAncestor = currentInitialCore->ancestor;
+    InitialNode *currentInitial = currentInitialCore;
+    bool isCoreRemoved = false;
+
+    while (currentInitial->childMask != 0) {
+        currentInitial = currentInitial->children[0];
+    }
+
+    // The subtree is visited in post-order, every node after its children
+    while (true) {
+        if (isForwardSet(currentInitial->isForwarded)) {
+            removeForwardedNodeFromInitialAndRemoveInitialFromForward(
+                    &(pf->forwardedPool), currentInitial);
+        }
+
+        InitialNode *currentAncestor = currentInitial->ancestor;
+        bool isCore = currentInitial == currentInitialCore;
+        uint32_t next = childPosition(currentAncestor->childMask,
+                                      labelDigit(currentInitial->label, 0));
+
+        // A removed child leaves the packed array, the next one takes its slot
+        if (currentInitial->childMask == 0
+            && !isPinnedSet(currentInitial->isForwarded)) {
+            removeInitialNode(&(pf->initialPool), currentInitial);
+            isCoreRemoved = isCore;
+        }
+        else {
+            // A path kept for a pinned node is joined as a new one would be
+            if (!isCore && !isPinnedSet(currentInitial->isForwarded)) {
+                mergeInitialNodeWithChild(&(pf->initialPool), currentInitial);
+            }
+
+            next++;
+        }
+
+        if (isCore) {
+            break;
+        }
+
+        if (next < countChildren(currentAncestor->childMask)) {
+            currentInitial = currentAncestor->children[next];
+
+            while (currentInitial->childMask != 0) {
+                currentInitial = currentInitial->children[0];
+            }
+        }
+        else {
+            currentInitial = currentAncestor;
+        }
+    }
+
+    removeStumpsInitialNode(&(pf->initialPool),
+                            isCoreRemoved ? coreAncestor : currentInitialCore);
+}
+
+void phfwdRemove(PhoneForward * pf, char const * num) {
+    if (pf && !pf->isReadOnly) {
+        size_t len = checkLength(num);
+
+        if (len == 0) {
+            return;
+        }
+
+        beginModification(pf);
+        removeRedirections(pf, num, len);
+        recordChange(pf, num, len, NULL, 0);
+    }
+}
+
+bool phfwdTransactionAdd(PhoneForwardTransaction *tx, char const *num1,
+                         char const *num2) {
+    if (!tx) {
+        return false;
+    }
+
+    size_t len1 = checkLength(num1);
+    size_t len2 = checkLength(num2);
+
+    if (len1 == 0 || len2 == 0 || strcmp(num1, num2) == 0) {
+        return false;
+    }
+
+    return stageOperation(tx, num1, len1, num2, len2);
+}
+
+bool phfwdTransactionRemove(PhoneForwardTransaction *tx, char const *num) {
+    if (!tx) {
+        return false;
+    }
+
+    size_t len = checkLength(num);
+    if (len == 0) {
+        return false;
+    }
+
+    return stageOperation(tx, num, len, NULL, 0);
+}
+
+/** @brief Compares two nodes by their addresses.
+ *
+ * @param[in] first - a pointer to a pointer to the first node;
+ * @param[in] second - a pointer to a pointer to the second node.
+ * @return A negative value if the first node is placed lower in memory,
+ *         a positive value if higher, zero for the same node.
+ */
+static int compareNodeAddresses(void const * first, void const * second) {
+    uintptr_t firstAddress = (uintptr_t) *(ForwardedNode * const *) first;
+    uintptr_t secondAddress = (uintptr_t) *(ForwardedNode * const *) second;
+
+    return (firstAddress > secondAddress) - (firstAddress < secondAddress);
+}
+
+/** @brief Reserves the slots for the redirected nodes.
+ * Enlarges the array of the redirected nodes of @p finalForward, so that
+ * @ref addForwardedNode never reallocates it while adding up to @p count
+ * nodes, as long as the node is pinned and the array is not compacted.
+ *
+ * @param[in, out] finalForward - a terminal node for the final redirection;
+ * @param[in] count - the number of the nodes to be added.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool reserveForwardedSlots(ForwardedNode * finalForward,
+                                  uint64_t count) {
+    /*
+     * Every addition extends the used part by at most one slot, and
+     * the rebalancing shrinks it to twice the number of the nodes.
+     */
+    uint64_t neededSlots = 2 * (finalForward->sumForwarded + count);
+    if (neededSlots < finalForward->numForwardedNodes) {
+        neededSlots = finalForward->numForwardedNodes;
+    }
+    neededSlots += count + 1;
+
+    uint64_t * slots = &(finalForward->numSlotsForNodes);
+    if (*slots >= neededSlots) {
+        return true;
+    }
+
+    uint64_t newSlots = (*slots)*2 + 1;
+    if (newSlots < neededSlots) {
+        newSlots = neededSlots;
+    }
+
+    InitialNode ** newNodeArray = realloc(finalForward->forwardedNodes,
+                                          newSlots * sizeof(InitialNode*));
+    if (!newNodeArray) {
+        return false;
+    }
+
+    finalForward->forwardedNodes = newNodeArray;
+    *slots = newSlots;
+
+    return true;
+}
+
+/** @brief Releases the nodes pinned by a transaction.
+ * Unpins the terminal nodes of the first @p numInitial and @p numForward
+ * staged additions, taken in the order of @p sorted, and removes those which
+ * do not participate in any redirection, together with the unnecessary
+ * nodes on their paths.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in] sorted - the staged additions in the order of their walks;
+ * @param[in] initials - the terminal nodes of the redirected prefixes,
+ *                       indexed as the additions;
+ * @param[in] numInitial - the number of the additions whose redirected
+ *                         prefixes have been pinned;
+ * @param[in, out] forwards - the terminal nodes of the final prefixes,
+ *                            indexed as the additions;
+ * @param[in, out] targets - the memory for @p numForward nodes, sorted by
+ *                           their addresses unless @p isSorted is set;
+ * @param[in] numForward - the number of the additions whose final prefixes
+ *                         have been pinned;
+ * @param[in] isSorted - indicates whether @p targets already holds
+ *                       the sorted pinned final nodes.
+ */
+static void releasePinnedNodes(PhoneForward * pf, BulkRule const * sorted,
+                               InitialNode * const * initials,
+                               size_t numInitial,
+                               ForwardedNode * const * forwards,
+                               ForwardedNode ** targets, size_t numForward,
+                               bool isSorted) {
+    // The additions of the same prefix are adjacent and share the node
+    InitialNode * previousInitial = NULL;
+    for (size_t i = 0; i < numInitial; i++) {
+        InitialNode * init = initials[sorted[i].index];
+
+        if (init != previousInitial) {
+            clearBitPinned(&(init->isForwarded));
+            removeStumpsInitialNode(&(pf->initialPool), init);
+            previousInitial = init;
+        }
+    }
+
+    if (!isSorted) {
+        for (size_t i = 0; i < numForward; i++) {
+            targets[i] = forwards[sorted[i].index];
+        }
+
+        qsort(targets, numForward, sizeof(ForwardedNode*),
+              compareNodeAddresses);
+    }
+
+    for (size_t i = 0; i < numForward; i++) {
+        if (i == 0 || targets[i] != targets[i - 1]) {
+            clearBitPinned(&(targets[i]->isForwarding));
+            releaseUnusedForwardedNode(&(pf->forwardedPool), targets[i]);
+        }
+    }
+}
+
+/** @brief Prepares the staged additions.
+ * Extends the paths of all the prefixes of the staged additions, in
+ * the sorted order sharing the walks as @ref phfwdAddBulk does, pins their
+ * terminal nodes and reserves the slots for the redirected nodes. None of
+ * the redirections is changed. On failure the nodes added for the additions
+ * are removed.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in] sorted - the staged additions sorted by @ref compareBulkRules;
+ * @param[in] n - the number of the additions;
+ * @param[out] initials - the terminal nodes of the redirected prefixes,
+ *                        indexed as the additions;
+ * @param[out] forwards - the terminal nodes of the final prefixes, indexed as
+ *                        the additions;
+ * @param[out] targets - the pinned final nodes sorted by their addresses.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool prepareAdditions(PhoneForward * pf, BulkRule const * sorted,
+                             size_t n, InitialNode ** initials,
+                             ForwardedNode ** forwards,
+                             ForwardedNode ** targets) {
+    InitialNode * currentInitial = pf->initialRoot;
+    ForwardedNode * currentForward = pf->forwardedRoot;
+    char const * previousNum1 = "";
+    char const * previousNum2 = "";
+    size_t numPrepared = 0;
+    bool isPrepared = true;
+
+    // The pinned terminal nodes of the previous addition are never merged away
+    while (numPrepared < n) {
+        BulkRule const * rule = &(sorted[numPrepared]);
+
+        size_t common1 = commonPrefixLength(previousNum1, rule->num1);
+        while (currentInitial->depth > common1) {
+            currentInitial = currentInitial->ancestor;
+        }
+
+        if (!extendInitialPath(pf, currentInitial, rule->num1, rule->len1,
+                               &currentInitial)) {
+            removeStumpsInitialNode(&(pf->initialPool), currentInitial);
+            isPrepared = false;
+
+            break;
+        }
+
+        setBitPinned(&(currentInitial->isForwarded));
+        initials[rule->index] = currentInitial;
+
+        size_t common2 = commonPrefixLength(previousNum2, rule->num2);
+        while (currentForward->depth > common2) {
+            currentForward = currentForward->ancestor;
+        }
+
+        if (!extendForwardedPath(pf, currentForward, rule->num2, rule->len2,
+                                 &currentForward)) {
+            removeStumpsForwardedNode(&(pf->forwardedPool), currentForward);
+            releasePinnedNodes(pf, sorted, initials, numPrepared + 1,
+                               forwards, targets, numPrepared, false);
+
+            return false;
+        }
+
+        setBitPinned(&(currentForward->isForwarding));
+        forwards[rule->index] = currentForward;
+        previousNum1 = rule->num1;
+        previousNum2 = rule->num2;
+        numPrepared++;
+    }
+
+    for (size_t i = 0; i < numPrepared; i++) {
+        targets[i] = forwards[sorted[i].index];
+    }
+
+    qsort(targets, numPrepared, sizeof(ForwardedNode*), compareNodeAddresses);
+
+    for (size_t i = 0; i < numPrepared && isPrepared; ) {
+        size_t count = 1;
+        while (i + count < numPrepared && targets[i + count] == targets[i]) {
+            count++;
+        }
+
+        isPrepared = reserveForwardedSlots(targets[i], count);
+        i += count;
+    }
+
+    if (!isPrepared) {
+        releasePinnedNodes(pf, sorted, initials, numPrepared, forwards,
+                           targets, numPrepared, true);
+    }
+
+    return isPrepared;
+}
+
+/** @brief Applies the staged operations.
+ * Performs the operations in the order they have been staged, on the paths
+ * prepared by @ref prepareAdditions, therefore never allocates memory.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in] tx - a pointer to the transaction;
+ * @param[in] initials - the terminal nodes of the redirected prefixes of
+ *                       the additions;
+ * @param[in] forwards - the terminal nodes of the final prefixes of
+ *                       the additions.
+ */
+static void applyOperations(PhoneForward * pf,
+                            PhoneForwardTransaction const * tx,
+                            InitialNode * const * initials,
+                            ForwardedNode * const * forwards) {
+    size_t numAdded = 0;
+
+    for (size_t i = 0; i < tx->numOperations; i++) {
+        TransactionOperation const * operation = &(tx->operations[i]);
+
+        if (operation->len2 == 0) {
+            removeRedirections(pf, tx->text + operation->offset1,
+                               operation->len1);
+
+            continue;
+        }
+
+        InitialNode * init = initials[numAdded];
+        ForwardedNode * finalForward = forwards[numAdded];
+        numAdded++;
+
+        // The reserved slots make the addition succeed
+        addForwardedNode(&(pf->forwardedPool), init, finalForward);
+        setBitForward(&(finalForward->isForwarding));
+        setBitForward(&(init->isForwarded));
+    }
+}
+
+bool phfwdTransactionCommit(PhoneForward *pf,
+                            PhoneForwardTransaction const *tx) {
+    if (!pf || pf->isReadOnly || !tx) {
+        return false;
+    }
+
+    size_t n = tx->numAdditions;
+    size_t count = n > 0 ? n : 1;
+    BulkRule * sorted = malloc(count * sizeof(BulkRule));
+    InitialNode ** initials = malloc(count * sizeof(InitialNode*));
+    ForwardedNode ** forwards = malloc(count * sizeof(ForwardedNode*));
+    ForwardedNode ** targets = malloc(count * sizeof(ForwardedNode*));
+    bool isCommitted = sorted && initials && forwards && targets;
+
+    for (size_t i = 0, j = 0; i < tx->numOperations && isCommitted; i++) {
+        TransactionOperation const * operation = &(tx->operations[i]);
+
+        if (operation->len2 > 0) {
+            BulkRule * rule = &(sorted[j]);
+
+            rule->num1 = tx->text + operation->offset1;
+            rule->num2 = tx->text + operation->offset2;
+            rule->len1 = operation->len1;
+            rule->len2 = operation->len2;
+            rule->key1 = bulkSortKey(rule->num1, rule->len1);
+            rule->index = j++;
+        }
+    }
+
+    /*
+     * The trees are extended before any redirection changes, so a failure
+     * leaves the redirections, the image and the cached ones untouched.
+     */
+    if (isCommitted) {
+        qsort(sorted, n, sizeof(BulkRule), compareBulkRules);
+        isCommitted = prepareAdditions(pf, sorted, n, initials, forwards,
+                                       targets);
+    }
+
+    if (isCommitted) {
+        beginModification(pf);
+        applyOperations(pf, tx, initials, forwards);
+        releasePinnedNodes(pf, sorted, initials, n, forwards, targets, n,
+                           true);
+    }
+
+    for (size_t i = 0;
+         i < tx->numOperations && isCommitted && (pf->journal || pf->compiled);
+         i++) {
+        TransactionOperation const * operation = &(tx->operations[i]);
+
+        recordChange(pf, tx->text + operation->offset1, operation->len1,
+                     tx->text + operation->offset2, operation->len2);
+    }
+
+    free(sorted);
+    free(initials);
+    free(forwards);
+    free(targets);
+
+    return isCommitted;
+}
+
+/** @brief Frees memory owned by a node.
+ * Frees the array of redirected nodes owned by a node handed out by the pool
+ * of the tree storing the final prefixes; the arrays of children are
+ * dropped together with their pools. Released slots of the pool store NULL.
+ *
+ * @param[in, out] slot - a pointer to the slot of the pool storing the node.
+ */
+static void freeForwardedNodeContent(void * slot) {
+    ForwardedNode * forward = slot;
+
+    free(forward->forwardedNodes);
+}
+
+void phfwdDelete(PhoneForward * pf) {
+    if (pf) {
+        // The nodes are dropped together with the pools, without a traversal
+        releaseTreePool(&(pf->initialPool));
+
+        poolForEach(&(pf->forwardedPool.nodes), freeForwardedNodeContent);
+        releaseTreePool(&(pf->forwardedPool));
+
+        if (pf->mapping) {
+            munmap(pf->mapping, pf->mappingLength);
+        }
+
+        releaseImage(pf->compiled);
+        phfwdTransactionDelete(pf->changes);
+
+        if (pf->cache) {
+            cacheRelease(pf->cache);
+            free(pf->cache);
+        }
+
+        if (pf->journal) {
+            journalClose(pf->journal);
+            free(pf->journal);
+        }
+
+        free(pf);
+    }
+}
+
+bool phfwdSetCache(PhoneForward *pf, size_t capacity) {
+    if (!pf) {
+        return false;
+    }
+
+    NumberCache * cache = NULL;
+
+    if (capacity > 0) {
+        cache = malloc(sizeof(NumberCache));
+
+        uint32_t entries = capacity < NUMBER_CACHE_NONE
+                           ? (uint32_t) capacity : NUMBER_CACHE_NONE - 1;
+        if (!cache || !cacheInit(cache, entries)) {
+            free(cache);
+
+            return false;
+        }
+    }
+
+    if (pf->cache) {
+        cacheRelease(pf->cache);
+        free(pf->cache);
+    }
+
+    pf->cache = cache;
+
+    return true;
+}
+
+bool phfwdSetJournal(PhoneForward *pf, char const *path, size_t syncInterval) {
+    if (!pf || (path && pf->isReadOnly)) {
+        return false;
+    }
+
+    // The previous journal may be continued, so it is written before opening
+    bool isWritten = !pf->journal || journalSync(pf->journal);
+    Journal * journal = NULL;
+
+    if (path) {
+        journal = malloc(sizeof(Journal));
+
+        if (!journal || !journalOpen(journal, path, syncInterval)) {
+            free(journal);
+
+            return false;
+        }
+    }
+
+    if (pf->journal) {
+        isWritten = journalClose(pf->journal) && isWritten;
+        free(pf->journal);
+    }
+
+    pf->journal = journal;
+
+    return isWritten;
+}
+
+bool phfwdJournalSync(PhoneForward *pf) {
+    return pf && pf->journal && journalSync(pf->journal);
+}
+
+/** @brief Applies the additions read from a journal.
+ * Adds the redirections collected since the last removal at once.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections;
+ * @param[in] rules - the collected redirections;
+ * @param[in, out] numRules - the number of the collected redirections,
+ *                            reset to 0.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool replayAdditions(PhoneForward * pf, PhoneForwardRule const * rules,
+                            size_t * numRules) {
+    size_t n = *numRules;
+    *numRules = 0;
+
+    return n == 0 || phfwdAddBulk(pf, rules, n);
+}
+
+PhoneForward * phfwdReplayJournal(char const *path) {
+    if (!path) {
+        return NULL;
+    }
+
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return NULL;
+    }
+
+    struct stat status;
+    char * data = MAP_FAILED;
+    size_t length = 0;
+
+    if (fstat(descriptor, &status) == 0) {
+        length = (size_t) status.st_size;
+        data = length > 0 ? mmap(NULL, length, PROT_READ, MAP_PRIVATE,
+                                 descriptor, 0)
+                          : NULL;
+    }
+
+    close(descriptor);
+
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    PhoneForward * result = journalCheckHeader(data, length) ? phfwdNew()
+                                                             : NULL;
+    PhoneForwardRule * rules = NULL;
+    size_t numRules = 0;
+    size_t rulesSlots = 0;
+    bool isReplayed = result != NULL;
+
+    /*
+     * The additions between the removals are applied in bulk; the numbers
+     * stay in the mapping until they are copied into the trees.
+     */
+    JournalRecord record;
+    size_t offset = JOURNAL_HEADER_LENGTH;
+    size_t recordLength;
+
+    while (isReplayed && offset < length
+           && (recordLength = journalReadRecord(data + offset,
+                                                length - offset,
+                                                &record)) > 0) {
+        offset += recordLength;
+
+        if (record.type == JOURNAL_REMOVE) {
+            isReplayed = replayAdditions(result, rules, &numRules);
+
+            if (isReplayed) {
+                phfwdRemove(result, record.num1);
+            }
+
+            continue;
+        }
+
+        if (numRules == rulesSlots) {
+            rulesSlots = rulesSlots * 2 + 1;
+            PhoneForwardRule * moreRules = realloc(
+                    rules, rulesSlots * sizeof(PhoneForwardRule));
+
+            if (!moreRules) {
+                isReplayed = false;
+
+                break;
+            }
+
+            rules = moreRules;
+        }
+
+        rules[numRules].num1 = record.num1;
+        rules[numRules].num2 = record.num2;
+        numRules++;
+    }
+
+    isReplayed = isReplayed && replayAdditions(result, rules, &numRules);
+
+    free(rules);
+
+    if (length > 0) {
+        munmap(data, length);
+    }
+
+    if (!isReplayed) {
+        phfwdDelete(result);
+
+        return NULL;
+    }
+
+    return result;
+}
+
+/** @brief Creates and initializes a structure.
+ * Creates and initializes an empty PhoneNumbers structure. The memory for
+ * the numbers is allocated when the first one is added.
+ *
+ * @return A pointer to initialized @p PhoneNumbers structure.
+ */
+static PhoneNumbers * createNewPhoneNumbers() {
+    return calloc(1, sizeof (PhoneNumbers));
+}
+
+/** @brief Creates a structure of a fixed size.
+ * Allocates the structure, the array of offsets and the memory for
+ * the numbers as a single block of memory. The offsets are to be filled by
+ * the caller.
+ *
+ * @param[in] count - the number of the numbers;
+ * @param[in] textLength - the number of the bytes of all the numbers together
+ *                         with their terminating null characters.
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
+ */
+static PhoneNumbers * createSingleBlock(size_t count, size_t textLength) {
+    size_t headerLength = sizeof(PhoneNumbers) + count * sizeof(size_t);
+    PhoneNumbers * result = malloc(headerLength + textLength);
+    if (!result) {
+        return NULL;
+    }
+
+    result->offsets = (size_t*) (result + 1);
+    result->text = (char*) result + headerLength;
+    result->slots = count;
+    result->lastAvailableIndex = count;
+    result->textLength = textLength;
+    result->textSlots = textLength;
+    result->isSingleBlock = 1;
+    result->reverseIter = NULL;
+
+    return result;
+}
+
+void phnumDelete(PhoneNumbers *pnum) {
+    if (pnum && !pnum->isSingleBlock) {
+        free(pnum->offsets);
+        free(pnum->text);
+    }
+
+    if (pnum) {
+        phfwdReverseIterFree(pnum->reverseIter);
+    }
+
+    free(pnum);
+}
+
+/** @brief Finds the longest redirected prefix.
+ * Walks down the tree storing the redirected prefixes along the given number
+ * and finds the terminal node of its longest redirected prefix.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number.
+ * @return The terminal node of the longest redirected prefix of @p num or NULL
+ *         if no prefix of @p num is redirected.
+ */
+static InitialNode const * findLongestForwarded(PhoneForward const *pf,
+                                                char const *num, size_t len) {
+    InitialNode const * lastForwardedNode = NULL;
+    InitialNode const * currentInitial = pf->initialRoot;
+    bool isPossibleToPass = true;
+
+    while (currentInitial->depth < len && isPossibleToPass) {
+        if (isForwardSet(currentInitial->isForwarded)) {
+            lastForwardedNode = currentInitial;
+        }
+
+        InitialNode const * child = matchInitialChild(currentInitial, num, len);
+
+        if (child) {
+            currentInitial = child;
+        }
+        else {
+            isPossibleToPass = false;
+        }
+    }
+
+    //Check the last one
+    if (isForwardSet(currentInitial->isForwarded)) {
+        lastForwardedNode = currentInitial;
+    }
+
+    return lastForwardedNode;
+}
+
+/** @struct Redirection
+ * @brief The redirection applied to a number by @ref phfwdGet.
+ * @var Redirection::redirectedLength
+ *      The length of the longest redirected prefix of the number, 0 if no
+ *      prefix is redirected.
+ * @var Redirection::finalPrefix
+ *      The final prefix replacing the redirected one, not terminated with
+ *      the null character, if it is read from an image.
+ * @var Redirection::finalNode
+ *      The terminal node of the final prefix if it is read from the trees,
+ *      NULL otherwise.
+ * @var Redirection::finalLength
+ *      The length of the final prefix.
+ */
+typedef struct Redirection {
+    size_t redirectedLength;
+    char const * finalPrefix;
+    ForwardedNode const * finalNode;
+    size_t finalLength;
+} Redirection;  ///< Replacement of the longest redirected prefix
+
+/** @struct SplitNumber
+ * @brief A number whose digits are stored in two parts, such as
+ *      a redirected prefix followed by the rest of another number.
+ * @var SplitNumber::head
+ *      The first part of the digits.
+ * @var SplitNumber::headLength
+ *      The number of the digits in \link SplitNumber::head head \endlink.
+ * @var SplitNumber::tail
+ *      The rest of the digits.
+ * @var SplitNumber::length
+ *      The number of all the digits.
+ */
+typedef struct SplitNumber {
+    char const * head;
+    size_t headLength;
+    char const * tail;
+    size_t length;
+} SplitNumber;  ///< Number stored in two parts
+
+/** @brief Provides a digit of a number stored in two parts.
+ *
+ * @param[in] number - a pointer to the number;
+ * @param[in] index - the index of the digit, smaller than the length of
+ *                    the number.
+ * @return The digit.
+ */
+static char splitDigit(SplitNumber const * number, size_t index) {
+    return index < number->headLength
+           ? number->head[index] : number->tail[index - number->headLength];
+}
+
+/** @brief Compares an edge label with a number stored in two parts.
+ *
+ * @param[in] label - the packed label;
+ * @param[in] labelLength - the number of the digits of the label;
+ * @param[in] number - a pointer to the number;
+ * @param[in] depth - the index of the digit of the number compared with
+ *                    the first digit of the label;
+ * @param[in] limit - the number of the leading digits of the number which
+ *                    may be compared.
+ * @return @p True if the whole label matches the digits of the number
+ *         before @p limit, @p false otherwise.
+ */
+static bool matchSplitLabel(uint64_t label, uint32_t labelLength,
+                            SplitNumber const * number, size_t depth,
+                            size_t limit) {
+    if (limit - depth < labelLength) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < labelLength; i++) {
+        if (labelDigit(label, i) != getIndex(splitDigit(number, depth + i))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Walks down the changes of a snapshot along a number.
+ * Follows a number stored in two parts in the tree holding the changes
+ * made after the image of a snapshot has been built.
+ *
+ * @param[in] root - the root of the tree holding the changes;
+ * @param[in] number - a pointer to the number;
+ * @param[out] removedLength - the length of the shortest prefix of
+ *                             the number removed by the changes or SIZE_MAX
+ *                             if there is none.
+ * @return The terminal node of the longest prefix of the number redirected
+ *         by the changes or NULL if there is none.
+ */
+static InitialNode const * walkChanges(InitialNode const * root,
+                                       SplitNumber const * number,
+                                       size_t * removedLength) {
+    InitialNode const * node = root;
+    InitialNode const * lastForwarded = NULL;
+    *removedLength = SIZE_MAX;
+
+    while (node->depth < number->length) {
+        size_t depth = node->depth;
+        InitialNode const * child = getInitialChild(
+                node, getIndex(splitDigit(number, depth)));
+
+        if (!child || !matchSplitLabel(child->label, child->labelLength,
+                                       number, depth, number->length)) {
+            break;
+        }
+
+        node = child;
+
+        if (isRemovedSet(node->isForwarded) && *removedLength == SIZE_MAX) {
+            *removedLength = node->depth;
+        }
+
+        if (isForwardSet(node->isForwarded)) {
+            lastForwarded = node;
+        }
+    }
+
+    return lastForwarded;
+}
+
+/** @brief Walks down an image along a number stored in two parts.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] number - a pointer to the number;
+ * @param[in] limit - the length of the longest prefix of the number which
+ *                    is considered.
+ * @return The index of the terminal node of the longest redirected prefix
+ *         of the number not longer than @p limit or @ref FLAT_NONE if there
+ *         is none.
+ */
+static uint32_t findSplitFlatForwarded(FlatTrie const * trie,
+                                       SplitNumber const * number,
+                                       size_t limit) {
+    uint32_t node = 0;
+
+    while (trie->initial[node].depth < limit) {
+        FlatInitialNode const * parent = &(trie->initial[node]);
+        uint32_t digit = getIndex(splitDigit(number, parent->depth));
+
+        if (!hasChild(parent->childMask, digit)) {
+            break;
+        }
+
+        uint32_t child = parent->firstChild
+                         + childPosition(parent->childMask, digit);
+        FlatInitialNode const * childNode = &(trie->initial[child]);
+
+        if (!matchSplitLabel(childNode->label, childNode->labelLength, number,
+                             parent->depth, limit)) {
+            break;
+        }
+
+        node = child;
+    }
+
+    return trie->initial[node].nearestForwarded;
+}
+
+/** @brief Describes a redirection found in an image.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] forwarded - the index of the terminal node of the redirected
+ *                        prefix.
+ * @return The redirection.
+ */
+static Redirection flatRedirection(FlatTrie const * trie, uint32_t forwarded) {
+    FlatInitialNode const * initial = &(trie->initial[forwarded]);
+    FlatForwardedNode const * final = &(trie->forwarded[initial->target]);
+    Redirection result = {initial->depth, trie->pool + final->prefix, NULL,
+                          final->depth};
+
+    return result;
+}
+
+/** @brief Describes a redirection found in the trees.
+ *
+ * @param[in] forwarded - the terminal node of the redirected prefix.
+ * @return The redirection.
+ */
+static Redirection treeRedirection(InitialNode const * forwarded) {
+    ForwardedNode const * final = forwarded->forwardingNode;
+    Redirection result = {forwarded->depth, "", final, final->depth};
+
+    return result;
+}
+
+/** @brief Finds the redirection of a number in a snapshot with changes.
+ * The changes made after the image has been built take precedence: their
+ * redirected prefixes replace the ones of the image and a removal hides
+ * the redirected prefixes of the image which start with the removed one.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] changes - the root of the tree holding the changes;
+ * @param[in] number - a pointer to the number.
+ * @return The redirection of the number, with empty prefixes if no prefix of
+ *         the number is redirected.
+ */
+static Redirection findChangedRedirection(FlatTrie const * trie,
+                                          InitialNode const * changes,
+                                          SplitNumber const * number) {
+    size_t removedLength;
+    InitialNode const * changed = walkChanges(changes, number, &removedLength);
+    size_t limit = removedLength <= number->length ? removedLength - 1
+                                                   : number->length;
+    uint32_t forwarded = findSplitFlatForwarded(trie, number, limit);
+
+    if (forwarded != FLAT_NONE
+        && (!changed || trie->initial[forwarded].depth > changed->depth)) {
+        return flatRedirection(trie, forwarded);
+    }
+
+    if (changed) {
+        return treeRedirection(changed);
+    }
+
+    Redirection result = {0, "", NULL, 0};
+
+    return result;
+}
+
+/** @brief Finds the redirection of a number.
+ * Finds the longest redirected prefix of the number and its final prefix,
+ * in the trees or, if it is not empty, in the image of @p pf. In the image
+ * the deepest node reached along the number knows the nearest terminal node
+ * of a redirected prefix, so no flags are checked on the way.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number.
+ * @return The redirection of the number, with empty prefixes if no prefix of
+ *         @p num is redirected.
+ */
+static Redirection findRedirection(PhoneForward const * pf, char const * num,
+                                   size_t len) {
+    Redirection result = {0, "", NULL, 0};
+
+    if (pf->isOverlaid) {
+        SplitNumber number = {num, len, "", len};
+
+        result = findChangedRedirection(&(pf->flat), pf->initialRoot, &number);
+    }
+    else if (pf->flat.header) {
+        FlatTrie const * trie = &(pf->flat);
+        uint32_t reached = descendFlatInitial(trie, 0, num, len);
+        uint32_t forwarded = trie->initial[reached].nearestForwarded;
+
+        if (forwarded != FLAT_NONE) {
+            result = flatRedirection(trie, forwarded);
+        }
+    }
+    else {
+        InitialNode const * lastForwardedNode = findLongestForwarded(pf, num,
+                                                                     len);
+
+        if (lastForwardedNode) {
+            result = treeRedirection(lastForwardedNode);
+        }
+    }
+
+    return result;
+}
+
+/** @brief Computes the length of a redirected number.
+ *
+ * @param[in] redirection - the redirection of the number;
+ * @param[in] len - the length of the number.
+ * @return The number of the digits of the number after the redirection.
+ */
+static size_t forwardedLength(Redirection const * redirection, size_t len) {
+    return redirection->finalLength + (len - redirection->redirectedLength);
+}
+
+/** @brief Writes a redirected number.
+ * Writes the number after the redirection, followed by the terminating null
+ * character, into the memory large enough to store the number of digits
+ * given by @ref forwardedLength and the terminating null character.
+ *
+ * @param[in] redirection - the redirection of the number;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number;
+ * @param[out] destination - the memory for the redirected number.
+ */
+static void writeForwarded(Redirection const * redirection,
+                           char const * num, size_t len, char * destination) {
+    size_t finalPrefixLength = redirection->finalLength;
+    size_t finalSuffixLength = len - redirection->redirectedLength;
+
+    if (redirection->finalNode) {
+        writeForwardedPath(redirection->finalNode, destination);
+    }
+    else {
+        memcpy(destination, redirection->finalPrefix, finalPrefixLength);
+    }
+
+    memcpy(destination + finalPrefixLength,
+           num + redirection->redirectedLength, finalSuffixLength);
+    destination[finalPrefixLength + finalSuffixLength] = '\0';
+}
+
+/** @brief Creates a sequence of one number.
+ * Allocates the structure, the array of offsets and the number as a single
+ * block of memory.
+ *
+ * @param[in] number - the number;
+ * @param[in] length - the length of the number.
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
+ */
+static PhoneNumbers * createSingleNumber(char const * number, size_t length) {
+    PhoneNumbers * result = createSingleBlock(1, length + 1);
+    if (!result) {
+        return NULL;
+    }
+
+    result->offsets[0] = 0;
+    memcpy(result->text, number, length + 1);
+
+    return result;
+}
+
+/** @brief Caches the redirection of a number.
+ * Stores the redirection in the cache of the structure if it is enabled.
+ * A failure of the allocation only leaves the number not cached.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number;
+ * @param[in] forwarded - the redirected number;
+ * @param[in] forwardedLength - the length of the redirected number.
+ */
+static void cacheForwarded(PhoneForward const * pf, char const * num,
+                           size_t len, char const * forwarded,
+                           size_t forwardedLength) {
+    if (pf->cache) {
+        char * slot = cacheReserve(pf->cache, num, len, forwardedLength,
+                                   pf->generation);
+
+        if (slot) {
+            memcpy(slot, forwarded, forwardedLength + 1);
+        }
+    }
+}
+
+PhoneNumbers * phfwdGet(PhoneForward const *pf, char const* num) {
+    if (!pf) {
+        return NULL;
+    }
+
+    size_t len = checkLength(num);
+    size_t cachedLength;
+    char const * cached = (pf->cache && len > 0)
+                          ? cacheFind(pf->cache, num, len, pf->generation,
+                                      &cachedLength)
+                          : NULL;
+
+    if (cached) {
+        return createSingleNumber(cached, cachedLength);
+    }
+
+    // A string which is not a number gets a sequence with a missing number
+    if (len == 0) {
+        PhoneNumbers * result = createSingleBlock(1, 0);
+
+        if (result) {
+            result->offsets[0] = NO_NUMBER;
+        }
+
+        return result;
+    }
+
+    Redirection redirection = findRedirection(pf, num, len);
+    size_t resultLength = forwardedLength(&redirection, len);
+    PhoneNumbers * result = createSingleBlock(1, resultLength + 1);
+    if (!result) {
+        return NULL;
+    }
+
+    result->offsets[0] = 0;
+    writeForwarded(&redirection, num, len, result->text);
+    cacheForwarded(pf, num, len, result->text, resultLength);
+
+    return result;
+}
+
+size_t phfwdGetInto(PhoneForward const *pf, char const *num, char *out,
+                    size_t cap) {
+    if (!pf) {
+        return 0;
+    }
+
+    size_t len = checkLength(num);
+    if (len == 0) {
+        return 0;
+    }
+
+    size_t resultLength;
+    char const * cached = pf->cache
+                          ? cacheFind(pf->cache, num, len, pf->generation,
+                                      &resultLength)
+                          : NULL;
+
+    if (cached) {
+        if (out && resultLength < cap) {
+            memcpy(out, cached, resultLength + 1);
+        }
+
+        return resultLength;
+    }
+
+    Redirection redirection = findRedirection(pf, num, len);
+    resultLength = forwardedLength(&redirection, len);
+
+    if (out && resultLength < cap) {
+        writeForwarded(&redirection, num, len, out);
+        cacheForwarded(pf, num, len, out, resultLength);
+    }
+
+    return resultLength;
+}
+
+PhoneNumbers * phfwdGetBatch(PhoneForward const *pf, char const *const *nums,
+                             size_t n) {
+    if (!pf || (!nums && n > 0)) {
+        return NULL;
+    }
+
+    // The redirections and the lengths found in the first pass share one block
+    Redirection * redirections = malloc((n > 0 ? n : 1)
+                                        * (sizeof(Redirection)
+                                           + sizeof(size_t)));
+    if (!redirections) {
+        return NULL;
+    }
+
+    size_t * lengths = (size_t*) (redirections + n);
+
+    // The first pass finds the redirections and the size of all the results
+    size_t numbersLength = 0;
+    for (size_t i = 0; i < n; i++) {
+        lengths[i] = checkLength(nums[i]);
+
+        if (lengths[i] > 0) {
+            redirections[i] = findRedirection(pf, nums[i], lengths[i]);
+            numbersLength += forwardedLength(&redirections[i], lengths[i])
+                             + 1;
+        }
+    }
+
+    PhoneNumbers * result = createSingleBlock(n, numbersLength);
+    if (!result) {
+        free(redirections);
+
+        return NULL;
+    }
+
+    size_t offset = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (lengths[i] == 0) {
+            result->offsets[i] = NO_NUMBER;
+        }
+        else {
+            writeForwarded(&redirections[i], nums[i], lengths[i],
+                           result->text + offset);
+            result->offsets[i] = offset;
+            offset += forwardedLength(&redirections[i], lengths[i]) + 1;
+        }
+    }
+
+    free(redirections);
+
+    return result;
+}
+
+char const * phnumGet(PhoneNumbers const *pnum, size_t idx) {
+    if (!pnum || idx >= pnum->lastAvailableIndex
+        || pnum->offsets[idx] == NO_NUMBER) {
+        return NULL;
+    }
+    else {
+        return pnum->text + pnum->offsets[idx];
+    }
+}
+
+/** @brief Checks whether a redirection applies to a reconstructed number.
+ * Checks whether the redirection of the prefix represented by @p node is
+ * the one chosen by @ref phfwdGet for the number made of this prefix followed
+ * by @p suffix, i.e. whether no longer prefix of that number is redirected.
+ * Walks down the tree storing the redirected prefixes from @p node along
+ * @p suffix, without building the number nor allocating memory.
+ *
+ * @param[in] node - the terminal node of a redirected prefix;
+ * @param[in] suffix - the validated digits following the prefix;
+ * @param[in] suffixLength - the number of the digits in @p suffix.
+ * @return @p False if a longer prefix of the number is redirected,
+ *         @p true otherwise.
+ */
+static bool isLongestForwarded(InitialNode const * node, char const * suffix,
+                               size_t suffixLength) {
+    size_t matched = 0;
+
+    while (matched < suffixLength) {
+        InitialNode const * child = getInitialChild(node,
+                                                    getIndex(suffix[matched]));
+
+        if (!child || matchLabel(child->label, child->labelLength,
+                                 suffix + matched, suffixLength - matched)
+                      < child->labelLength) {
+            return true;
+        }
+
+        if (isForwardSet(child->isForwarded)) {
+            return false;
+        }
+
+        matched += child->labelLength;
+        node = child;
+    }
+
+    return true;
+}
+
+/** @brief Checks whether a redirection applies to a reconstructed number.
+ * Checks the same as @ref isLongestForwarded for the terminal node of
+ * a redirected prefix in an image.
+ *
+ * @param[in] trie - a pointer to the view of the image;
+ * @param[in] node - the index of the terminal node of a redirected prefix;
+ * @param[in] suffix - the validated digits following the prefix;
+ * @param[in] suffixLength - the number of the digits in @p suffix.
+ * @return @p False if a longer prefix of the number is redirected,
+ *         @p true otherwise.
+ */
+static bool isLongestFlatForwarded(FlatTrie const * trie, uint32_t node,
+                                   char const * suffix, size_t suffixLength) {
+    size_t matched = 0;
+
+    while (matched < suffixLength) {
+        FlatInitialNode const * parent = &(trie->initial[node]);
+        uint32_t digit = getIndex(suffix[matched]);
+
+        if (!hasChild(parent->childMask, digit)) {
+            return true;
+        }
+
+        node = parent->firstChild + childPosition(parent->childMask, digit);
+        FlatInitialNode const * child = &(trie->initial[node]);
+
+        if (matchLabel(child->label, child->labelLength, suffix + matched,
+                       suffixLength - matched) < child->labelLength) {
+            return true;
+        }
+
+        if (child->isForwarded) {
+            return false;
+        }
+
+        matched += child->labelLength;
+    }
+
+    return true;
+}
+
+/** @brief Makes room for a number.
+ * Enlarges the array of offsets and the memory for the numbers of
+ * the structure, if necessary, so that one more number of the given length
+ * fits. The numbers of a structure allocated as a single block are moved to
+ * separately allocated memory, which can grow, when they do not fit in
+ * the block. On failure the structure is left unchanged.
+ *
+ * @param[in, out] pnum - the structure storing the numbers;
+ * @param[in] length - the length of the number.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool reserveNumber(PhoneNumbers * pnum, size_t length) {
+    uint64_t slots = pnum->slots;
+    size_t textSlots = pnum->textSlots;
+    size_t neededText = pnum->textLength + length + 1;
+
+    if (slots <= pnum->lastAvailableIndex) {
+        slots = slots * 2 + 1;
+    }
+
+    if (textSlots < neededText) {
+        textSlots = textSlots * 2 > neededText ? textSlots * 2 : neededText;
+    }
+
+    if (slots == pnum->slots && textSlots == pnum->textSlots) {
+        return true;
+    }
+
+    // The numbers leave the block of the structure for memory which can grow
+    if (pnum->isSingleBlock) {
+        size_t * offsets = malloc(slots * sizeof(size_t));
+        char * text = malloc(textSlots);
+
+        if (!offsets || !text) {
+            free(offsets);
+            free(text);
+
+            return false;
+        }
+
+        memcpy(offsets, pnum->offsets,
+               pnum->lastAvailableIndex * sizeof(size_t));
+        memcpy(text, pnum->text, pnum->textLength);
+        pnum->offsets = offsets;
+        pnum->text = text;
+        pnum->slots = slots;
+        pnum->textSlots = textSlots;
+        pnum->isSingleBlock = 0;
+
+        return true;
+    }
+
+    if (slots != pnum->slots) {
+        size_t * offsets = realloc(pnum->offsets, slots * sizeof(size_t));
+        if (!offsets) {
+            return false;
+        }
+
+        pnum->offsets = offsets;
+        pnum->slots = slots;
+    }
+
+    if (textSlots != pnum->textSlots) {
+        char * text = realloc(pnum->text, textSlots);
+        if (!text) {
+            return false;
+        }
+
+        pnum->text = text;
+        pnum->textSlots = textSlots;
+    }
+
+    return true;
+}
+
+/** @brief Adding new number to PhoneNumbers.
+ * Appends a copy of the number to the numbers of the structure, reallocating
+ * its memory if necessary.
+ *
+ * @param[in, out] pnum - the structure storing the numbers;
+ * @param[in] number - the number;
+ * @param[in] length - the length of the number.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool appendNumber(PhoneNumbers * pnum, char const * number,
+                         size_t length) {
+    if (!reserveNumber(pnum, length)) {
+        return false;
+    }
+
+    pnum->offsets[pnum->lastAvailableIndex++] = pnum->textLength;
+    memcpy(pnum->text + pnum->textLength, number, length + 1);
+    pnum->textLength += length + 1;
+
+    return true;
+}
+
+PhoneNumbers * phnumNew(void) {
+    return createNewPhoneNumbers();
+}
+
+bool phnumAdd(PhoneNumbers *pnum, char const *num) {
+    if (!pnum || !num) {
+        return false;
+    }
+
+    return appendNumber(pnum, num, strlen(num));
+}
+
+/** @brief Empties a sequence.
+ * Removes all the numbers of the sequence, keeping the memory allocated for
+ * them.
+ *
+ * @param[in, out] pnum - the structure storing the numbers.
+ */
+static void clearNumbers(PhoneNumbers * pnum) {
+    pnum->lastAvailableIndex = 0;
+    pnum->textLength = 0;
+}
+
+PhoneNumbers * phfwdGetReuse(PhoneForward const *pf, char const *num,
+                             PhoneNumbers *pnum) {
+    if (!pnum) {
+        return phfwdGet(pf, num);
+    }
+
+    clearNumbers(pnum);
+
+    if (!pf) {
+        return NULL;
+    }
+
+    size_t len = checkLength(num);
+    size_t resultLength;
+    char const * cached = (pf->cache && len > 0)
+                          ? cacheFind(pf->cache, num, len, pf->generation,
+                                      &resultLength)
+                          : NULL;
+
+    if (cached) {
+        return appendNumber(pnum, cached, resultLength) ? pnum : NULL;
+    }
+
+    // A string which is not a number gets a sequence with a missing number
+    if (len == 0) {
+        if (!reserveNumber(pnum, 0)) {
+            return NULL;
+        }
+
+        pnum->offsets[pnum->lastAvailableIndex++] = NO_NUMBER;
+
+        return pnum;
+    }
+
+    Redirection redirection = findRedirection(pf, num, len);
+    resultLength = forwardedLength(&redirection, len);
+
+    if (!reserveNumber(pnum, resultLength)) {
+        return NULL;
+    }
+
+    pnum->offsets[pnum->lastAvailableIndex++] = 0;
+    writeForwarded(&redirection, num, len, pnum->text);
+    pnum->textLength = resultLength + 1;
+    cacheForwarded(pf, num, len, pnum->text, resultLength);
+
+    return pnum;
+}
+
+/** @struct ReversePrefix
+ * @brief A redirected prefix visited by a @ref ReverseLevel, stored either
+ *      in the trees or in the image of the structure.
+ * @var ReversePrefix::prefix
+ *      The digits of the redirected prefix or NULL if there is no prefix.
+ *      The digits of a prefix from the trees are written down in
+ *      \link ReverseLevel::path path \endlink of the stream.
+ * @var ReversePrefix::length
+ *      The number of the digits in \link ReversePrefix::prefix prefix
+ *      \endlink.
+ * @var ReversePrefix::node
+ *      The terminal node of the prefix in the tree storing the redirected
+ *      prefixes or NULL if the prefix comes from an image.
+ * @var ReversePrefix::flatNode
+ *      The index of the terminal node of the prefix in an image.
+ */
+typedef struct ReversePrefix {
+    char const * prefix;
+    size_t length;
+    InitialNode const * node;
+    uint32_t flatNode;
+} ReversePrefix;  ///< Redirected prefix taken from a tree or an image
+
+/** @struct ReverseCandidate
+ * @brief A number reconstructed by @ref phfwdReverseIterNext, which is not
+ *      written down until it is yielded.
+ * @var ReverseCandidate::prefix
+ *      The redirected prefix the number starts with or NULL if the candidate
+ *      is the number passed to the iterator itself.
+ * @var ReverseCandidate::prefixLength
+ *      The length of \link ReverseCandidate::prefix prefix \endlink, 0 if
+ *      there is no prefix.
+ * @var ReverseCandidate::suffixStart
+ *      The index of the first digit of the number passed to the iterator
+ *      which follows the redirected prefix in the candidate.
+ */
+typedef struct ReverseCandidate {
+    char const * prefix;
+    size_t prefixLength;
+    size_t suffixStart;
+} ReverseCandidate;  ///< Lazily reconstructed phone number
+
+/** @struct PendingPrefix
+ * @brief A redirected prefix visited by a @ref ReverseLevel whose subtree
+ *      has not been left yet.
+ * @var PendingPrefix::prefix
+ *      The redirected prefix.
+ * @var PendingPrefix::isPending
+ *      A flag indicating whether the number reconstructed from the prefix
+ *      has not been produced yet.
+ */
+typedef struct PendingPrefix {
+    ReversePrefix prefix;
+    bool isPending;
+} PendingPrefix;  ///< Redirected prefix on the path of the visited one
+
+/** @struct ReverseLevel
+ * @brief A stream of the numbers reconstructed from the prefixes redirected
+ *      to a single prefix of the number, produced in lexicographic order.
+ *      The redirected prefixes are visited in the order of the sorted array,
+ *      which differs from the order of the numbers only for prefixes
+ *      beginning other prefixes. Therefore the number of a prefix waits until
+ *      its subtree is left or a greater number of the subtree is produced.
+ * @var ReverseLevel::nodes
+ *      The sorted array of the redirected nodes of the final prefix, with
+ *      NULL slots, or NULL if the prefixes come from an image.
+ * @var ReverseLevel::flatNodes
+ *      The sorted indices of the redirected nodes of the final prefix in
+ *      an image or NULL if the prefixes come from the trees.
+ * @var ReverseLevel::numSlots
+ *      The number of the slots of the array of the redirected nodes.
+ * @var ReverseLevel::depth
+ *      The length of the prefix of the number after forwarding.
+ * @var ReverseLevel::nextIndex
+ *      The index of the next slot of the array of the redirected nodes
+ *      to be visited.
+ * @var ReverseLevel::chain
+ *      The visited redirected prefixes whose subtrees have not been left,
+ *      each of them beginning the next one.
+ * @var ReverseLevel::chainLength
+ *      The number of the prefixes in \link ReverseLevel::chain chain
+ *      \endlink.
+ * @var ReverseLevel::chainSlots
+ *      The number of the slots allocated for \link ReverseLevel::chain chain
+ *      \endlink and for \link ReverseLevel::waiting waiting \endlink.
+ * @var ReverseLevel::waiting
+ *      The indices of the pending prefixes of \link ReverseLevel::chain
+ *      chain \endlink, together with the index of the slot just left by
+ *      \link ReverseLevel::closing closing \endlink if there is one, kept
+ *      as a binary heap ordered by their numbers.
+ * @var ReverseLevel::numWaiting
+ *      The number of the indices in \link ReverseLevel::waiting waiting
+ *      \endlink.
+ * @var ReverseLevel::path
+ *      The digits of the last prefix of \link ReverseLevel::chain chain
+ *      \endlink, if the prefixes come from the trees. As the prefixes of
+ *      the chain begin one another, they all share these digits, and so do
+ *      \link ReverseLevel::closing closing \endlink and
+ *      \link ReverseLevel::head head \endlink taken from the chain.
+ * @var ReverseLevel::pathSlots
+ *      The number of the bytes allocated for \link ReverseLevel::path path
+ *      \endlink.
+ * @var ReverseLevel::pathNode
+ *      The node whose prefix has been written in \link ReverseLevel::path
+ *      path \endlink the last time or NULL.
+ * @var ReverseLevel::closing
+ *      The prefix whose subtree has just been left, producing its number
+ *      after the smaller waiting numbers of the chain; without a prefix if
+ *      there is none.
+ * @var ReverseLevel::head
+ *      The prefix of the smallest number of the stream which has not been
+ *      taken yet, without a prefix if the stream is exhausted.
+ */
+typedef struct ReverseLevel {
+    InitialNode * const * nodes;
+    uint32_t const * flatNodes;
+    uint64_t numSlots;
+    size_t depth;
+    uint64_t nextIndex;
+    PendingPrefix* chain;
+    size_t chainLength;
+    size_t chainSlots;
+    size_t* waiting;
+    size_t numWaiting;
+    char* path;
+    size_t pathSlots;
+    InitialNode const * pathNode;
+    ReversePrefix closing;
+    ReversePrefix head;
+} ReverseLevel;  ///< Ordered stream of numbers redirected to one prefix
+
+/** @struct PhoneReverseIter
+ * @brief A cursor yielding the results of @ref phfwdReverse
+ *      or @ref phfwdGetReverse one by one, merging the streams of all
+ *      redirected prefixes of the number.
+ * @var PhoneReverseIter::levels
+ *      The streams of the prefixes of the number which are final
+ *      redirections, from the shortest one.
+ * @var PhoneReverseIter::numLevels
+ *      The number of the streams.
+ * @var PhoneReverseIter::levelSlots
+ *      The number of the streams allocated in \link PhoneReverseIter::levels
+ *      levels \endlink, which keep the memory of their chains and paths when
+ *      the iterator is started again.
+ * @var PhoneReverseIter::flat
+ *      The image the numbers are reconstructed from or NULL if they are
+ *      reconstructed from the trees.
+ * @var PhoneReverseIter::changes
+ *      The root of the tree holding the changes made after the image has
+ *      been built, whose numbers are reconstructed as well, or NULL if
+ *      the numbers come from a single source.
+ * @var PhoneReverseIter::isNumPending
+ *      A flag indicating whether the number passed to the iterator is still
+ *      to be yielded.
+ * @var PhoneReverseIter::isGetReverse
+ *      A flag indicating whether the numbers are limited to the results
+ *      of @ref phfwdGetReverse.
+ * @var PhoneReverseIter::isFailed
+ *      A flag indicating a memory allocation failure.
+ * @var PhoneReverseIter::num
+ *      A copy of the number passed to the iterator or, if the iterator is
+ *      used only within a single call, the number itself.
+ * @var PhoneReverseIter::len
+ *      The length of \link PhoneReverseIter::num num \endlink.
+ * @var PhoneReverseIter::buffer
+ *      The most recently yielded number.
+ * @var PhoneReverseIter::bufferLength
+ *      The length of the most recently yielded number, 0 if none has been
+ *      yielded yet.
+ * @var PhoneReverseIter::bufferSlots
+ *      The size of the memory allocated for
+ *      \link PhoneReverseIter::buffer buffer \endlink.
+ */
+struct PhoneReverseIter {
+    ReverseLevel* levels;
+    size_t numLevels;
+    size_t levelSlots;
+    FlatTrie const * flat;
+    InitialNode const * changes;
+    bool isNumPending;
+    bool isGetReverse;
+    bool isFailed;
+    char const * num;
+    size_t len;
+    char* buffer;
+    size_t bufferLength;
+    size_t bufferSlots;
+};
+
+/** @brief Provides the length of a candidate.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in] candidate - a pointer to the candidate.
+ * @return The length of the number represented by the candidate.
+ */
+static size_t candidateLength(PhoneReverseIter const * it,
+                              ReverseCandidate const * candidate) {
+    return candidate->prefixLength + it->len - candidate->suffixStart;
+}
+
+/** @brief Provides a digit of a candidate.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in] candidate - a pointer to the candidate;
+ * @param[in] index - the index of the digit, smaller than the length
+ *                    of the candidate.
+ * @return The character representing the digit.
+ */
+static char candidateDigit(PhoneReverseIter const * it,
+                           ReverseCandidate const * candidate, size_t index) {
+    if (index < candidate->prefixLength) {
+        return candidate->prefix[index];
+    }
+    else {
+        return it->num[candidate->suffixStart + index
+                       - candidate->prefixLength];
+    }
+}
+
+/** @brief Compares two candidates.
+ * Compares the numbers represented by the candidates lexicographically,
+ * the digits ordered by their values, without writing them down. A number
+ * precedes the longer numbers it begins.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in] first - a pointer to the first candidate;
+ * @param[in] second - a pointer to the second candidate;
+ * @param[in] shared - the number of the leading digits known to be equal
+ *                     in both numbers.
+ * @return A negative value if the first number is smaller, a positive value
+ *         if it is greater, zero in case of equal numbers.
+ */
+static int compareCandidates(PhoneReverseIter const * it,
+                             ReverseCandidate const * first,
+                             ReverseCandidate const * second, size_t shared) {
+    size_t firstLength = candidateLength(it, first);
+    size_t secondLength = candidateLength(it, second);
+    size_t commonLength = firstLength < secondLength ? firstLength
+                                                     : secondLength;
+
+    for (size_t i = shared; i < commonLength; i++) {
+        int result = getIndex(candidateDigit(it, first, i))
+                     - getIndex(candidateDigit(it, second, i));
+
+        if (result != 0) {
+            return result;
+        }
+    }
+
+    return (firstLength > secondLength) - (firstLength < secondLength);
+}
+
+/** @brief Checks whether a candidate has just been yielded.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in] candidate - a pointer to the candidate.
+ * @return @p True if the candidate represents the most recently yielded
+ *         number, @p false otherwise.
+ */
+static bool isYielded(PhoneReverseIter const * it,
+                      ReverseCandidate const * candidate) {
+    size_t length = candidateLength(it, candidate);
+
+    if (length != it->bufferLength) {
+        return false;
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        if (candidateDigit(it, candidate, i) != it->buffer[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Builds the candidate of a prefix of a stream.
+ *
+ * @param[in] level - a pointer to the stream;
+ * @param[in] prefix - a pointer to a redirected prefix of the stream.
+ * @return The candidate representing the number reconstructed from
+ *         the prefix.
+ */
+static ReverseCandidate levelCandidate(ReverseLevel const * level,
+                                       ReversePrefix const * prefix) {
+    ReverseCandidate result = {prefix->prefix, prefix->length, level->depth};
+
+    return result;
+}
+
+/** @brief Compares the numbers of two prefixes of the chain of a stream.
+ * The digits of the shorter prefix begin both numbers, as one prefix of
+ * the chain begins the other, so they are not compared.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in] level - a pointer to the stream;
+ * @param[in] first - the index of the first prefix in the chain;
+ * @param[in] second - the index of the second prefix in the chain.
+ * @return The result of @ref compareCandidates for the numbers reconstructed
+ *         from the prefixes.
+ */
+static int compareInLevel(PhoneReverseIter const * it,
+                          ReverseLevel const * level, size_t first,
+                          size_t second) {
+    ReverseCandidate firstCandidate =
+        levelCandidate(level, &(level->chain[first].prefix));
+    ReverseCandidate secondCandidate =
+        levelCandidate(level, &(level->chain[second].prefix));
+    size_t shared = firstCandidate.prefixLength < secondCandidate.prefixLength
+                    ? firstCandidate.prefixLength
+                    : secondCandidate.prefixLength;
+
+    return compareCandidates(it, &firstCandidate, &secondCandidate, shared);
+}
+
+/** @brief Adds a prefix of the chain of a stream to the waiting ones.
+ * Sifts the index up the binary heap of the waiting prefixes, which has
+ * room for it.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in, out] level - a pointer to the stream;
+ * @param[in] index - the index of the prefix in the chain.
+ */
+static void pushWaiting(PhoneReverseIter const * it, ReverseLevel * level,
+                        size_t index) {
+    size_t * heap = level->waiting;
+    size_t position = level->numWaiting++;
+
+    while (position > 0
+           && compareInLevel(it, level, index, heap[(position - 1) / 2]) < 0) {
+        heap[position] = heap[(position - 1) / 2];
+        position = (position - 1) / 2;
+    }
+
+    heap[position] = index;
+}
+
+/** @brief Takes the prefix with the smallest number among the waiting ones.
+ * Removes the root of the binary heap of the waiting prefixes, which is not
+ * empty, and sifts the last index down in its place.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in, out] level - a pointer to the stream.
+ * @return The index of the prefix in the chain.
+ */
+static size_t popWaiting(PhoneReverseIter const * it, ReverseLevel * level) {
+    size_t * heap = level->waiting;
+    size_t smallest = heap[0];
+    size_t last = heap[--level->numWaiting];
+    size_t position = 0;
+
+    while (2 * position + 1 < level->numWaiting) {
+        size_t child = 2 * position + 1;
+
+        if (child + 1 < level->numWaiting
+            && compareInLevel(it, level, heap[child + 1], heap[child]) < 0) {
+            child++;
+        }
+
+        if (compareInLevel(it, level, heap[child], last) >= 0) {
+            break;
+        }
+
+        heap[position] = heap[child];
+        position = child;
+    }
+
+    heap[position] = last;
+
+    return smallest;
+}
+
+/** @brief Checks whether a prefix begins another one.
+ *
+ * @param[in] ancestor - a pointer to a redirected prefix;
+ * @param[in] prefix - a pointer to another redirected prefix.
+ * @return @p True if @p ancestor begins @p prefix, @p false otherwise.
+ */
+static bool isPrefixOf(ReversePrefix const * ancestor,
+                       ReversePrefix const * prefix) {
+    if (prefix->node) {
+        InitialNode const * node = prefix->node;
+
+        while (node->depth > ancestor->length) {
+            node = node->ancestor;
+        }
+
+        return node == ancestor->node;
+    }
+
+    return ancestor->length <= prefix->length
+           && memcmp(ancestor->prefix, prefix->prefix, ancestor->length) == 0;
+}
+
+/** @brief Checks whether a redirection of an image has been changed.
+ *
+ * @param[in] changes - the root of the tree holding the changes made after
+ *                      the image has been built;
+ * @param[in] prefix - the redirected prefix of the image;
+ * @param[in] length - the length of the prefix.
+ * @return @p True if the prefix has been redirected again or removed,
+ *         @p false otherwise.
+ */
+static bool isChangedPrefix(InitialNode const * changes, char const * prefix,
+                            size_t length) {
+    SplitNumber number = {prefix, length, "", length};
+    size_t removedLength;
+    InitialNode const * changed = walkChanges(changes, &number,
+                                              &removedLength);
+
+    return removedLength <= length || (changed && changed->depth == length);
+}
+
+/** @brief Reads the next redirected prefix of a stream.
+ * Skips the NULL slots of the array of the redirected nodes, as well as
+ * the prefixes of an image whose redirections have been changed, and reads
+ * the prefix of the slot the stream is about to visit, without moving past
+ * it. The digits of a prefix from the trees are not written down until
+ * the prefix joins the chain, see @ref pushInLevel.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in, out] level - a pointer to the stream;
+ * @param[out] visited - the prefix to be visited.
+ * @return @p False if all slots have been visited, @p true otherwise.
+ */
+static bool peekInLevel(PhoneReverseIter const * it, ReverseLevel * level,
+                        ReversePrefix * visited) {
+    visited->prefix = NULL;
+
+    if (level->flatNodes) {
+        while (level->nextIndex < level->numSlots) {
+            uint32_t index = level->flatNodes[level->nextIndex];
+            FlatInitialNode const * node = &(it->flat->initial[index]);
+
+            visited->prefix = it->flat->pool + node->prefix;
+            visited->length = node->depth;
+            visited->node = NULL;
+            visited->flatNode = index;
+
+            if (!it->changes
+                || !isChangedPrefix(it->changes, visited->prefix,
+                                    visited->length)) {
+                return true;
+            }
+
+            level->nextIndex++;
+        }
+
+        visited->prefix = NULL;
+
+        return false;
+    }
+
+    while (level->nextIndex < level->numSlots
+           && !level->nodes[level->nextIndex]) {
+        level->nextIndex++;
+    }
+
+    if (level->nextIndex < level->numSlots) {
+        InitialNode const * node = level->nodes[level->nextIndex];
+
+        visited->length = node->depth;
+        visited->node = node;
+        visited->flatNode = FLAT_NONE;
+
+        return true;
+    }
+
+    return false;
+}
+
+/** @brief Adds a visited prefix to the chain of a stream.
+ * Writes down the digits of a prefix from the trees in the path of
+ * the stream, which keeps the digits of the prefixes of the chain beginning
+ * it, and places the prefix at the end of the chain and among the waiting
+ * ones.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in, out] level - a pointer to the stream;
+ * @param[in] visited - the visited prefix, begun by all the prefixes of
+ *                      the chain.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool pushInLevel(PhoneReverseIter const * it, ReverseLevel * level,
+                        ReversePrefix visited) {
+    if (level->chainSlots <= level->chainLength) {
+        size_t newSlots = level->chainSlots * 2 + 1;
+        PendingPrefix * newChain = realloc(level->chain,
+                                           newSlots * sizeof(PendingPrefix));
+
+        if (!newChain) {
+            return false;
+        }
+
+        level->chain = newChain;
+
+        size_t * newWaiting = realloc(level->waiting,
+                                      newSlots * sizeof(size_t));
+
+        if (!newWaiting) {
+            return false;
+        }
+
+        level->waiting = newWaiting;
+        level->chainSlots = newSlots;
+    }
+
+    if (visited.node) {
+        if (level->pathSlots < visited.length) {
+            size_t newSlots = level->pathSlots * 2 > visited.length
+                              ? level->pathSlots * 2 : visited.length;
+            char * newPath = realloc(level->path, newSlots);
+
+            if (!newPath) {
+                return false;
+            }
+
+            // The prefixes of the chain share the moved digits
+            for (size_t i = 0; i < level->chainLength; i++) {
+                level->chain[i].prefix.prefix = newPath;
+            }
+
+            level->path = newPath;
+            level->pathSlots = newSlots;
+        }
+
+        writeInitialPath(visited.node, level->pathNode, level->path);
+        level->pathNode = visited.node;
+        visited.prefix = level->path;
+    }
+
+    level->chain[level->chainLength].prefix = visited;
+    level->chain[level->chainLength].isPending = true;
+    pushWaiting(it, level, level->chainLength++);
+
+    return true;
+}
+
+/** @brief Produces the next number of a stream.
+ * Visits the sorted array of the redirected nodes, keeping the chain of
+ * the prefixes whose subtrees have not been left. When a subtree is left,
+ * the number of its prefix is produced, preceded by the smaller waiting
+ * numbers of the chain, which are taken from a binary heap, so producing
+ * a number takes logarithmic time in the length of the chain.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in, out] level - a pointer to the stream;
+ * @param[out] next - the prefix of the produced number, without a prefix
+ *                    if the stream is exhausted.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool produceInLevel(PhoneReverseIter const * it, ReverseLevel * level,
+                           ReversePrefix * next) {
+    while (true) {
+        if (level->closing.prefix) {
+            // The left slot still holds the closing prefix, which is waiting
+            size_t smallest = popWaiting(it, level);
+
+            if (smallest < level->chainLength) {
+                level->chain[smallest].isPending = false;
+                *next = level->chain[smallest].prefix;
+            }
+            else {
+                *next = level->closing;
+                level->closing.prefix = NULL;
+            }
+
+            return true;
+        }
+
+        ReversePrefix visited;
+        bool isVisited = peekInLevel(it, level, &visited);
+
+        if (level->chainLength > 0) {
+            PendingPrefix * last = &(level->chain[level->chainLength - 1]);
+
+            if (!isVisited || !isPrefixOf(&(last->prefix), &visited)) {
+                if (last->isPending) {
+                    level->closing = last->prefix;
+                }
+
+                level->chainLength--;
+                continue;
+            }
+        }
+
+        if (!isVisited) {
+            next->prefix = NULL;
+
+            return true;
+        }
+
+        if (!pushInLevel(it, level, visited)) {
+            return false;
+        }
+
+        level->nextIndex++;
+    }
+}
+
+/** @brief Checks whether a redirected prefix applies to its number.
+ * Checks whether the redirection of the prefix is the one chosen by
+ * @ref phfwdGet for the number made of the prefix followed by @p suffix.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in] head - a pointer to the redirected prefix;
+ * @param[in] suffix - the validated digits following the prefix;
+ * @param[in] suffixLength - the number of the digits in @p suffix.
+ * @return @p False if a longer prefix of the number is redirected,
+ *         @p true otherwise.
+ */
+static bool isAppliedPrefix(PhoneReverseIter const * it,
+                            ReversePrefix const * head, char const * suffix,
+                            size_t suffixLength) {
+    if (it->changes) {
+        SplitNumber number = {head->prefix, head->length, suffix,
+                              head->length + suffixLength};
+
+        return findChangedRedirection(it->flat, it->changes,
+                                      &number).redirectedLength
+               == head->length;
+    }
+
+    return head->node
+           ? isLongestForwarded(head->node, suffix, suffixLength)
+           : isLongestFlatForwarded(it->flat, head->flatNode, suffix,
+                                    suffixLength);
+}
+
+/** @brief Advances a stream.
+ * Replaces the head of a stream with the next number of the stream,
+ * skipping the numbers which are not results of @ref phfwdGetReverse
+ * if the iterator is limited to them.
+ *
+ * @param[in] it - a pointer to the iterator;
+ * @param[in, out] level - a pointer to the stream.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool advanceLevel(PhoneReverseIter const * it, ReverseLevel * level) {
+    char const * suffix = it->num + level->depth;
+    size_t suffixLength = it->len - level->depth;
+    ReversePrefix * head = &(level->head);
+
+    do {
+        if (!produceInLevel(it, level, head)) {
+            return false;
+        }
+    } while (head->prefix && it->isGetReverse
+             && !isAppliedPrefix(it, head, suffix, suffixLength));
+
+    return true;
+}
+
+/** @brief Opens the stream of a final prefix.
+ * Adds the stream of the numbers redirected to a prefix of the number
+ * passed to the iterator and finds its first number.
+ *
+ * @param[in, out] it - a pointer to the iterator with enough memory for
+ *                      the new stream;
+ * @param[in] nodes - the sorted array of the redirected nodes or NULL;
+ * @param[in] flatNodes - the sorted indices of the redirected nodes in
+ *                        the image or NULL;
+ * @param[in] numSlots - the number of the slots of the array;
+ * @param[in] depth - the length of the final prefix.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool openLevel(PhoneReverseIter * it, InitialNode * const * nodes,
+                      uint32_t const * flatNodes, uint64_t numSlots,
+                      size_t depth) {
+    ReverseLevel * level = &(it->levels[it->numLevels++]);
+
+    level->nodes = nodes;
+    level->flatNodes = flatNodes;
+    level->numSlots = numSlots;
+    level->depth = depth;
+    level->nextIndex = 0;
+    level->chainLength = 0;
+    level->numWaiting = 0;
+    level->pathNode = NULL;
+    level->closing.prefix = NULL;
+
+    return advanceLevel(it, level);
+}
+
+/** @brief Counts the final prefixes of a number.
+ * Walks down the tree storing the final prefixes, or its image, along
+ * the number and opens the streams of the final prefixes met on the way if
+ * the iterator has memory for them. The changes made after the image has
+ * been built are walked as well.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in, out] it - a pointer to the iterator;
+ * @param[in] isOpening - a flag indicating whether the streams are opened.
+ * @return The number of the final prefixes or SIZE_MAX in case of memory
+ *         allocation failure.
+ */
+static size_t walkFinalPrefixes(PhoneForward const * pf, PhoneReverseIter * it,
+                                bool isOpening) {
+    size_t numLevels = 0;
+    bool isSuccessful = true;
+
+    if (it->flat) {
+        FlatTrie const * trie = it->flat;
+        uint32_t current = 0;
+
+        while (current != FLAT_NONE && isSuccessful) {
+            FlatForwardedNode const * node = &(trie->forwarded[current]);
+
+            if (node->isForwarding) {
+                numLevels++;
+                isSuccessful = !isOpening
+                               || openLevel(it, NULL,
+                                            trie->inbound + node->firstInbound,
+                                            node->numInbound, node->depth);
+            }
+
+            current = node->depth < it->len
+                      ? matchFlatForwardedChild(trie, current, it->num,
+                                                it->len)
+                      : FLAT_NONE;
+        }
+    }
+
+    if (!it->flat || it->changes) {
+        ForwardedNode const * current = pf->forwardedRoot;
+
+        while (current && isSuccessful) {
+            if (isForwardSet(current->isForwarding)) {
+                numLevels++;
+                isSuccessful = !isOpening
+                               || openLevel(it, current->forwardedNodes, NULL,
+                                            current->numForwardedNodes,
+                                            current->depth);
+            }
+
+            current = current->depth < it->len
+                      ? matchForwardedChild(current, it->num, it->len)
+                      : NULL;
+        }
+    }
+
+    return isSuccessful ? numLevels : SIZE_MAX;
+}
+
+/** @brief Creates an iterator without a number.
+ * Allocates an iterator, followed by the given number of bytes for a copy
+ * of the number, and marks it as holding no memory.
+ *
+ * @param[in] numSlots - the number of the bytes reserved for the number.
+ * @return A pointer to the iterator or NULL in case of memory allocation
+ *         failure.
+ */
+static PhoneReverseIter * createReverseIter(size_t numSlots) {
+    PhoneReverseIter * it = malloc(sizeof(PhoneReverseIter) + numSlots);
+    if (!it) {
+        return NULL;
+    }
+
+    it->levels = NULL;
+    it->numLevels = 0;
+    it->levelSlots = 0;
+    it->flat = NULL;
+    it->changes = NULL;
+    it->isNumPending = false;
+    it->isGetReverse = false;
+    it->isFailed = false;
+    it->num = "";
+    it->len = 0;
+    it->buffer = NULL;
+    it->bufferLength = 0;
+    it->bufferSlots = 0;
+
+    return it;
+}
+
+/** @brief Starts an iterator.
+ * Makes the iterator yield the numbers reconstructed for the given number
+ * from the beginning, reusing the memory of its streams and of its buffer.
+ * The number has to stay unchanged while the iterator is used.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in, out] it - a pointer to the iterator;
+ * @param[in] num - the validated number;
+ * @param[in] len - the length of the number, 0 if it is not valid;
+ * @param[in] isGetReverse - a flag indicating whether the numbers are limited
+ *                           to the results of @ref phfwdGetReverse.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool startReverseIter(PhoneForward const * pf, PhoneReverseIter * it,
+                             char const * num, size_t len, bool isGetReverse) {
+    it->numLevels = 0;
+    it->flat = pf->flat.header ? &(pf->flat) : NULL;
+    it->changes = pf->isOverlaid ? pf->initialRoot : NULL;
+    it->isNumPending = false;
+    it->isGetReverse = isGetReverse;
+    it->isFailed = false;
+    it->num = len > 0 ? num : "";
+    it->len = len;
+    it->bufferLength = 0;
+
+    if (len == 0) {
+        return true;
+    }
+
+    it->isNumPending = !isGetReverse
+                       || findRedirection(pf, num, len).redirectedLength == 0;
+
+    // The first pass counts the final redirections among the prefixes
+    size_t numLevels = walkFinalPrefixes(pf, it, false);
+
+    if (it->levelSlots < numLevels) {
+        ReverseLevel * newLevels = realloc(it->levels,
+                                           numLevels * sizeof(ReverseLevel));
+        if (!newLevels) {
+            return false;
+        }
+
+        // The new streams have no memory of their own yet
+        memset(newLevels + it->levelSlots, 0,
+               (numLevels - it->levelSlots) * sizeof(ReverseLevel));
+        it->levels = newLevels;
+        it->levelSlots = numLevels;
+    }
+
+    return walkFinalPrefixes(pf, it, true) != SIZE_MAX;
+}
+
+PhoneReverseIter * phfwdReverseIterNew(PhoneForward const *pf, char const *num,
+                                       bool isGetReverse) {
+    if (!pf) {
+        return NULL;
+    }
+
+    size_t len = checkLength(num);
+
+    PhoneReverseIter * it = createReverseIter(len + 1);
+    if (!it) {
+        return NULL;
+    }
+
+    char * copy = (char*) (it + 1);
+    memcpy(copy, len > 0 ? num : "", len + 1);
+
+    if (!startReverseIter(pf, it, copy, len, isGetReverse)) {
+        phfwdReverseIterFree(it);
+
+        return NULL;
+    }
+
+    return it;
+}
+
+/** @brief Writes down a yielded number.
+ * Writes the number represented by the candidate to the buffer of
+ * the iterator, enlarging the buffer if necessary.
+ *
+ * @param[in, out] it - a pointer to the iterator;
+ * @param[in] candidate - a pointer to the candidate.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool writeCandidate(PhoneReverseIter * it,
+                           ReverseCandidate const * candidate) {
+    size_t prefixLength = candidate->prefixLength;
+    size_t length = candidateLength(it, candidate);
+
+    if (it->bufferSlots <= length) {
+        size_t newSlots = it->bufferSlots * 2 > length ? it->bufferSlots * 2
+                                                       : length + 1;
+        char * newBuffer = realloc(it->buffer, newSlots);
+
+        if (!newBuffer) {
+            return false;
+        }
+
+        it->buffer = newBuffer;
+        it->bufferSlots = newSlots;
+    }
+
+    if (prefixLength > 0) {
+        memcpy(it->buffer, candidate->prefix, prefixLength);
+    }
+    memcpy(it->buffer + prefixLength, it->num + candidate->suffixStart,
+           length - prefixLength);
+    it->buffer[length] = '\0';
+    it->bufferLength = length;
+
+    return true;
+}
+
+char const * phfwdReverseIterNext(PhoneReverseIter *it) {
+    if (!it || it->isFailed) {
+        return NULL;
+    }
+
+    while (true) {
+        ReverseCandidate smallest = {NULL, 0, 0};
+        ReverseLevel * smallestLevel = NULL;
+        bool isFound = it->isNumPending;
+
+        for (size_t i = 0; i < it->numLevels; i++) {
+            ReverseLevel * level = &(it->levels[i]);
+            ReverseCandidate head = levelCandidate(level, &(level->head));
+
+            if (level->head.prefix
+                && (!isFound
+                    || compareCandidates(it, &head, &smallest, 0) < 0)) {
+                smallest = head;
+                smallestLevel = level;
+                isFound = true;
+            }
+        }
+
+        if (!isFound) {
+            return NULL;
+        }
+
+        // Equal numbers are adjacent in the order, so only the last one matters
+        bool isNew = !isYielded(it, &smallest);
+
+        // The number is written down before its stream overwrites the path
+        if ((isNew && !writeCandidate(it, &smallest))
+            || (smallestLevel && !advanceLevel(it, smallestLevel))) {
+            it->isFailed = true;
+
+            return NULL;
+        }
+
+        if (!smallestLevel) {
+            it->isNumPending = false;
+        }
+
+        if (isNew) {
+            return it->buffer;
+        }
+    }
+}
+
+void phfwdReverseIterFree(PhoneReverseIter *it) {
+    if (it) {
+        for (size_t i = 0; i < it->levelSlots; i++) {
+            free(it->levels[i].chain);
+            free(it->levels[i].waiting);
+            free(it->levels[i].path);
+        }
+
+        free(it->levels);
+        free(it->buffer);
+        free(it);
+    }
+}
+
+/** @brief Creates phfwdGetReverse or phwfdReverse output.
+ * A helper function which creates the full result of @ref phfwdGetReverse
+ * or @ref phfwdReverse, according to the passed parameter, indicating which
+ * function has called reverseHelper. The numbers are copied from a cursor,
+ * which provides them already sorted and without repetitions.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - a pointer to the string representing a number.
+ * @param[in] isGetReverse - an indicator whether phfwdGetReverse
+ *                           or phfwdReverse calls reverseHelper;
+ * @param[in, out] reused - the structure to be emptied and filled with
+ *                          the result or NULL if a new one is to be created.
+ * @return A pointer to the structure storing the sequence of numbers
+ *         or NULL in case of memory allocation failure.
+ */
+static PhoneNumbers * reverseHelper(PhoneForward const * pf, char const *num,
+                                    bool isGetReverse, PhoneNumbers * reused) {
+    if (reused) {
+        clearNumbers(reused);
+    }
+
+    if (!pf) {
+        return NULL;
+    }
+
+    // The cursor of a reused structure is kept for the next call, and
+    // the number outlives it within this call, so it is not copied
+    PhoneReverseIter * it = reused ? reused->reverseIter : NULL;
+    if (!it) {
+        it = createReverseIter(0);
+        if (!it) {
+            return NULL;
+        }
+
+        if (reused) {
+            reused->reverseIter = it;
+        }
+    }
+
+    PhoneNumbers *result = reused ? reused : createNewPhoneNumbers();
+    if (!result || !startReverseIter(pf, it, num, checkLength(num),
+                                     isGetReverse)) {
+        it->isFailed = true;
+    }
+
+    char const * number;
+    while (!it->isFailed && (number = phfwdReverseIterNext(it))) {
+        if (!appendNumber(result, number, it->bufferLength)) {
+            it->isFailed = true;
+        }
+    }
+
+    // A reused structure stays with the caller, emptied
+    if (it->isFailed) {
+        if (reused) {
+            clearNumbers(reused);
+        }
+        else {
+            phnumDelete(result);
+        }
+
+        result = NULL;
+    }
+
+    if (!reused) {
+        phfwdReverseIterFree(it);
+    }
+
+    return result;
+}
+
+PhoneNumbers * phfwdReverse(PhoneForward const *pf, char const *num) {
+    return reverseHelper(pf, num, false, NULL);
+}
+
+PhoneNumbers * phfwdGetReverse(PhoneForward const *pf, char const *num) {
+    return reverseHelper(pf, num, true, NULL);
+}
+
+PhoneNumbers * phfwdReverseReuse(PhoneForward const *pf, char const *num,
+                                 bool isGetReverse, PhoneNumbers *pnum) {
+    return reverseHelper(pf, num, isGetReverse, pnum);
+}
+
+/** @brief Lists the nodes of a tree in breadth-first order.
+ * Lists the nodes of the tree storing the redirected prefixes in the order of
+ * their indices in an image, the children of every node in the order of
+ * the packed array of the children.
+ *
+ * @param[in] root - the root of the tree;
+ * @param[out] numNodes - the number of the nodes of the tree.
+ * @return The array of the nodes, which needs to be freed, or NULL in case of
+ *         memory allocation failure.
+ */
+static InitialNode const ** orderInitialNodes(InitialNode const * root,
+                                              size_t * numNodes) {
+    size_t slots = 16;
+    size_t length = 0;
+    InitialNode const ** order = malloc(slots * sizeof(InitialNode*));
+    if (!order) {
+        return NULL;
+    }
+
+    order[length++] = root;
+
+    for (size_t i = 0; i < length; i++) {
+        InitialNode const * node = order[i];
+        uint32_t numChildren = countChildren(node->childMask);
+
+        if (slots < length + numChildren) {
+            size_t newSlots = slots * 2 + numChildren;
+            InitialNode const ** newOrder = realloc(order, newSlots
+                                                    * sizeof(InitialNode*));
+
+            if (!newOrder) {
+                free(order);
+
+                return NULL;
+            }
+
+            order = newOrder;
+            slots = newSlots;
+        }
+
+        for (uint32_t j = 0; j < numChildren; j++) {
+            order[length++] = node->children[j];
+        }
+    }
+
+    *numNodes = length;
+
+    return order;
+}
+
+/** @brief Lists the nodes of a tree in breadth-first order.
+ * Lists the nodes of the tree storing the final prefixes in the order of
+ * their indices in an image, the children of every node in the order of
+ * the packed array of the children.
+ *
+ * @param[in] root - the root of the tree;
+ * @param[out] numNodes - the number of the nodes of the tree.
+ * @return The array of the nodes, which needs to be freed, or NULL in case of
+ *         memory allocation failure.
+ */
+static ForwardedNode const ** orderForwardedNodes(ForwardedNode const * root,
+                                                  size_t * numNodes) {
+    size_t slots = 16;
+    size_t length = 0;
+    ForwardedNode const ** order = malloc(slots * sizeof(ForwardedNode*));
+    if (!order) {
+        return NULL;
+    }
+
+    order[length++] = root;
+
+    for (size_t i = 0; i < length; i++) {
+        ForwardedNode const * node = order[i];
+        uint32_t numChildren = countChildren(node->childMask);
+
+        if (slots < length + numChildren) {
+            size_t newSlots = slots * 2 + numChildren;
+            ForwardedNode const ** newOrder = realloc(order, newSlots
+                                                      * sizeof(ForwardedNode*));
+
+            if (!newOrder) {
+                free(order);
+
+                return NULL;
+            }
+
+            order = newOrder;
+            slots = newSlots;
+        }
+
+        for (uint32_t j = 0; j < numChildren; j++) {
+            order[length++] = node->children[j];
+        }
+    }
+
+    *numNodes = length;
+
+    return order;
+}
+
+/** @brief Fills the nodes of an image storing the redirected prefixes.
+ * Copies the nodes in breadth-first order, numbering the children of every
+ * node consecutively. The nearest terminal node of a redirected prefix is
+ * handed down from a node to its children, which replace it with themselves
+ * if they are terminal nodes. The redirected prefixes are appended to
+ * the prefixes of the image.
+ *
+ * @param[in] order - the nodes in breadth-first order;
+ * @param[in] numNodes - the number of the nodes;
+ * @param[out] initial - the nodes of the image;
+ * @param[out] pool - the prefixes of the image;
+ * @param[in, out] poolLength - the number of the bytes of the prefixes
+ *                              already used.
+ */
+static void fillFlatInitial(InitialNode const ** order, size_t numNodes,
+                            FlatInitialNode * initial, char * pool,
+                            uint64_t * poolLength) {
+    uint32_t nextChild = 1;
+    initial[0].nearestForwarded = FLAT_NONE;
+
+    for (uint32_t i = 0; i < numNodes; i++) {
+        InitialNode const * node = order[i];
+        FlatInitialNode * flat = &(initial[i]);
+        uint32_t numChildren = countChildren(node->childMask);
+
+        flat->label = node->label;
+        flat->labelLength = node->labelLength;
+        flat->childMask = node->childMask;
+        flat->depth = (uint32_t) node->depth;
+        flat->firstChild = nextChild;
+        flat->target = FLAT_NONE;
+        flat->prefix = FLAT_NONE;
+
+        if (isForwardSet(node->isForwarded)) {
+            flat->isForwarded = 1;
+            flat->nearestForwarded = i;
+            flat->prefix = (uint32_t) *poolLength;
+            writeInitialPath(node, NULL, pool + *poolLength);
+            pool[*poolLength + node->depth] = '\0';
+            *poolLength += node->depth + 1;
+        }
+
+        for (uint32_t j = 0; j < numChildren; j++) {
+            initial[nextChild + j].nearestForwarded = flat->nearestForwarded;
         }
 
-        InitialNode *currentInitial = currentInitialCore;
-        InitialNode *coreAncestor = currentInitialCore->ancestor;
-        InitialNode *currentAncestor;
+        nextChild += numChildren;
+    }
+}
 
-        while (currentInitial != coreAncestor) {
-            if (isForwardSet(currentInitial->isForwarded)) {
-                removeForwardedNodeFromInitialAndRemoveInitialFromForward(
-                        currentInitial);
-            }
+/** @brief Fills the nodes of an image storing the final prefixes.
+ * Copies the nodes in breadth-first order, numbering the children of every
+ * node consecutively, and reserves the places of their redirected nodes.
+ * The final prefixes are appended to the prefixes of the image.
+ *
+ * @param[in] order - the nodes in breadth-first order;
+ * @param[in] numNodes - the number of the nodes;
+ * @param[out] forwarded - the nodes of the image;
+ * @param[out] pool - the prefixes of the image;
+ * @param[in, out] poolLength - the number of the bytes of the prefixes
+ *                              already used.
+ */
+static void fillFlatForwarded(ForwardedNode const ** order, size_t numNodes,
+                              FlatForwardedNode * forwarded, char * pool,
+                              uint64_t * poolLength) {
+    uint32_t nextChild = 1;
+    uint32_t nextInbound = 0;
+
+    for (uint32_t i = 0; i < numNodes; i++) {
+        ForwardedNode const * node = order[i];
+        FlatForwardedNode * flat = &(forwarded[i]);
+
+        flat->label = node->label;
+        flat->labelLength = node->labelLength;
+        flat->childMask = node->childMask;
+        flat->depth = (uint32_t) node->depth;
+        flat->firstChild = nextChild;
+        flat->firstInbound = nextInbound;
+        flat->prefix = FLAT_NONE;
+
+        if (isForwardSet(node->isForwarding)) {
+            flat->isForwarding = 1;
+            flat->numInbound = (uint32_t) node->sumForwarded;
+            flat->prefix = (uint32_t) *poolLength;
+            writeForwardedPath(node, pool + *poolLength);
+            pool[*poolLength + node->depth] = '\0';
+            *poolLength += node->depth + 1;
+            nextInbound += flat->numInbound;
+        }
 
-            if (currentInitial->filledEdges == 0) {
-                currentAncestor = currentInitial->ancestor;
-                removeInitialNode(currentInitial);
-                currentInitial = currentAncestor;
-            } else {
-                uint32_t *index = &(currentInitial->lastChecked);
+        nextChild += countChildren(node->childMask);
+    }
+}
 
-                while (!currentInitial->alphabet[*index]) {
-                    (*index)++;
-                }
+/** @brief Builds the image of a structure.
+ * Builds a position-independent image of the trees of @p pf: the nodes of
+ * both trees numbered in breadth-first order, the indices of the redirected
+ * nodes of every final prefix in the order of the prefixes and the prefixes
+ * themselves. The nodes refer to each other by 32-bit indices, the prefixes
+ * by offsets, so the image does not depend on the address it is placed at.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[out] length - the size of the image in bytes.
+ * @return The image, which needs to be freed, or NULL in case of memory
+ *         allocation failure or if the trees are too large for 32-bit
+ *         indices.
+ */
+static void * buildFlatImage(PhoneForward const * pf, size_t * length) {
+    size_t numInitial = 0;
+    size_t numForwarded = 0;
+    InitialNode const ** initialOrder = orderInitialNodes(pf->initialRoot,
+                                                          &numInitial);
+    ForwardedNode const ** forwardedOrder = orderForwardedNodes(
+            pf->forwardedRoot, &numForwarded);
+
+    if (!initialOrder || !forwardedOrder) {
+        free(initialOrder);
+        free(forwardedOrder);
 
-                currentInitial = currentInitial->alphabet[*index];
-            }
+        return NULL;
+    }
+
+    uint64_t poolLength = 0;
+    uint64_t numInbound = 0;
+    uint64_t maxDepth = 0;
+    for (size_t i = 0; i < numInitial; i++) {
+        if (isForwardSet(initialOrder[i]->isForwarded)) {
+            poolLength += initialOrder[i]->depth + 1;
         }
 
-        removeStumpsInitialNode(currentInitial);
+        if (maxDepth < initialOrder[i]->depth) {
+            maxDepth = initialOrder[i]->depth;
+        }
     }
-}
 
-void phfwdDelete(PhoneForward * pf) {
-    if (pf) {
-        InitialNode * currentInitial = pf->initialRoot;
-        InitialNode * currentInitAncestor;
-
-        // NULL is an ancestor
-        while (currentInitial) {
-            if (currentInitial->filledEdges == 0) {
-                currentInitAncestor = currentInitial->ancestor;
-                removeInitialNode(currentInitial);
-                currentInitial = currentInitAncestor;
-            }
-            else {
-                uint32_t * index = &(currentInitial->lastChecked);
+    for (size_t i = 0; i < numForwarded; i++) {
+        if (isForwardSet(forwardedOrder[i]->isForwarding)) {
+            poolLength += forwardedOrder[i]->depth + 1;
+            numInbound += forwardedOrder[i]->sumForwarded;
+        }
+    }
 
-                while (!currentInitial->alphabet[*index]) {
-                    (*index)++;
-                }
+    char * image = NULL;
+    FlatTrieHeader header;
+    char * path = malloc(maxDepth + 1);
+
+    // Every index and offset has to differ from FLAT_NONE
+    if (path && numInitial < FLAT_NONE && numForwarded < FLAT_NONE
+        && numInbound < FLAT_NONE && poolLength < FLAT_NONE) {
+        *length = flatTrieLayout(&header, (uint32_t) numInitial,
+                                 (uint32_t) numForwarded,
+                                 (uint32_t) numInbound, poolLength);
+        // The length is a multiple of the alignment
+        image = aligned_alloc(FLAT_TRIE_ALIGNMENT, *length);
+    }
 
-                currentInitial = currentInitial->alphabet[*index];
+    if (image) {
+        memset(image, 0, *length);
+        memcpy(image, &header, sizeof(FlatTrieHeader));
+
+        FlatInitialNode * initial = (FlatInitialNode*) (image
+                                                        + header.initialOffset);
+        FlatForwardedNode * forwarded = (FlatForwardedNode*) (
+                image + header.forwardedOffset);
+        uint32_t * inbound = (uint32_t*) (image + header.inboundOffset);
+        char * pool = image + header.poolOffset;
+        uint64_t poolUsed = 0;
+
+        fillFlatInitial(initialOrder, numInitial, initial, pool, &poolUsed);
+        fillFlatForwarded(forwardedOrder, numForwarded, forwarded, pool,
+                          &poolUsed);
+
+        FlatTrie trie;
+        InitialNode const * written = NULL;
+        flatTrieOpen(&trie, image, *length);
+
+        // The redirected nodes are found by their prefixes in the image
+        for (uint32_t i = 0; i < numForwarded; i++) {
+            ForwardedNode const * node = forwardedOrder[i];
+            uint32_t * nextInbound = inbound + forwarded[i].firstInbound;
+
+            if (!forwarded[i].isForwarding) {
+                continue;
             }
-        }
 
-        ForwardedNode * currentForward = pf->forwardedRoot;
-        ForwardedNode * currentForwardAncestor;
+            for (uint64_t j = 0; j < node->numForwardedNodes; j++) {
+                InitialNode const * redirected = node->forwardedNodes[j];
 
-        while (currentForward) {
-            if (currentForward->filledEdges == 0) {
-                currentForwardAncestor = currentForward->ancestor;
-                removeForwardedNode(currentForward);
-                currentForward = currentForwardAncestor;
-            }
-            else {
-                uint32_t *index = &(currentForward->lastChecked);
+                if (redirected) {
+                    writeInitialPath(redirected, written, path);
+                    written = redirected;
 
-                while(!currentForward->alphabet[*index]) {
-                    (*index)++;
-                }
+                    uint32_t index = descendFlatInitial(&trie, 0, path,
+                                                        redirected->depth);
 
-                currentForward = currentForward->alphabet[*index];
+                    initial[index].target = i;
+                    *(nextInbound++) = index;
+                }
             }
         }
-
-        free(pf);
     }
+
+    free(path);
+    free(initialOrder);
+    free(forwardedOrder);
+
+    return image;
 }
 
-/** @brief Creates and initializes a structure.
- * Creates and initializes a PhoneNumbers structure. The resulting structure
- * has allocated memory with an empty slot.
+/** @brief Merges a snapshot with its changes.
+ * Creates a structure with the redirections of the image of a snapshot
+ * and applies the changes the snapshot has replayed on top of the image.
  *
- * @return A pointer to initialized @p PhoneNumbers structure.
+ * @param[in] pf - a pointer to a snapshot whose trees hold changes.
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
  */
-static PhoneNumbers * createNewPhoneNumbers() {
-    PhoneNumbers * result = malloc(sizeof (PhoneNumbers));
-    if (!result) {
-        return NULL;
+static PhoneForward * mergeSnapshot(PhoneForward const * pf) {
+    FlatTrie const * trie = &(pf->flat);
+    uint32_t numInitial = trie->header->numInitial;
+    PhoneForwardRule * rules = malloc(numInitial * sizeof(PhoneForwardRule));
+    PhoneForward * result = rules ? phfwdNew() : NULL;
+    size_t numRules = 0;
+
+    for (uint32_t i = 0; i < numInitial && result; i++) {
+        FlatInitialNode const * node = &(trie->initial[i]);
+
+        if (node->isForwarded) {
+            rules[numRules].num1 = trie->pool + node->prefix;
+            rules[numRules].num2 = trie->pool
+                                   + trie->forwarded[node->target].prefix;
+            numRules++;
+        }
     }
-    
-    result->numbers = malloc(sizeof (char*));
-    if (!result->numbers) {
-        free(result);
 
-        return NULL;
+    if (result && (!phfwdAddBulk(result, rules, numRules)
+                   || !phfwdTransactionCommit(result, pf->changes))) {
+        phfwdDelete(result);
+        result = NULL;
     }
 
-    // The reallocation should occur analogously to adding nodes
-    result->numbers[0] = NULL;
-    result->slots = 1;
-    result->lastAvailableIndex = 1;
-    
+    free(rules);
+
     return result;
 }
 
-void phnumDelete(PhoneNumbers *pnum) {
-    if (pnum) {
-        for (uint64_t i = 0; i < pnum->lastAvailableIndex; i++) {
-            free(pnum->numbers[i]);
-        }
-
-        free(pnum->numbers);
-        free(pnum);
+bool phfwdSave(PhoneForward const *pf, char const *path) {
+    if (!pf || !path) {
+        return false;
     }
-}
 
-PhoneNumbers * phfwdGet(PhoneForward const *pf, char const* num) {
-    if (!pf) {
-        return NULL;
+    void * builtImage = NULL;
+    void const * image = pf->flat.header;
+    size_t length = 0;
+
+    if (image && !pf->isOverlaid) {
+        length = (size_t) pf->flat.header->totalLength;
     }
+    else {
+        // The image of a snapshot with changes is outdated by them
+        PhoneForward * merged = pf->isOverlaid ? mergeSnapshot(pf) : NULL;
+        PhoneForward const * source = pf->isOverlaid ? merged : pf;
 
-    size_t len = checkLength(num);
-    PhoneNumbers * result = createNewPhoneNumbers();
+        builtImage = source ? buildFlatImage(source, &length) : NULL;
+        phfwdDelete(merged);
 
-    if (!result) {
-        return NULL;
+        if (!builtImage) {
+            return false;
+        }
+
+        image = builtImage;
     }
 
-    if (len == 0) {
-        return result;
+    // The image is complete on the disk before it replaces the old one,
+    // which may still be mapped
+    size_t pathLength = strlen(path);
+    char * temporaryPath = malloc(pathLength + sizeof(TEMPORARY_SUFFIX));
+    FILE * file = NULL;
+
+    if (temporaryPath) {
+        memcpy(temporaryPath, path, pathLength);
+        memcpy(temporaryPath + pathLength, TEMPORARY_SUFFIX,
+               sizeof(TEMPORARY_SUFFIX));
+        file = fopen(temporaryPath, "wb");
     }
 
-    InitialNode * lastForwardedNode = NULL;
-    InitialNode * currentInitial = pf->initialRoot;
-    bool isPossibleToPass = true;
-    size_t depth = 0;
-    uint32_t digit;
+    bool isSaved = file && fwrite(image, 1, length, file) == length
+                   && fflush(file) == 0 && fsync(fileno(file)) == 0;
 
-    while (depth < len && isPossibleToPass && currentInitial) {
-        digit = getIndex(num[depth]);
-        if (isForwardSet(currentInitial->isForwarded)) {
-            lastForwardedNode = currentInitial;
-        }
+    if (file && fclose(file) != 0) {
+        isSaved = false;
+    }
 
-        if (currentInitial->alphabet[digit]) {
-            currentInitial = currentInitial->alphabet[digit];
-            depth++;
-        }
-        else {
-            isPossibleToPass = false;
-        }
+    if (isSaved && rename(temporaryPath, path) != 0) {
+        isSaved = false;
     }
 
-    //Check the last one
-    if (isForwardSet(currentInitial->isForwarded)) {
-        lastForwardedNode = currentInitial;
+    if (file && !isSaved) {
+        remove(temporaryPath);
     }
 
-    if (!lastForwardedNode) {
-        result->numbers[0] = strdup(num);
-        if (!result->numbers[0]) {
-            free(result->numbers);
-            free(result);
+    free(temporaryPath);
+    free(builtImage);
 
-            return NULL;
-        }
+    return isSaved;
+}
 
-        return result;
-    }
+/** @brief Opens a shared image.
+ *
+ * @param[out] flat - a pointer to the view of the image;
+ * @param[in] shared - a pointer to the image built by @ref buildFlatImage.
+ */
+static void openImage(FlatTrie * flat, SharedImage const * shared) {
+    flatTrieOpen(flat, shared->image, imageLength(shared));
+}
 
-    ForwardedNode * forwardedPrefixNode = lastForwardedNode->forwardingNode;
-    char* finalPrefix = forwardedPrefixNode->forwardedPrefix;
+bool phfwdCompile(PhoneForward *pf) {
+    if (!pf) {
+        return false;
+    }
 
-    size_t finalPrefixLength = forwardedPrefixNode->depth;
-    size_t nonForwardedPrefixLength = lastForwardedNode->depth;
-    size_t finalSuffixLength = len - nonForwardedPrefixLength;
-    size_t finalLength = finalSuffixLength + finalPrefixLength + 1;
+    // A mapped image or a compiled one is already used by the lookups
+    if (pf->flat.header) {
+        return true;
+    }
 
-    char* resultingForward = malloc(finalLength);
-    if (!resultingForward) {
-        phnumDelete(result);
+    // A failed modification has left the kept image up to date
+    if (pf->compiled && !pf->changes) {
+        openImage(&(pf->flat), pf->compiled);
 
-        return NULL;
+        return true;
     }
 
-    memmove(resultingForward, finalPrefix, finalPrefixLength);
-    memmove(resultingForward + finalPrefixLength,
-            num + nonForwardedPrefixLength, finalSuffixLength);
-    resultingForward[finalLength - 1] = '\0';
+    dropImage(pf);
 
-    result->numbers[0] = resultingForward;
+    size_t length = 0;
+    void * image = buildFlatImage(pf, &length);
+    SharedImage * shared = image ? malloc(sizeof(SharedImage)) : NULL;
 
-    return result;
-}
+    if (!shared || !flatTrieOpen(&(pf->flat), image, length)) {
+        free(image);
+        free(shared);
 
-char const * phnumGet(PhoneNumbers const *pnum, size_t idx) {
-    if (!pnum || idx >= pnum->lastAvailableIndex) {
-        return NULL;
-    }
-    else {
-        return (char const*)pnum->numbers[idx];
+        return false;
     }
+
+    shared->image = image;
+    atomic_init(&(shared->references), 1);
+    pf->compiled = shared;
+
+    return true;
 }
 
-/** @brief Customized strcmp.
- * Customized version of strcmp string comparing function, which is extended
- * with additional alphabet numbers and their values
+/** @brief Copies a transaction.
  *
- * @param[in] first - the first char array to compare.
- * @param[in] second - the second char array to compare
- * @return The result of lexicographic comparison equivalent to the result
- * of standard strcmp(...): if the first string is smaller lexicographically
- * it returns negative value; if the first string is greater - it returns
- * positive value; zero in case of equal strings.
+ * @param[in] tx - a pointer to a transaction with staged operations.
+ * @return A pointer to the copy or NULL in case of memory allocation failure.
  */
-static int customStrcmp(const char* first, const char* second) {
-    size_t index = 0;
-    int result = 0;
-    while (first[index] != '\0' && second[index] != '\0' && result == 0) {
-        result = getIndex(first[index]) - getIndex(second[index]);
-        index++;
+static PhoneForwardTransaction * copyTransaction(
+        PhoneForwardTransaction const * tx) {
+    PhoneForwardTransaction * copy = phfwdTransactionNew();
+    if (!copy) {
+        return NULL;
     }
 
-    /*
-     * Evaluation of the terminating conditions of the loop. In one iteration,
-     * the result might have been changed to negative or positive value,
-     * but the loop stopped after entering sufficient length condition
-     * in the next iteration.
-     */
-    if (result == 0) {
-        /*
-         * Both sequences have been equal up to the point one of them ended.
-         * The first one is shorter, therefore - smaller lexicographically.
-         */
-        if (first[index] == '\0' && second[index] != '\0') {
-            return -1;
-        }
-        /*
-         * Both sequences have been equal up to the point one of them ended.
-         * The first one is longer, therefore - greater lexicographically.
-         */
-        else if (first[index] != '\0' && second[index] == '\0') {
-            return 1;
-        }
-        /*
-         * Both sequences have equal length.
-         */
-        else {
-            return result;
-        }
-    }
-    else {
-        return result;
+    copy->operations = malloc(tx->numOperations
+                              * sizeof(TransactionOperation));
+    copy->text = malloc(tx->textLength);
+
+    if (!copy->operations || !copy->text) {
+        phfwdTransactionDelete(copy);
+
+        return NULL;
     }
+
+    memcpy(copy->operations, tx->operations,
+           tx->numOperations * sizeof(TransactionOperation));
+    memcpy(copy->text, tx->text, tx->textLength);
+    copy->numOperations = tx->numOperations;
+    copy->slots = tx->numOperations;
+    copy->numAdditions = tx->numAdditions;
+    copy->textLength = tx->textLength;
+    copy->textSlots = tx->textLength;
+
+    return copy;
 }
 
-/** @brief Customized comparator.
- * Customized comparator for string comparison, used in qsort(...).
- * Part of the function description covers qsort documentation.
+/** @brief Marks a removal in a snapshot.
+ * Removes the redirections of the prefixes starting with @p num from
+ * the trees of a snapshot and marks the node of the prefix, which hides
+ * the redirections of the image starting with it.
  *
- * @param[in] p1 - the first char array to compare.
- * @param[in] p2 - the second char array to compare.
- * @return An integer less than, equal to or greater than zero
- * if the first argument is considered to be respectively less than,
- * equal to or greater than the second.
+ * @param[in, out] pf - a pointer to the snapshot, not read-only yet;
+ * @param[in] num - the validated prefix;
+ * @param[in] len - the length of the prefix.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
  */
-static int comparatorStrings(const void *p1, const void *p2) {
-    return customStrcmp(* (char * const *) p1, * (char* const *) p2);
+static bool markRemoval(PhoneForward * pf, char const * num, size_t len) {
+    InitialNode * marked;
+
+    removeRedirections(pf, num, len);
+
+    if (!extendInitialPath(pf, pf->initialRoot, num, len, &marked)) {
+        removeStumpsInitialNode(&(pf->initialPool), marked);
+
+        return false;
+    }
+
+    setBitRemoved(&(marked->isForwarded));
+
+    return true;
 }
 
-/** @brief Customized qsort.
- * Customized version of qsort for sorting char arrays, using previusly defined
- * helper function for handling string comparison.
+/** @brief Replays changes in a snapshot.
+ * Makes the changes in the trees of a snapshot in their order, adding
+ * the redirections and marking the removals.
  *
- * @param[in] array - A char array to be sorted.
- * @param[in] numMembersToCompare - The number of members in the array
- * to be compared.
+ * @param[in, out] pf - a pointer to the snapshot, not read-only yet;
+ * @param[in] changes - a pointer to the changes.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
  */
-static void sortCharArray(char** array, size_t numMembersToCompare) {
-    qsort(array, numMembersToCompare, sizeof(char *), comparatorStrings);
+static bool replayChanges(PhoneForward * pf,
+                          PhoneForwardTransaction const * changes) {
+    bool isReplayed = true;
+
+    for (size_t i = 0; i < changes->numOperations && isReplayed; i++) {
+        TransactionOperation const * operation = &(changes->operations[i]);
+        char const * num1 = changes->text + operation->offset1;
+
+        isReplayed = operation->len2 > 0
+                     ? phfwdAdd(pf, num1, changes->text + operation->offset2)
+                     : markRemoval(pf, num1, operation->len1);
+    }
+
+    return isReplayed;
 }
 
-/** @brief Checks equality of phfwdGet input.
- * Checks whether the given @p reverseInput could have resulted from
- * @ref phfwdGet called with @p reconstructionResult.
- *
- * @param[in] reconstructionResult - a reconstructed original phone number.
- * @param[in] intendedOutput - an intended output from @ref phfwdGet called with
- *                             reconstructionResult.
- * @param[in] pf - a pointer to the structure storing number redirections.
- *
- * @return @p False in case of memory allocation failure or @p intendedOutput
- * not being equal with @ref phfwdGet called with @p reconstructionResult,
- * @p true otherwise.
- */
-static bool isResultingFromGet(const char * reconstructionResult,
-                             const char * intendedOutput,
-                             PhoneForward const * pf){
-    PhoneNumbers * getResult = phfwdGet(pf, reconstructionResult);
-    char const * resultGetNumber = phnumGet(getResult, 0);
-    bool isFromGet = true;
+PhoneForward * phfwdSnapshot(PhoneForward *pf) {
+    // A mapped file is not shared, it stays with its structure
+    if (!pf || pf->mapping) {
+        return NULL;
+    }
 
-    if (!resultGetNumber || customStrcmp(resultGetNumber,
-                                        intendedOutput) != 0) {
+    size_t numChanges = pf->changes ? pf->changes->numOperations : 0;
 
-        isFromGet = false;
+    /*
+     * Replaying the changes on top of the kept image pays off only until
+     * the changes replayed by the snapshots add up to a compilation.
+     */
+    if (!pf->isReadOnly && pf->compiled
+        && (pf->replayedChanges + numChanges) * REPLAY_COST
+           > imageNodes(pf->compiled)) {
+        dropImage(pf);
+        numChanges = 0;
     }
 
-    phnumDelete(getResult);
+    if (!pf->compiled && !phfwdCompile(pf)) {
+        return NULL;
+    }
 
-    return isFromGet;
-}
+    PhoneForward * result = phfwdNew();
+    if (!result) {
+        return NULL;
+    }
 
-/** @brief Adding new number to PhoneNumbers.
- * Adds the number to the set of numbers reconstructed in
- * @ref recreateOriginalPhoneNumbers. Reallocates memory of the result structure
- * if necessary. The pointer to the recreated phone number is assigned to
- * the array and owned by the structure to avoid double frees and memory leaks;
- * the pointer needs to be freed by @ref phnumDelete.
- *
- * @param[in, out] reversed - the structure storing reconstructing numbers.
- * @param[in] pointerToBeOwned - the pointer to the reconstructed phone number.
- * @return @p False in case of memory allocation failure, @p true otherwise.
- */
-static bool addReversedNumber(PhoneNumbers* reversed, char* pointerToBeOwned) {
-    uint64_t * slots = &(reversed->slots);
-    uint64_t * lastIndex = &(reversed->lastAvailableIndex);
+    // The changes are kept for the snapshots of the snapshot
+    if (numChanges > 0) {
+        result->changes = copyTransaction(pf->changes);
 
-    if (*slots <= * lastIndex) {
-        uint64_t newSlots = (*slots)*2 + 1;
-        char** newNumbers = realloc(reversed->numbers,
-                                    newSlots * sizeof(char*));
+        if (!result->changes || !replayChanges(result, pf->changes)) {
+            phfwdDelete(result);
 
-        if (!newNumbers) {
-            return false;
+            return NULL;
         }
 
-        reversed->numbers = newNumbers;
-        *slots = newSlots;
+        result->isOverlaid = true;
+
+        if (!pf->isReadOnly) {
+            pf->replayedChanges += numChanges;
+        }
     }
 
-    reversed->numbers[(*lastIndex)++] = pointerToBeOwned;
+    atomic_fetch_add(&(pf->compiled->references), 1);
+    pf->isShared = true;
+    result->compiled = pf->compiled;
+    openImage(&(result->flat), result->compiled);
+    result->isReadOnly = true;
 
-    return true;
+    return result;
 }
 
-/** @brief Removes duplicated numbers.
- * Removes duplicates from the array of the sorted phone numbers,
- * recreated in @ref recreateOriginalPhoneNumbers.
- *
- * @param[in, out] sorted - the sorted char** array of the reconstructed numbers.
- */
-static void removeDuplicateNumbersAfterQsort(PhoneNumbers* sorted) {
-    if (sorted->lastAvailableIndex > 0) {
-        uint64_t left = 0;
-        uint64_t right = 1;
-        uint64_t notNullElementsInTheArray = sorted->lastAvailableIndex;
-
-        while (left < (sorted->lastAvailableIndex - 1)
-               && right < sorted->lastAvailableIndex) {
-                    while (right < sorted->lastAvailableIndex
-                            && customStrcmp(sorted->numbers[left],
-                                            sorted->numbers[right]) == 0) {
-                                 free(sorted->numbers[right]);
-                                 sorted->numbers[right] = NULL;
-
-                                 right++;
-                                 notNullElementsInTheArray--;
-                    }
-
-                    /*
-                     * If (right == (sorted->lastAvailableIndex - 1)),
-                     * the element at the index `left` and the element
-                     * at the last occupied index, stored in `right`,
-                     * are different as the result of the terminating condition
-                     * of the previous loop.
-                     *
-                     * If (right > (sorted->lastAvailableIndex - 1)),
-                     * the elements from the index (left + 1) to the end of
-                     * the array inclusively are NULL and there are not
-                     * any elements left to check.
-                     *
-                     * Terminating conditions of the loops enable leaving
-                     * the final termination for the outermost loop,
-                     * however the next loop for passing NULL would be executed
-                     * without need and would cost unnecessary time.
-                     */
-                    if (right >= (sorted->lastAvailableIndex - 1)) {
-                        break;
-                    }
-
-                    /*
-                     * After the increment, `right` value is at most
-                     * (sorted->lastAvailableIndex - 1), leaving at most
-                     * (sorted->lastAvailableIndex - 2)th index free for `left`,
-                     * but with not freed content
-                     * at (sorted->lastAvailableIndex - 2)th index
-                     */
-                    right++;
-
-                    while (!sorted->numbers[left + 1]) {
-                        left++;
-                    }
-
-                    /*
-                     * sorted[left] may be null; left is smaller tha right
-                     * after the increment.
-                     */
-                    left++;
-        }
-
-        left = 0;
-        right = 1;
-        /*
-         * Inner terminating condition (left + 1) ensures that `left` value
-         * is always smaller than `right` value.
-         *
-         * Swapping null values
-         */
-        while (right < sorted->lastAvailableIndex) {
-             while (right < sorted->lastAvailableIndex
-                    && !sorted->numbers[right]) {
-                        right++;
-             }
+PhoneForward * phfwdLoadMapped(char const *path) {
+    if (!path) {
+        return NULL;
+    }
 
-             if (right == sorted->lastAvailableIndex) {
-                 break;
-             }
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return NULL;
+    }
 
-             while ((left + 1) < right && sorted->numbers[left]) {
-                 left++;
-             }
+    struct stat status;
+    void * mapping = MAP_FAILED;
+    size_t length = 0;
 
-             if (!sorted->numbers[left] && sorted->numbers[right]) {
-                 sorted->numbers[left] = sorted->numbers[right];
-                 sorted->numbers[right] = NULL;
-             }
+    if (fstat(descriptor, &status) == 0 && status.st_size > 0) {
+        length = (size_t) status.st_size;
+        mapping = mmap(NULL, length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+    }
 
-             left++;
-             right++;
-        }
+    // The mapping stays valid after the file is closed
+    close(descriptor);
 
-        sorted->lastAvailableIndex = notNullElementsInTheArray;
+    if (mapping == MAP_FAILED) {
+        return NULL;
+    }
+
+    PhoneForward * result = phfwdNew();
+    // The file may have been damaged, so no node is trusted
+    if (!result || !flatTrieOpen(&(result->flat), mapping, length)
+        || !flatTrieVerify(&(result->flat))) {
+        phfwdDelete(result);
+        munmap(mapping, length);
+
+        return NULL;
     }
+
+    result->mapping = mapping;
+    result->mappingLength = length;
+    result->isReadOnly = true;
+
+    return result;
 }
 
-/** @brief Reconstructs original phone numbers.
- * Reconstructs original phone numbers, using prefixes which has been redirected
- * to the prefix represented by the passed @ref ForwardedNode. Iterates over
- * the array of the nodes representing forwarded prefixes and creates
- * the original string through concatenation of the retrieved original prefix
- * and the suffix left after forwarded prefix.
+/** @brief Counts a node in the shape of a tree.
  *
- * @param[in] finalRedirection - the node representing the prefix
- *                               after forwarding.
- * @param[in] arrayLength - the length of the phone number after forwarding.
- * @param[in] num - the phone number after forwarding
- * @param[in, out] results - the structure storing reconstructed phone numbers.
- * @param[in] isGetReverse - indicates whether the helper function should
- *                           proceed as for phfwdGetReverse.
- * @param[in] pf - a pointer to the structure storing number redirections.
+ * @param[in, out] tree - the shape of the tree;
+ * @param[in] depth - the number of the digits on the path to the node;
+ * @param[in] childMask - the bitmap of the edges leaving the node;
+ * @param[in] isTerminal - indicates whether the node ends a prefix.
+ */
+static void countTreeNode(PhoneForwardTreeStats * tree, uint64_t depth,
+                          uint16_t childMask, bool isTerminal) {
+    tree->nodes++;
+    tree->terminalNodes += isTerminal;
+    tree->depths[depth < PHFWD_STATS_DEPTHS ? depth
+                                            : PHFWD_STATS_DEPTHS - 1]++;
+    tree->fanOuts[countChildren(childMask)]++;
+}
+
+/** @brief Describes the trees of a structure.
+ * Visits the nodes of both trees, counting them and the memory they own.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in, out] stats - the description, zeroed beforehand.
  * @return @p False in case of memory allocation failure, @p true otherwise.
  */
-static bool recreateOriginalPhoneNumbers(ForwardedNode* finalRedirection,
-                                         size_t arrayLength,
-                                         char const * num,
-                                         PhoneNumbers * results,
-                                         bool isGetReverse,
-                                         PhoneForward const * pf) {
-    InitialNode * originalNumber;
-    size_t redirectedPrefixLength = finalRedirection->depth;
-    size_t resultingSuffixLength = arrayLength - redirectedPrefixLength;
-
-    for (uint64_t i = 0; i < finalRedirection->numForwardedNodes; i++) {
-        originalNumber = finalRedirection->forwardedNodes[i];
-        if (originalNumber) {
-            size_t originalPrefixLength = originalNumber->depth;
-            size_t resultingLength = resultingSuffixLength
-                                        + originalPrefixLength + 1;
-            char* originalPrefix = originalNumber->initialPrefix;
-
-            char* newNumber = malloc(resultingLength);
-            if (!newNumber) {
-                return false;
-            }
+static bool describeTrees(PhoneForward const * pf, PhoneForwardStats * stats) {
+    size_t numInitial = 0;
+    size_t numForwarded = 0;
+    InitialNode const ** initialOrder = orderInitialNodes(pf->initialRoot,
+                                                          &numInitial);
+    ForwardedNode const ** forwardedOrder =
+        orderForwardedNodes(pf->forwardedRoot, &numForwarded);
+
+    if (!initialOrder || !forwardedOrder) {
+        free(initialOrder);
+        free(forwardedOrder);
 
-            memmove(newNumber, originalPrefix, originalPrefixLength);
-            memmove(newNumber + originalPrefixLength,
-                    num + redirectedPrefixLength, resultingSuffixLength);
-            newNumber[resultingLength - 1] = '\0';
+        return false;
+    }
 
-            if (isGetReverse) {
-                if (!isResultingFromGet(newNumber, num, pf)) {
-                    free(newNumber);
-                }
-                else {
-                    if (!addReversedNumber(results, newNumber)) {
-                        free(newNumber);
+    for (size_t i = 0; i < numInitial; i++) {
+        InitialNode const * node = initialOrder[i];
 
-                        return false;
-                    }
-                }
-            }
-            else if (!isGetReverse) {
-                if (!addReversedNumber(results, newNumber)) {
-                    free(newNumber);
+        countTreeNode(&(stats->initial), node->depth, node->childMask,
+                      isForwardSet(node->isForwarded));
+    }
 
-                    return false;
-                }
-            }
-        }
+    for (size_t i = 0; i < numForwarded; i++) {
+        ForwardedNode const * node = forwardedOrder[i];
+
+        countTreeNode(&(stats->forwarded), node->depth, node->childMask,
+                      isForwardSet(node->isForwarding));
+        stats->forwardedArrayBytes += node->numSlotsForNodes
+                                      * sizeof(InitialNode*);
+        stats->forwardedArraySlots += node->numForwardedNodes;
+        stats->tombstones += node->numForwardedNodes - node->sumForwarded;
     }
 
+    stats->nodeBytes = poolBytes(&(pf->initialPool.nodes))
+                       + poolBytes(&(pf->forwardedPool.nodes));
+    stats->childrenBytes = childrenBytes(&(pf->initialPool))
+                           + childrenBytes(&(pf->forwardedPool));
+
+    free(initialOrder);
+    free(forwardedOrder);
+
     return true;
 }
 
-/** @brief Creates phfwdGetReverse or phwfdReverse output.
- * A helper function which creates the full result of @ref phfwdGetReverse
- * or @ref phfwdReverse, according to the passed parameter, indicating which
- * function has called reverseHelper.
+/** @brief Describes the trees stored in an image.
  *
- * @param[in] pf - a pointer to the structure storing number redirections;
- * @param[in] num - a pointer to the string representing a number.
- * @param[in] isGetReverse - an indicator whether phfwdGetReverse
- *                           or phfwdReverse calls reverseHelper.
- * @return A pointer to the structure storing the sequence of numbers
- *         or NULL in case of memory allocation failure.
+ * @param[in] flat - a view of the image;
+ * @param[in, out] stats - the description, zeroed beforehand.
  */
-PhoneNumbers * reverseHelper(PhoneForward const * pf,
-                            char const *num, bool isGetReverse) {
-    if (!pf) {
-        return NULL;
+static void describeImage(FlatTrie const * flat, PhoneForwardStats * stats) {
+    for (uint32_t i = 0; i < flat->header->numInitial; i++) {
+        FlatInitialNode const * node = &(flat->initial[i]);
+        countTreeNode(&(stats->initial), node->depth, node->childMask,
+                      node->isForwarded);
     }
 
-    size_t len = checkLength(num);
-    PhoneNumbers *result = createNewPhoneNumbers();
-
-    if (!result) {
-        return NULL;
+    for (uint32_t i = 0; i < flat->header->numForwarded; i++) {
+        FlatForwardedNode const * node = &(flat->forwarded[i]);
+        countTreeNode(&(stats->forwarded), node->depth, node->childMask,
+                      node->isForwarding);
     }
+}
 
-    if (len == 0) {
-        return result;
+bool phfwdStats(PhoneForward const *pf, PhoneForwardStats *stats) {
+    if (!pf || !stats) {
+        return false;
     }
 
-    if (!isGetReverse || isResultingFromGet(num, num, pf)) {
-        result->numbers[0] = strdup(num);
+    memset(stats, 0, sizeof(PhoneForwardStats));
 
-        if (!result->numbers[0]) {
-            phnumDelete(result);
+    // The trees of a read-only structure hold only the changes of a snapshot
+    if (pf->isReadOnly) {
+        PhoneForwardStats changed;
+        memset(&changed, 0, sizeof(PhoneForwardStats));
 
-            return NULL;
+        if (pf->isOverlaid && !describeTrees(pf, &changed)) {
+            return false;
         }
+
+        describeImage(&(pf->flat), stats);
+        stats->nodeBytes = changed.nodeBytes;
+        stats->childrenBytes = changed.childrenBytes;
+        stats->forwardedArrayBytes = changed.forwardedArrayBytes;
+        stats->imageBytes = pf->mapping ? pf->mappingLength
+                            : (size_t) pf->flat.header->totalLength;
     }
     else {
-            result->lastAvailableIndex = 0;
-    }
-
-    size_t depth = 0;
-    ForwardedNode *currentForward = pf->forwardedRoot;
-    bool isPossibleToPass = true;
-    uint32_t digit;
-    while (depth < len && isPossibleToPass && currentForward) {
-        digit = getIndex(num[depth]);
-
-        if (isForwardSet(currentForward->isForwarding)) {
-            // Add number to phoneNumbers
-            if (!recreateOriginalPhoneNumbers(currentForward, len, num, result,
-                                              isGetReverse, pf)) {
-                phnumDelete(result);
-
-                return NULL;
-            }
+        if (!describeTrees(pf, stats)) {
+            return false;
         }
 
-        if (currentForward->alphabet[digit]) {
-            currentForward = currentForward->alphabet[digit];
-            depth++;
-        } else {
-            isPossibleToPass = false;
-        }
+        // The image kept for the snapshots is held also when not viewed
+        stats->imageBytes = pf->compiled ? imageLength(pf->compiled) : 0;
     }
 
-    //Check the last one
-    if (currentForward && isForwardSet(currentForward->isForwarding)) {
-        if (!recreateOriginalPhoneNumbers(currentForward, len, num, result,
-                                          isGetReverse, pf)) {
-            phnumDelete(result);
-
-            return NULL;
-        }
+    if (pf->cache) {
+        stats->cacheBytes = sizeof(NumberCache) + cacheBytes(pf->cache);
     }
 
-    sortCharArray(result->numbers, result->lastAvailableIndex);
-    removeDuplicateNumbersAfterQsort(result);
+    if (pf->changes) {
+        stats->changesBytes = sizeof(PhoneForwardTransaction)
+                              + pf->changes->slots
+                                * sizeof(TransactionOperation)
+                              + pf->changes->textSlots;
+    }
 
-    return result;
-}
+    stats->totalBytes = sizeof(PhoneForward) + stats->nodeBytes
+                        + stats->childrenBytes + stats->forwardedArrayBytes
+                        + stats->imageBytes + stats->cacheBytes
+                        + stats->changesBytes;
 
-PhoneNumbers * phfwdReverse(PhoneForward const *pf, char const *num) {
-    return reverseHelper(pf, num, false);
+    return true;
 }
-
-PhoneNumbers * phfwdGetReverse(PhoneForward const *pf, char const *num) {
-    return reverseHelper(pf, num, true);
-}
\ No newline at end of file
@@ -25,6 +25,110 @@ typedef struct PhoneForward PhoneForward;  ///< Stores phone forwards
 struct PhoneNumbers;
 typedef struct PhoneNumbers PhoneNumbers;  ///< Stores phone numbers
 
+/**
+ * This is the structure yielding reconstructed phone numbers one by one.
+ */
+struct PhoneReverseIter;
+typedef struct PhoneReverseIter PhoneReverseIter;  ///< Iterates over numbers
+
+/**
+ * This is the structure staging modifications applied together.
+ */
+struct PhoneForwardTransaction;
+typedef struct PhoneForwardTransaction PhoneForwardTransaction;  ///< Batch
+
+/** @struct PhoneForwardRule
+ * @brief A single redirection passed to @ref phfwdAddBulk.
+ * @var PhoneForwardRule::num1
+ *      The prefix of the redirected numbers.
+ * @var PhoneForwardRule::num2
+ *      The prefix of the numbers to whom the redirection is performed.
+ */
+typedef struct PhoneForwardRule {
+    char const *num1;
+    char const *num2;
+} PhoneForwardRule;  ///< Redirection of a bulk addition
+
+/**
+ * The number of the depths distinguished by @ref PhoneForwardTreeStats;
+ * the nodes at larger depths are counted together with the last one.
+ */
+#define PHFWD_STATS_DEPTHS      32
+
+/**
+ * The number of the possible numbers of the children of a node, counted
+ * by @ref PhoneForwardTreeStats.
+ */
+#define PHFWD_STATS_FAN_OUTS    13
+
+/** @struct PhoneForwardTreeStats
+ * @brief The shape of one of the trees of a structure.
+ * @var PhoneForwardTreeStats::nodes
+ *      The number of the nodes, including the root.
+ * @var PhoneForwardTreeStats::terminalNodes
+ *      The number of the nodes ending a prefix: a redirected one in the tree
+ *      of the redirected prefixes, a target one in the other tree.
+ * @var PhoneForwardTreeStats::depths
+ *      The numbers of the nodes by the number of the digits on the path from
+ *      the root; the last element counts also all the deeper nodes.
+ * @var PhoneForwardTreeStats::fanOuts
+ *      The numbers of the nodes by the number of their children.
+ */
+typedef struct PhoneForwardTreeStats {
+    size_t nodes;
+    size_t terminalNodes;
+    size_t depths[PHFWD_STATS_DEPTHS];
+    size_t fanOuts[PHFWD_STATS_FAN_OUTS];
+} PhoneForwardTreeStats;  ///< Shape of a tree
+
+/** @struct PhoneForwardStats
+ * @brief Memory usage and shape of a structure, filled by @ref phfwdStats.
+ *      The sizes are the ones requested from the allocator, without its
+ *      own overhead.
+ * @var PhoneForwardStats::initial
+ *      The tree of the redirected prefixes.
+ * @var PhoneForwardStats::forwarded
+ *      The tree of the prefixes the numbers are redirected to.
+ * @var PhoneForwardStats::nodeBytes
+ *      The memory of the pools of the nodes of both trees, including
+ *      the released nodes.
+ * @var PhoneForwardStats::childrenBytes
+ *      The memory of the pools of the arrays of the children of the nodes,
+ *      including the released arrays.
+ * @var PhoneForwardStats::forwardedArrayBytes
+ *      The memory of the arrays of the redirected nodes kept by the targets.
+ * @var PhoneForwardStats::forwardedArraySlots
+ *      The number of the used slots of these arrays, up to the last one
+ *      which has been occupied.
+ * @var PhoneForwardStats::tombstones
+ *      The number of the used slots which are empty, either left by
+ *      a removal or kept as a gap for the insertions.
+ * @var PhoneForwardStats::imageBytes
+ *      The size of the image serving the lookups or kept for the snapshots,
+ *      either mapped from a file or compiled in memory; 0 if there is none.
+ * @var PhoneForwardStats::cacheBytes
+ *      The memory of the cache enabled by @ref phfwdSetCache.
+ * @var PhoneForwardStats::changesBytes
+ *      The memory of the changes made since the image has been compiled,
+ *      which are kept for the snapshots, see @ref phfwdSnapshot.
+ * @var PhoneForwardStats::totalBytes
+ *      The memory of the structure: the sum of all the sizes above and of
+ *      the structure itself.
+ */
+typedef struct PhoneForwardStats {
+    PhoneForwardTreeStats initial;
+    PhoneForwardTreeStats forwarded;
+    size_t nodeBytes;
+    size_t childrenBytes;
+    size_t forwardedArrayBytes;
+    size_t forwardedArraySlots;
+    size_t tombstones;
+    size_t imageBytes;
+    size_t cacheBytes;
+    size_t changesBytes;
+    size_t totalBytes;
+} PhoneForwardStats;  ///< Memory usage and shape of a structure
+
 /** @brief Creates a new structure.
  * Creates a new structure which does not contain any redirections.
  *
@@ -34,13 +138,86 @@ typedef struct PhoneNumbers PhoneNumbers;  ///< Stores phone numbers
 PhoneForward * phfwdNew(void);
 
 /** @brief Removes a structure.
- * Removes a structure pointed to by @p pf. It does nothing if this pointer
- * is NULL.
+ * Removes a structure pointed to by @p pf, closing its journal, if any,
+ * after writing its records. It does nothing if this pointer is NULL.
  *
  * @param[in] pf - a pointer to the structure to be deleted.
  */
 void phfwdDelete(PhoneForward *pf);
 
+/** @brief Enables the cache of the redirections of numbers.
+ * Makes @ref phfwdGet and @ref phfwdGetInto remember the redirections of up
+ * to @p capacity most recently queried numbers and serve the repeated
+ * queries without looking for the redirected prefix. Any modification of
+ * the structure outdates all the cached redirections. The cached queries
+ * modify the cache, therefore a structure with the cache enabled must not
+ * be queried by many threads at the same time. Replaces the previous cache,
+ * if any; @p capacity equal to 0 disables the cache.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections;
+ * @param[in] capacity - the number of the cached numbers.
+ * @return @p False if @p pf is NULL or in case of memory allocation failure,
+ *         in which case the previous cache is kept, @p true otherwise.
+ */
+bool phfwdSetCache(PhoneForward *pf, size_t capacity);
+
+/** @brief Enables the journal of the modifications.
+ * Makes @ref phfwdAdd, @ref phfwdAddBulk, @ref phfwdRemove and
+ * @ref phfwdTransactionCommit append the records of the successful
+ * modifications to the journal in the file @p path, which is created if it
+ * does not exist. The records are kept in
+ * memory and written to the file, which is then synchronized with
+ * the storage, after every @p syncInterval records, by
+ * @ref phfwdJournalSync and when the journal is closed. An existing journal
+ * is continued, after cutting off a record left incomplete by a crash, so
+ * the journal should be enabled on the structure created from it by
+ * @ref phfwdReplayJournal or, for a new file, on an empty structure.
+ * If a modification cannot be recorded, the journal stops recording the next
+ * ones, which is reported by @ref phfwdJournalSync. Replaces the previous
+ * journal, if any, writing its records first; @p path equal to NULL disables
+ * the journal. The journal is closed by @ref phfwdDelete.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections;
+ * @param[in] path - a pointer to the path of the file or NULL;
+ * @param[in] syncInterval - the number of the records after which the file
+ *                           is synchronized, 0 if it is synchronized only on
+ *                           demand and when the journal is closed.
+ * @return @p False if @p pf is NULL or read-only, if the file cannot be
+ *         opened or is not a journal, in which case the previous journal is
+ *         kept, or if the records of the previous journal could not be
+ *         written, @p true otherwise.
+ */
+bool phfwdSetJournal(PhoneForward *pf, char const *path, size_t syncInterval);
+
+/** @brief Synchronizes the journal of the modifications.
+ * Writes the records of the journal enabled by @ref phfwdSetJournal kept in
+ * memory to the file and waits until they reach the storage.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections.
+ * @return @p False if @p pf is NULL, if the journal is disabled or if any of
+ *         its records could not be stored, @p true otherwise.
+ */
+bool phfwdJournalSync(PhoneForward *pf);
+
+/** @brief Recreates a structure from a journal.
+ * Creates a new structure and applies the modifications recorded in
+ * the journal written by the structure given to @ref phfwdSetJournal,
+ * in their order, adding the redirections recorded between the removals
+ * with @ref phfwdAddBulk. The records following the last complete one, left
+ * by a crash, are ignored, and a file holding only a part of the beginning
+ * of a journal is an empty journal. The journal is not enabled in the created
+ * structure.
+ *
+ * @param[in] path - a pointer to the path of the file.
+ * @return A pointer to the created structure or NULL if @p path is NULL,
+ *         if the file cannot be read or is not a journal or in case of memory
+ *         allocation failure.
+ */
+PhoneForward * phfwdReplayJournal(char const *path);
+
 /** @brief Adds a redirection.
  *  Adds a forwarding of the all numbers beginning with the prefix @p num1
  *  to the numbers, whose given prefix has been correspondingly substituted
@@ -61,6 +238,25 @@ void phfwdDelete(PhoneForward *pf);
  */
 bool phfwdAdd(PhoneForward *pfd, char const *num1, char const *num2);
 
+/** @brief Adds many redirections.
+ * Adds the redirections as if @ref phfwdAdd were called for the rules in
+ * the order of the array; of the rules with the same @p num1 the last one
+ * counts. The rules are sorted by @p num1 first, so the consecutive walks
+ * down the trees start where the paths of the previous rule diverge, instead
+ * of starting from the roots. The journal records the redirections which
+ * have been added, also when only a part of them has been.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in] rules - a pointer to the array of the redirections;
+ * @param[in] n - the number of the redirections.
+ * @return The value of @p true, if all redirections have been added.
+ *         The value of @p false, if any rule is incorrect as described in
+ *         @ref phfwdAdd, in which case nothing is added, or enough memory
+ *         could not have been allocated, in which case a part of
+ *         the redirections may have been added.
+ */
+bool phfwdAddBulk(PhoneForward *pf, PhoneForwardRule const *rules, size_t n);
+
 /** @brief Removes redirections.
  * Removes all redirections, in which the parameter @p num is a prefix
  * of the parameter @p num1 used in redirection inclusion (phfwdAdd). If there
@@ -72,6 +268,76 @@ bool phfwdAdd(PhoneForward *pfd, char const *num1, char const *num2);
  */
 void phfwdRemove(PhoneForward *pf, char const *num);
 
+/** @brief Creates a transaction.
+ * Creates an empty sequence of modifications, which are staged by
+ * @ref phfwdTransactionAdd and @ref phfwdTransactionRemove and applied
+ * together by @ref phfwdTransactionCommit.
+ *
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
+ */
+PhoneForwardTransaction * phfwdTransactionNew(void);
+
+/** @brief Removes a transaction.
+ * Removes a structure pointed to by @p tx. It does nothing if the pointer
+ * is NULL.
+ *
+ * @param[in] tx - a pointer to the transaction to be removed.
+ */
+void phfwdTransactionDelete(PhoneForwardTransaction *tx);
+
+/** @brief Stages an addition of a redirection.
+ * Appends the addition of the redirection of @p num1 to @p num2, as made by
+ * @ref phfwdAdd, to the transaction. The numbers are copied.
+ *
+ * @param[in, out] tx - a pointer to the transaction;
+ * @param[in] num1 - a pointer to the string representing the prefix of
+ *                   the redirected numbers;
+ * @param[in] num2 - a pointer to the string representing the prefix of
+ *                   the numbers to whom the redirection is performed.
+ * @return The value of @p true, if the addition has been staged.
+ *         The value of @p false, if @p tx is NULL, the redirection is
+ *         incorrect as described in @ref phfwdAdd or enough memory could not
+ *         have been allocated, in which case the transaction is unchanged.
+ */
+bool phfwdTransactionAdd(PhoneForwardTransaction *tx, char const *num1,
+                         char const *num2);
+
+/** @brief Stages a removal of redirections.
+ * Appends the removal of the redirections of the prefixes starting with
+ * @p num, as made by @ref phfwdRemove, to the transaction. The number is
+ * copied.
+ *
+ * @param[in, out] tx - a pointer to the transaction;
+ * @param[in] num - a pointer to the string representing the prefix of numbers.
+ * @return The value of @p true, if the removal has been staged.
+ *         The value of @p false, if @p tx is NULL, the string does not
+ *         represent a number or enough memory could not have been allocated,
+ *         in which case the transaction is unchanged.
+ */
+bool phfwdTransactionRemove(PhoneForwardTransaction *tx, char const *num);
+
+/** @brief Applies a transaction.
+ * Makes the staged modifications, with the same result as calling
+ * @ref phfwdAdd and @ref phfwdRemove in the order they have been staged,
+ * but either all of them or none. The paths of all the added prefixes are
+ * extended first, in sorted order as by @ref phfwdAddBulk, together with
+ * the memory for the redirections, and only then the modifications are
+ * made, without allocating memory, as one change of the structure: the cached
+ * redirections and the compiled image are dropped once. The journal records
+ * all the modifications after they are made. The transaction is not changed,
+ * so it may be applied to other structures as well.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number redirections;
+ * @param[in] tx - a pointer to the transaction.
+ * @return The value of @p true, if the modifications have been made.
+ *         The value of @p false, if @p pf or @p tx is NULL, @p pf is
+ *         read-only or enough memory could not have been allocated, in which
+ *         case the redirections of @p pf are unchanged.
+ */
+bool phfwdTransactionCommit(PhoneForward *pf,
+                            PhoneForwardTransaction const *tx);
+
 /** @brief Assigns the number redirection.
  * Assigns the redirection to the given number. Looks for the longest common
  * prefix. The result is the sequence containing at most one number.
@@ -87,6 +353,62 @@ void phfwdRemove(PhoneForward *pf, char const *num);
  */
 PhoneNumbers * phfwdGet(PhoneForward const *pf, char const *num);
 
+/** @brief Assigns the number redirection into a given buffer.
+ * Assigns the redirection to the given number exactly as @ref phfwdGet does,
+ * but writes the resulting number, followed by the terminating null
+ * character, into the memory provided by the caller instead of allocating
+ * a structure. Nothing is written if the result together with the terminating
+ * null character does not fit in @p cap bytes; the returned length allows
+ * to repeat the call with a sufficiently large buffer.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - a pointer to the string representing the number;
+ * @param[out] out - a pointer to the memory for the resulting number;
+ * @param[in] cap - the size of the memory pointed to by @p out in bytes.
+ * @return The length of the resulting number or 0 if @p pf is NULL or
+ *         the given string does not represent a number.
+ */
+size_t phfwdGetInto(PhoneForward const *pf, char const *num, char *out,
+                    size_t cap);
+
+/** @brief Assigns the number redirection reusing a structure.
+ * Assigns the redirection to the given number exactly as @ref phfwdGet does,
+ * but stores the result in the structure @p pnum, replacing its numbers and
+ * keeping the memory already allocated for them. A structure reused in a loop
+ * of queries stops allocating memory once it has grown large enough.
+ * The structure remains owned by the caller, also when NULL is returned,
+ * in which case it is left empty. If @p pnum is NULL, the function
+ * behaves as @ref phfwdGet.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - a pointer to the string representing the number;
+ * @param[in, out] pnum - a pointer to the structure to be filled with
+ *                        the result or NULL.
+ * @return A pointer to the structure storing the sequence of numbers, equal to
+ *         @p pnum if it is not NULL, or NULL if @p pf is NULL or in case of
+ *         memory allocation failure.
+ */
+PhoneNumbers * phfwdGetReuse(PhoneForward const *pf, char const *num,
+                             PhoneNumbers *pnum);
+
+/** @brief Assigns the number redirections to many numbers at once.
+ * Assigns the redirection to each of the @p n given numbers, exactly as
+ * @ref phfwdGet does. The result is the sequence containing @p n numbers:
+ * the number at the index @p i is the redirection of @p nums[i] or NULL
+ * if @p nums[i] does not represent a number. All the numbers are stored in
+ * a single block of memory. Allocates the structure @p PhoneNumbers,
+ * which should be freed using the function @ref phnumDelete.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] nums - an array of pointers to the strings representing
+ *                   the numbers;
+ * @param[in] n - the number of the strings in @p nums.
+ * @return A pointer to the structure storing the sequence of numbers
+ *         or NULL in case of memory allocation failure.
+ */
+PhoneNumbers * phfwdGetBatch(PhoneForward const *pf, char const *const *nums,
+                             size_t n);
+
 /** @brief Assigns possible redirections to the given number.
  * Assigns the following sequence of numbers to the given number: if there
  * exists a number @p x such that its prefix can be redirected to the
@@ -120,11 +442,35 @@ void phnumDelete(PhoneNumbers *pnum);
  *
  * @param[in] pnum - a pointer to the structure storing the sequence of numbers;
  * @param[in] idx - an index of the phone number.
- * @return A pointer to the string representing a phone number.
+ * @return A pointer to the string representing a phone number, valid until
+ *         the sequence is extended by @ref phnumAdd or removed.
  *         Tha value of NULL if @p pnum is NULL or the index is too large.
  */
 char const * phnumGet(PhoneNumbers const *pnum, size_t idx);
 
+/** @brief Creates an empty sequence of numbers.
+ * Allocates a structure @p PhoneNumbers containing no numbers, which can be
+ * extended using the function @ref phnumAdd and should be freed using
+ * the function @ref phnumDelete.
+ *
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
+ */
+PhoneNumbers * phnumNew(void);
+
+/** @brief Appends a number to a sequence.
+ * Appends a copy of the string @p num at the end of the sequence.
+ * The string is not validated. The numbers of the sequence may be moved,
+ * so the pointers provided by @ref phnumGet before are no longer valid.
+ *
+ * @param[in, out] pnum - a pointer to the structure storing the sequence
+ *                        of numbers;
+ * @param[in] num - a pointer to the string to be appended.
+ * @return @p False if @p pnum or @p num is NULL or in case of memory
+ *         allocation failure, @p true otherwise.
+ */
+bool phnumAdd(PhoneNumbers *pnum, char const *num);
+
 /** @brief Reconstructs original numbers from given redirection.
  * Assings the following sequence of numbers to the given number: if there
  * exists a number @p x such that @ref phfwdGet function called with given @p x
@@ -140,4 +486,165 @@ char const * phnumGet(PhoneNumbers const *pnum, size_t idx);
  */
 PhoneNumbers * phfwdGetReverse(PhoneForward const *pf, char const *num);
 
+/** @brief Reconstructs numbers reusing a structure.
+ * Computes the result of @ref phfwdReverse or, if @p isGetReverse is set,
+ * of @ref phfwdGetReverse called with @p num, and stores it in the structure
+ * @p pnum, replacing its numbers and keeping the memory already allocated for
+ * them. The structure also keeps the memory of the reconstruction itself,
+ * so once it has grown large enough, the calls allocate no memory.
+ * The structure remains owned by the caller, also when NULL is
+ * returned, in which case it is left empty. If @p pnum is NULL, a new
+ * structure is allocated.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - a pointer to the string representing a number;
+ * @param[in] isGetReverse - a flag indicating whether the result is that of
+ *                           @ref phfwdGetReverse;
+ * @param[in, out] pnum - a pointer to the structure to be filled with
+ *                        the result or NULL.
+ * @return A pointer to the structure storing the sequence of numbers, equal to
+ *         @p pnum if it is not NULL, or NULL if @p pf is NULL or in case of
+ *         memory allocation failure.
+ */
+PhoneNumbers * phfwdReverseReuse(PhoneForward const *pf, char const *num,
+                                 bool isGetReverse, PhoneNumbers *pnum);
+
+/** @brief Creates a cursor over reconstructed numbers.
+ * Creates a structure yielding the numbers of @ref phfwdReverse or, if
+ * @p isGetReverse is set, of @ref phfwdGetReverse called with @p num, in
+ * the same order, without repetitions. A number is written down only when it
+ * is yielded, therefore retrieving the first few numbers does not require
+ * building nor sorting the whole set. The number @p num is copied. The structure @p pf
+ * must not be modified nor removed until the cursor is removed using
+ * the function @ref phfwdReverseIterFree. If the given string does not
+ * represent a number, the cursor yields nothing.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] num - a pointer to the string representing a number;
+ * @param[in] isGetReverse - indicates whether the numbers are limited
+ *                           to those of @ref phfwdGetReverse.
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure or if @p pf is NULL.
+ */
+PhoneReverseIter * phfwdReverseIterNew(PhoneForward const *pf, char const *num,
+                                       bool isGetReverse);
+
+/** @brief Provides the next reconstructed number.
+ * Provides the next number in lexicographic order. The string is owned by
+ * the cursor and stays valid until the next call with the same cursor.
+ *
+ * @param[in, out] it - a pointer to the cursor.
+ * @return A pointer to the string representing a phone number or NULL if all
+ *         numbers have been provided, @p it is NULL or in case of memory
+ *         allocation failure, after which the cursor yields nothing more.
+ */
+char const * phfwdReverseIterNext(PhoneReverseIter *it);
+
+/** @brief Removes a cursor.
+ * Removes a structure pointed to by @p it. It does nothing if the pointer
+ * is NULL.
+ *
+ * @param[in] it - a pointer to the cursor to be removed.
+ */
+void phfwdReverseIterFree(PhoneReverseIter *it);
+
+/** @brief Saves the redirections to a file.
+ * Writes an image of the structure pointed to by @p pf to the file with
+ * the given path. The image is written to the file with the suffix
+ * ".tmp" appended to the path and flushed to the disk first, then it
+ * replaces the file with the given path, so the file never holds
+ * a partial image and a structure still using the old file by
+ * @ref phfwdLoadMapped keeps its content. The image stores the trees in
+ * arrays of nodes referring to each other by indices, so it can be used
+ * directly after mapping it into memory by @ref phfwdLoadMapped, without
+ * rebuilding the trees.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] path - a pointer to the string representing the path
+ *                   of the file.
+ * @return @p True if the file has been written, @p false if @p pf or @p path
+ *         is NULL, in case of memory allocation failure or if the file could
+ *         not be written.
+ */
+bool phfwdSave(PhoneForward const *pf, char const *path);
+
+/** @brief Loads the redirections from a file.
+ * Creates a structure serving the redirections saved by @ref phfwdSave
+ * straight from the file, mapped into memory read-only. The functions
+ * @ref phfwdGet, @ref phfwdReverse, @ref phfwdGetReverse and the related ones
+ * behave as for the saved structure; @ref phfwdAdd returns @p false
+ * and @ref phfwdRemove does nothing. The file is released by
+ * @ref phfwdDelete and must not be modified until then.
+ *
+ * @param[in] path - a pointer to the string representing the path
+ *                   of the file.
+ * @return A pointer to the created structure or NULL if @p path is NULL,
+ *         the file could not be mapped, does not contain a consistent
+ *         image of the current version or in case of memory allocation
+ *         failure.
+ */
+PhoneForward * phfwdLoadMapped(char const *path);
+
+/** @brief Compiles the redirections for faster lookups.
+ * Builds in memory the same image as @ref phfwdSave, in a single block
+ * aligned to cache lines, and makes @ref phfwdGet, @ref phfwdReverse,
+ * @ref phfwdGetReverse and the related functions use it instead of
+ * the trees: a lookup walks an array of nodes numbered in breadth-first order,
+ * each of which knows its deepest redirected ancestor. The trees are kept,
+ * so the structure may still be modified; the lookups use the trees from
+ * the first modification until the next compilation. The first modification
+ * releases the image, unless a snapshot taken by @ref phfwdSnapshot has
+ * shared it: then the image stays in memory, for the next snapshots, until
+ * the next compilation, together with a copy of every modification made
+ * since, which costs a memory allocation now and then. @ref phfwdStats counts
+ * both. It does nothing if the structure already uses an image.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections.
+ * @return @p False if @p pf is NULL, in case of memory allocation failure
+ *         or if the trees are too large for an image, @p true otherwise.
+ */
+bool phfwdCompile(PhoneForward *pf);
+
+/** @brief Takes a snapshot of the redirections.
+ * Creates a read-only structure serving the current redirections of @p pf,
+ * which stay unchanged when @p pf is modified later. The snapshot shares
+ * the image compiled by @ref phfwdCompile with @p pf, compiling it first if
+ * there is none, so taking a snapshot of a structure unmodified since
+ * the last compilation takes constant time. Otherwise the changes made since
+ * that compilation are replayed in the trees of the snapshot, which
+ * the lookups check before the image, so taking a snapshot costs time
+ * proportional to the number of these changes. Once the changes replayed by
+ * the snapshots of @p pf add up to the cost of a compilation, the image is
+ * compiled again instead. The modifications of @p pf never copy the image.
+ * The snapshot behaves as a structure loaded by @ref phfwdLoadMapped:
+ * @ref phfwdAdd
+ * returns @p false and @ref phfwdRemove does nothing. The snapshot does not
+ * depend on @p pf, so it may be queried by other threads while @p pf is
+ * modified, and it is removed by @ref phfwdDelete, also after @p pf.
+ *
+ * @param[in, out] pf - a pointer to the structure storing number
+ *                      redirections, not loaded by @ref phfwdLoadMapped.
+ * @return A pointer to the created snapshot or NULL if @p pf is NULL or
+ *         loaded by @ref phfwdLoadMapped, if the image cannot be compiled or
+ *         in case of memory allocation failure.
+ */
+PhoneForward * phfwdSnapshot(PhoneForward *pf);
+
+/** @brief Describes the memory usage of a structure.
+ * Fills @p stats with the numbers of the nodes of both trees, the sizes of
+ * their parts and the histograms of the depths and the numbers of
+ * the children of the nodes. For a structure loaded by @ref phfwdLoadMapped
+ * or taken by @ref phfwdSnapshot the trees are described as stored in
+ * the image. The image is the only memory counted besides the structure
+ * itself, except for a snapshot taken after changes, whose trees holding
+ * the changes are counted as well.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[out] stats - a pointer to the memory for the description.
+ * @return @p False if @p pf or @p stats is NULL or in case of memory
+ *         allocation failure, @p true otherwise.
+ */
+bool phfwdStats(PhoneForward const *pf, PhoneForwardStats *stats);
+
 #endif /* __PHONE_FORWARD_H__ */
@@ -0,0 +1,532 @@
+/** @file
+ * Benchmark of the class storing phone numbers forwards
+ *
+ * Generates synthetic numbering plans and measures the throughput and
+ * the latency percentiles of the operations on them. Usage:
+ *
+ *     phone_forward_bench [workload [size [queries]]]
+ *
+ * where workload is one of country, deep, fanin, descending or all
+ * (the default), size
+ * is the number of the added redirections (by default 1000, 10000 and
+ * 100000 are measured) and queries is the maximal number of the calls of
+ * every querying function (100000 by default). The rules are generated
+ * from their indices, so they are never stored all at once.
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "phone_forward.h"
+
+/**
+ * The maximal length of a generated number, with the terminating null
+ * character.
+ */
+#define MAX_BENCH_NUMBER    24
+
+/**
+ * The number of the bits selecting a bucket within a power of two in
+ * a latency histogram.
+ */
+#define HISTOGRAM_SUB_BITS  4
+
+/**
+ * The number of the buckets of a latency histogram.
+ */
+#define HISTOGRAM_BUCKETS   (64 << HISTOGRAM_SUB_BITS)
+
+/**
+ * The time after which a querying phase stops even if it has not made all
+ * its calls, in nanoseconds.
+ */
+#define PHASE_BUDGET_NS     2000000000ull
+
+/**
+ * The number of the operator prefixes of the deep workload.
+ */
+#define NUM_OPERATORS       256
+
+/**
+ * The number of the prefixes of the descending workload.
+ */
+#define DESCENDING_RANGE    100000000ull
+
+/**
+ * The default number of the calls of every querying function.
+ */
+#define DEFAULT_QUERIES     100000
+
+/** @struct Histogram
+ * @brief Latencies of the calls of a function, grouped in buckets whose
+ *      width is proportional to their values.
+ * @var Histogram::counts
+ *      The numbers of the calls in the buckets.
+ * @var Histogram::calls
+ *      The number of all the calls.
+ * @var Histogram::totalNs
+ *      The total time of all the calls, in nanoseconds.
+ */
+typedef struct Histogram {
+    uint64_t counts[HISTOGRAM_BUCKETS];
+    uint64_t calls;
+    uint64_t totalNs;
+} Histogram;  ///< Latencies of the calls of a function
+
+/** @struct Rule
+ * @brief A generated redirection.
+ * @var Rule::num1
+ *      The redirected prefix.
+ * @var Rule::num2
+ *      The prefix the redirection is performed to.
+ */
+typedef struct Rule {
+    char num1[MAX_BENCH_NUMBER];
+    char num2[MAX_BENCH_NUMBER];
+} Rule;  ///< A generated redirection
+
+/**
+ * A generator of the redirection with the given index.
+ */
+typedef void (*RuleGenerator)(uint64_t index, Rule * rule);
+
+/** @struct Workload
+ * @brief A named kind of numbering plan.
+ * @var Workload::name
+ *      The name given on the command line.
+ * @var Workload::generate
+ *      The generator of its redirections.
+ */
+typedef struct Workload {
+    char const * name;
+    RuleGenerator generate;
+} Workload;  ///< A named kind of numbering plan
+
+/** @brief Mixes a value.
+ * The finalizer of the SplitMix64 generator, used both to derive
+ * the generator state of a rule from its index and to advance it.
+ *
+ * @param[in, out] state - the state of the generator.
+ * @return The next pseudorandom value.
+ */
+static uint64_t nextRandom(uint64_t * state) {
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+    return z ^ (z >> 31);
+}
+
+/** @brief Draws a number from a range.
+ *
+ * @param[in, out] state - the state of the generator;
+ * @param[in] bound - the size of the range.
+ * @return A pseudorandom value from 0 to @p bound - 1.
+ */
+static uint32_t drawBelow(uint64_t * state, uint32_t bound) {
+    return (uint32_t) (nextRandom(state) % bound);
+}
+
+/** @brief Appends random decimal digits to a number.
+ *
+ * @param[in, out] state - the state of the generator;
+ * @param[in, out] number - the number, long enough for the digits;
+ * @param[in] count - the number of the appended digits.
+ */
+static void appendDigits(uint64_t * state, char * number, size_t count) {
+    size_t length = strlen(number);
+
+    for (size_t i = 0; i < count; i++) {
+        number[length++] = (char) ('0' + drawBelow(state, 10));
+    }
+
+    number[length] = '\0';
+}
+
+/** @brief Writes a country calling code.
+ * The codes have from one to three digits and do not start with zero, so
+ * a few short codes are shared by many numbers.
+ *
+ * @param[in, out] state - the state of the generator;
+ * @param[out] number - the memory for the code.
+ */
+static void writeCountryCode(uint64_t * state, char * number) {
+    number[0] = (char) ('1' + drawBelow(state, 9));
+    number[1] = '\0';
+    appendDigits(state, number, drawBelow(state, 3));
+}
+
+/** @brief Generates a redirection between national numbering plans.
+ * Redirects a block of subscriber numbers, i.e. a country code followed by
+ * an area code and the beginning of a subscriber number, to a shorter
+ * prefix in another country.
+ *
+ * @param[in] index - the index of the redirection;
+ * @param[out] rule - the generated redirection.
+ */
+static void generateCountry(uint64_t index, Rule * rule) {
+    uint64_t state = index;
+
+    writeCountryCode(&state, rule->num1);
+    appendDigits(&state, rule->num1, 3 + drawBelow(&state, 4));
+    writeCountryCode(&state, rule->num2);
+    appendDigits(&state, rule->num2, 2 + drawBelow(&state, 3));
+}
+
+/** @brief Writes an operator prefix.
+ * Every operator has a fixed ten-digit prefix, so the redirections of its
+ * numbers share long paths in the trees.
+ *
+ * @param[in] operator - the index of the operator;
+ * @param[out] number - the memory for the prefix.
+ */
+static void writeOperatorPrefix(uint32_t operator, char * number) {
+    uint64_t state = operator * 0x100000001b3ull;
+
+    number[0] = '\0';
+    appendDigits(&state, number, 10);
+}
+
+/** @brief Generates a redirection between deep operator prefixes.
+ * Redirects a number range of an operator to a range of another one.
+ *
+ * @param[in] index - the index of the redirection;
+ * @param[out] rule - the generated redirection.
+ */
+static void generateDeep(uint64_t index, Rule * rule) {
+    uint64_t state = index;
+
+    writeOperatorPrefix(drawBelow(&state, NUM_OPERATORS), rule->num1);
+    appendDigits(&state, rule->num1, 2 + drawBelow(&state, 5));
+    writeOperatorPrefix(drawBelow(&state, NUM_OPERATORS), rule->num2);
+    appendDigits(&state, rule->num2, drawBelow(&state, 5));
+}
+
+/** @brief Generates a redirection to one of a few service numbers.
+ * Redirects a random prefix to one of four targets, most often to
+ * the first one, so a reverse query returns a large part of the rules.
+ *
+ * @param[in] index - the index of the redirection;
+ * @param[out] rule - the generated redirection.
+ */
+static void generateFanIn(uint64_t index, Rule * rule) {
+    static char const * const targets[] = {"800", "8001", "900", "112"};
+    uint64_t state = index;
+    uint32_t target = drawBelow(&state, 8);
+
+    rule->num1[0] = '\0';
+    appendDigits(&state, rule->num1, 6 + drawBelow(&state, 5));
+    strcpy(rule->num2, targets[target < 4 ? 0 : target - 4]);
+}
+
+/** @brief Generates a redirection in descending order.
+ * Redirects the prefixes of one number range to a single target in
+ * descending order of the prefixes, so every addition places its node in
+ * front of all the nodes of the sorted array kept by the target.
+ *
+ * @param[in] index - the index of the redirection;
+ * @param[out] rule - the generated redirection.
+ */
+static void generateDescending(uint64_t index, Rule * rule) {
+    snprintf(rule->num1, MAX_BENCH_NUMBER, "1%08llu",
+             (unsigned long long) (DESCENDING_RANGE - 1
+                                   - index % DESCENDING_RANGE));
+    strcpy(rule->num2, "999");
+}
+
+/** @brief Reads the clock.
+ *
+ * @return The current time in nanoseconds.
+ */
+static uint64_t now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+
+    return (uint64_t) time.tv_sec * 1000000000ull + (uint64_t) time.tv_nsec;
+}
+
+/** @brief Determines the bucket of a latency.
+ * The latencies below 2^HISTOGRAM_SUB_BITS nanoseconds have their own
+ * buckets, the others share a bucket with the latencies of the same power
+ * of two and the same following @ref HISTOGRAM_SUB_BITS bits.
+ *
+ * @param[in] ns - the latency in nanoseconds.
+ * @return The index of the bucket.
+ */
+static size_t bucketOf(uint64_t ns) {
+    if (ns < (1u << HISTOGRAM_SUB_BITS)) {
+        return (size_t) ns;
+    }
+
+    int exponent = 63 - __builtin_clzll(ns);
+    uint64_t sub = (ns >> (exponent - HISTOGRAM_SUB_BITS))
+                   & ((1u << HISTOGRAM_SUB_BITS) - 1);
+
+    return ((size_t) (exponent - HISTOGRAM_SUB_BITS + 1)
+            << HISTOGRAM_SUB_BITS) | sub;
+}
+
+/** @brief Determines the smallest latency of a bucket.
+ *
+ * @param[in] bucket - the index of the bucket.
+ * @return The smallest latency in nanoseconds falling into @p bucket.
+ */
+static uint64_t bucketStart(size_t bucket) {
+    if (bucket < (1u << HISTOGRAM_SUB_BITS)) {
+        return bucket;
+    }
+
+    int exponent = (int) (bucket >> HISTOGRAM_SUB_BITS)
+                   + HISTOGRAM_SUB_BITS - 1;
+    uint64_t sub = bucket & ((1u << HISTOGRAM_SUB_BITS) - 1);
+
+    return ((1ull << HISTOGRAM_SUB_BITS) | sub)
+           << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+/** @brief Records a call.
+ *
+ * @param[in, out] histogram - the latencies of the function;
+ * @param[in] ns - the latency of the call in nanoseconds.
+ */
+static void recordCall(Histogram * histogram, uint64_t ns) {
+    histogram->counts[bucketOf(ns)]++;
+    histogram->calls++;
+    histogram->totalNs += ns;
+}
+
+/** @brief Determines a latency percentile.
+ *
+ * @param[in] histogram - the latencies of the function;
+ * @param[in] percent - the percentile.
+ * @return The smallest latency of the bucket containing the percentile,
+ *         in nanoseconds.
+ */
+static uint64_t percentile(Histogram const * histogram, uint64_t percent) {
+    uint64_t rank = (histogram->calls * percent + 99) / 100;
+    uint64_t seen = 0;
+
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; i++) {
+        seen += histogram->counts[i];
+
+        if (seen >= rank && seen > 0) {
+            return bucketStart(i);
+        }
+    }
+
+    return 0;
+}
+
+/** @brief Prints the results of a phase.
+ * The throughput is computed from the time spent in the measured function.
+ *
+ * @param[in] workload - the name of the workload;
+ * @param[in] size - the number of the redirections;
+ * @param[in] function - the name of the measured function;
+ * @param[in] histogram - the latencies of the calls.
+ */
+static void report(char const * workload, uint64_t size, char const * function,
+                   Histogram const * histogram) {
+    double seconds = (double) histogram->totalNs / 1e9;
+    double throughput = seconds > 0 ? (double) histogram->calls / seconds : 0;
+
+    printf("%-10s %9llu %-16s %9llu %12.0f %9llu %9llu\n", workload,
+           (unsigned long long) size, function,
+           (unsigned long long) histogram->calls, throughput,
+           (unsigned long long) percentile(histogram, 50),
+           (unsigned long long) percentile(histogram, 99));
+}
+
+/** @brief Measures a querying function.
+ * Calls the function with the prefixes of randomly chosen rules followed by
+ * two random digits, the redirected ones for @ref phfwdGet and
+ * the targets for the reverse queries, until @p queries calls are made or
+ * @ref PHASE_BUDGET_NS passes.
+ *
+ * @param[in] pf - a pointer to the structure storing number redirections;
+ * @param[in] workload - the measured workload;
+ * @param[in] size - the number of the redirections;
+ * @param[in] queries - the maximal number of the calls;
+ * @param[in] function - the name of the function;
+ * @param[in] query - the function.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool measureQuery(PhoneForward const * pf, Workload const * workload,
+                         uint64_t size, uint64_t queries,
+                         char const * function,
+                         PhoneNumbers * (*query)(PhoneForward const *,
+                                                 char const *)) {
+    Histogram * histogram = calloc(1, sizeof(Histogram));
+    if (!histogram) {
+        return false;
+    }
+
+    bool isForward = query == phfwdGet;
+    uint64_t state = size ^ 0x5bd1e995ull;
+    uint64_t start = now();
+    Rule rule;
+
+    for (uint64_t i = 0; i < queries && now() - start < PHASE_BUDGET_NS;
+         i++) {
+        workload->generate(nextRandom(&state) % size, &rule);
+        char * number = isForward ? rule.num1 : rule.num2;
+        appendDigits(&state, number, 2);
+
+        uint64_t before = now();
+        PhoneNumbers * result = query(pf, number);
+        recordCall(histogram, now() - before);
+
+        if (!result) {
+            free(histogram);
+
+            return false;
+        }
+
+        phnumDelete(result);
+    }
+
+    report(workload->name, size, function, histogram);
+    free(histogram);
+
+    return true;
+}
+
+/** @brief Measures all the functions on a workload.
+ * Adds @p size redirections, measures the queries and removes the prefixes
+ * of randomly chosen rules.
+ *
+ * @param[in] workload - the measured workload;
+ * @param[in] size - the number of the redirections;
+ * @param[in] queries - the maximal number of the calls of every querying
+ *                      function.
+ * @return @p False in case of memory allocation failure, @p true otherwise.
+ */
+static bool measureWorkload(Workload const * workload, uint64_t size,
+                            uint64_t queries) {
+    PhoneForward * pf = phfwdNew();
+    Histogram * histogram = calloc(1, sizeof(Histogram));
+
+    if (!pf || !histogram) {
+        phfwdDelete(pf);
+        free(histogram);
+
+        return false;
+    }
+
+    Rule rule;
+    for (uint64_t i = 0; i < size; i++) {
+        workload->generate(i, &rule);
+
+        // A redirection of a prefix to itself is refused by phfwdAdd
+        if (strcmp(rule.num1, rule.num2) == 0) {
+            continue;
+        }
+
+        uint64_t before = now();
+        bool isAdded = phfwdAdd(pf, rule.num1, rule.num2);
+        recordCall(histogram, now() - before);
+
+        if (!isAdded) {
+            phfwdDelete(pf);
+            free(histogram);
+
+            return false;
+        }
+    }
+
+    report(workload->name, size, "phfwdAdd", histogram);
+
+    bool isMeasured =
+        measureQuery(pf, workload, size, queries, "phfwdGet", phfwdGet)
+        && measureQuery(pf, workload, size, queries, "phfwdReverse",
+                        phfwdReverse)
+        && measureQuery(pf, workload, size, queries, "phfwdGetReverse",
+                        phfwdGetReverse);
+
+    if (isMeasured) {
+        memset(histogram, 0, sizeof(Histogram));
+        uint64_t state = size;
+
+        for (uint64_t i = 0; i < queries && i < size; i++) {
+            workload->generate(nextRandom(&state) % size, &rule);
+
+            uint64_t before = now();
+            phfwdRemove(pf, rule.num1);
+            recordCall(histogram, now() - before);
+        }
+
+        report(workload->name, size, "phfwdRemove", histogram);
+    }
+
+    phfwdDelete(pf);
+    free(histogram);
+
+    return isMeasured;
+}
+
+/** @brief Runs the benchmark.
+ *
+ * @param[in] argc - the number of the arguments;
+ * @param[in] argv - the workload, the size and the number of the queries.
+ * @return 0 on success, 1 for incorrect arguments or in case of memory
+ *         allocation failure.
+ */
+int main(int argc, char * argv[]) {
+    static Workload const workloads[] = {
+        {"country", generateCountry},
+        {"deep", generateDeep},
+        {"fanin", generateFanIn},
+        {"descending", generateDescending}
+    };
+    static uint64_t const defaultSizes[] = {1000, 10000, 100000};
+    size_t numWorkloads = sizeof(workloads) / sizeof(workloads[0]);
+    size_t numSizes = sizeof(defaultSizes) / sizeof(defaultSizes[0]);
+
+    char const * chosen = argc > 1 ? argv[1] : "all";
+    uint64_t size = argc > 2 ? strtoull(argv[2], NULL, 10) : 0;
+    uint64_t queries = argc > 3 ? strtoull(argv[3], NULL, 10)
+                                : DEFAULT_QUERIES;
+
+    if ((argc > 2 && size == 0) || queries == 0) {
+        fprintf(stderr, "usage: %s [country|deep|fanin|descending|all "
+                        "[size [queries]]]\n", argv[0]);
+
+        return 1;
+    }
+
+    printf("%-10s %9s %-16s %9s %12s %9s %9s\n", "workload", "size",
+           "function", "calls", "calls/s", "p50[ns]", "p99[ns]");
+
+    bool isKnown = false;
+    for (size_t i = 0; i < numWorkloads; i++) {
+        if (strcmp(chosen, "all") != 0
+            && strcmp(chosen, workloads[i].name) != 0) {
+            continue;
+        }
+
+        isKnown = true;
+        for (size_t j = 0; j < (size ? 1 : numSizes); j++) {
+            if (!measureWorkload(&workloads[i], size ? size : defaultSizes[j],
+                                 queries)) {
+                fprintf(stderr, "memory allocation failure\n");
+
+                return 1;
+            }
+        }
+    }
+
+    if (!isKnown) {
+        fprintf(stderr, "unknown workload: %s\n", chosen);
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,334 @@
+/** @file
+ * Implementation of the class storing phone numbers forwards shared
+ * by threads
+ *
+ * The structure follows the left-right scheme: the readers use one of two
+ * copies of the redirections, while the writer modifies the other one,
+ * switches the readers to it and then waits for a grace period before
+ * modifying the first copy. The readers only announce themselves in
+ * counters of the current epoch; there are two epochs and the writer waits
+ * for both of them to become empty, so every reader which might have seen
+ * the old copy has left it before the copy is modified and its nodes freed.
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include "phone_forward_concurrent.h"
+
+/**
+ * The number of the counters of the readers of a single epoch. The threads
+ * are spread among them, so that they rarely write to the same memory.
+ */
+#define NUM_READ_STRIPES    64
+
+/**
+ * The assumed size of a cache line, separating the counters of the readers.
+ */
+#define CACHE_LINE_SIZE     64
+
+/**
+ * The value of the stripe of a thread which has not read anything yet.
+ */
+#define NO_STRIPE           UINT32_MAX
+
+/** @struct ReadStripe
+ * @brief Counters of the readers of both epochs, used by a part of
+ *      the threads and placed in a separate cache line.
+ * @var ReadStripe::readers
+ *      The numbers of the readers which have announced themselves in
+ *      the given epoch and have not finished yet.
+ */
+typedef struct ReadStripe {
+    _Alignas(CACHE_LINE_SIZE) atomic_size_t readers[2];
+} ReadStripe;  ///< Counters of the readers of a part of the threads
+
+/** @struct PhoneForwardConcurrent
+ * @brief Two copies of the redirections with the state of the readers.
+ * @var PhoneForwardConcurrent::stripes
+ *      The counters of the readers.
+ * @var PhoneForwardConcurrent::copies
+ *      The copies of the redirections.
+ * @var PhoneForwardConcurrent::readCopy
+ *      The index of the copy used by the new readers.
+ * @var PhoneForwardConcurrent::epoch
+ *      The epoch the new readers announce themselves in.
+ * @var PhoneForwardConcurrent::writerLock
+ *      The lock held by the thread modifying the structure.
+ * @var PhoneForwardConcurrent::pendingNum1
+ *      The first prefix of the modification which has been applied only to
+ *      the copy used by the readers, to be applied to the other copy by
+ *      the next modification; NULL if the copies are equal.
+ * @var PhoneForwardConcurrent::pendingNum2
+ *      The second prefix of the pending modification or NULL if it is
+ *      a removal.
+ */
+struct PhoneForwardConcurrent {
+    ReadStripe stripes[NUM_READ_STRIPES];
+    PhoneForward* copies[2];
+    atomic_uint readCopy;
+    atomic_uint epoch;
+    pthread_mutex_t writerLock;
+    char* pendingNum1;
+    char* pendingNum2;
+};
+
+/**
+ * The source of the stripes assigned to the threads.
+ */
+static atomic_uint nextStripe;
+
+/**
+ * The stripe of the current thread.
+ */
+static _Thread_local uint32_t threadStripe = NO_STRIPE;
+
+/** @brief Provides the stripe of the current thread.
+ * Assigns the stripes to the threads in turn when they read for the first
+ * time.
+ *
+ * @param[in, out] pfc - a pointer to the structure.
+ * @return A pointer to the counters of the readers of the thread.
+ */
+static ReadStripe * currentStripe(PhoneForwardConcurrent * pfc) {
+    if (threadStripe == NO_STRIPE) {
+        threadStripe = atomic_fetch_add(&nextStripe, 1) % NUM_READ_STRIPES;
+    }
+
+    return &(pfc->stripes[threadStripe]);
+}
+
+PhoneForwardConcurrent * phfwdConcurrentNew(void) {
+    PhoneForwardConcurrent * result = aligned_alloc(
+            CACHE_LINE_SIZE, sizeof(PhoneForwardConcurrent));
+    if (!result) {
+        return NULL;
+    }
+
+    result->copies[0] = phfwdNew();
+    result->copies[1] = phfwdNew();
+
+    if (!result->copies[0] || !result->copies[1]
+        || pthread_mutex_init(&(result->writerLock), NULL) != 0) {
+        phfwdDelete(result->copies[0]);
+        phfwdDelete(result->copies[1]);
+        free(result);
+
+        return NULL;
+    }
+
+    for (size_t i = 0; i < NUM_READ_STRIPES; i++) {
+        atomic_init(&(result->stripes[i].readers[0]), 0);
+        atomic_init(&(result->stripes[i].readers[1]), 0);
+    }
+
+    atomic_init(&(result->readCopy), 0);
+    atomic_init(&(result->epoch), 0);
+    result->pendingNum1 = NULL;
+    result->pendingNum2 = NULL;
+
+    return result;
+}
+
+void phfwdConcurrentDelete(PhoneForwardConcurrent *pfc) {
+    if (pfc) {
+        phfwdDelete(pfc->copies[0]);
+        phfwdDelete(pfc->copies[1]);
+        pthread_mutex_destroy(&(pfc->writerLock));
+        free(pfc->pendingNum1);
+        free(pfc->pendingNum2);
+        free(pfc);
+    }
+}
+
+/** @brief Reads from the structure.
+ * Announces the reader in the current epoch, answers the query using
+ * the copy the readers are directed to and withdraws the announcement.
+ *
+ * @param[in, out] pfc - a pointer to the structure;
+ * @param[in] num - a pointer to the string representing a number;
+ * @param[in] query - the function answering the query.
+ * @return The result of @p query or NULL if @p pfc is NULL.
+ */
+static PhoneNumbers * readConcurrent(PhoneForwardConcurrent * pfc,
+                                     char const * num,
+                                     PhoneNumbers * (*query)(
+                                             PhoneForward const *,
+                                             char const *)) {
+    if (!pfc) {
+        return NULL;
+    }
+
+    ReadStripe * stripe = currentStripe(pfc);
+    unsigned epoch = atomic_load(&(pfc->epoch));
+
+    atomic_fetch_add(&(stripe->readers[epoch]), 1);
+    PhoneNumbers * result = query(pfc->copies[atomic_load(&(pfc->readCopy))],
+                                  num);
+    atomic_fetch_sub(&(stripe->readers[epoch]), 1);
+
+    return result;
+}
+
+PhoneNumbers * phfwdConcurrentGet(PhoneForwardConcurrent *pfc,
+                                  char const *num) {
+    return readConcurrent(pfc, num, phfwdGet);
+}
+
+PhoneNumbers * phfwdConcurrentReverse(PhoneForwardConcurrent *pfc,
+                                      char const *num) {
+    return readConcurrent(pfc, num, phfwdReverse);
+}
+
+PhoneNumbers * phfwdConcurrentGetReverse(PhoneForwardConcurrent *pfc,
+                                         char const *num) {
+    return readConcurrent(pfc, num, phfwdGetReverse);
+}
+
+/** @brief Checks whether an epoch has no readers.
+ *
+ * @param[in, out] pfc - a pointer to the structure;
+ * @param[in] epoch - the epoch.
+ * @return @p True if no reader is announced in the epoch, @p false otherwise.
+ */
+static bool isEpochEmpty(PhoneForwardConcurrent * pfc, unsigned epoch) {
+    for (size_t i = 0; i < NUM_READ_STRIPES; i++) {
+        if (atomic_load(&(pfc->stripes[i].readers[epoch])) != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Waits for a grace period.
+ * Moves the new readers to the other epoch and waits until both epochs
+ * become empty at some moment. Every reader which has started before
+ * the call has finished afterwards, while the new readers are not delayed.
+ *
+ * @param[in, out] pfc - a pointer to the structure.
+ */
+static void waitForReaders(PhoneForwardConcurrent * pfc) {
+    unsigned previous = atomic_load(&(pfc->epoch));
+    unsigned next = 1 - previous;
+
+    // The readers left in the next epoch by the previous grace period
+    while (!isEpochEmpty(pfc, next)) {
+        sched_yield();
+    }
+
+    atomic_store(&(pfc->epoch), next);
+
+    while (!isEpochEmpty(pfc, previous)) {
+        sched_yield();
+    }
+}
+
+/** @brief Applies a modification to a copy.
+ *
+ * @param[in, out] pf - a pointer to the copy;
+ * @param[in] num1 - the first prefix of the modification;
+ * @param[in] num2 - the second prefix of an addition or NULL for a removal.
+ * @return The result of @ref phfwdAdd for an addition, @p true for a removal.
+ */
+static bool applyModification(PhoneForward * pf, char const * num1,
+                              char const * num2) {
+    if (num2) {
+        return phfwdAdd(pf, num1, num2);
+    }
+
+    phfwdRemove(pf, num1);
+
+    return true;
+}
+
+/** @brief Modifies the structure.
+ * Applies the modification to the copy not used by the readers, completing
+ * the pending modification first, then directs the readers to it, waits
+ * for a grace period and applies the modification to the other copy. If
+ * the second application fails, it is left pending.
+ *
+ * @param[in, out] pfc - a pointer to the structure;
+ * @param[in] num1 - the first prefix of the modification;
+ * @param[in] num2 - the second prefix of an addition or NULL for a removal.
+ * @return @p False if the modification is incorrect or in case of memory
+ *         allocation failure, @p true otherwise.
+ */
+static bool writeConcurrent(PhoneForwardConcurrent * pfc, char const * num1,
+                            char const * num2) {
+    if (!pfc) {
+        return false;
+    }
+
+    // An addition of no number fails, a removal of no number changes nothing
+    if (!num1) {
+        return !num2;
+    }
+
+    // The copies let the modification be left pending without allocating
+    char * copiedNum1 = strdup(num1);
+    char * copiedNum2 = num2 ? strdup(num2) : NULL;
+
+    if (!copiedNum1 || (num2 && !copiedNum2)) {
+        free(copiedNum1);
+        free(copiedNum2);
+
+        return false;
+    }
+
+    pthread_mutex_lock(&(pfc->writerLock));
+
+    unsigned readCopy = atomic_load(&(pfc->readCopy));
+    PhoneForward * hidden = pfc->copies[1 - readCopy];
+    bool isApplied = true;
+
+    if (pfc->pendingNum1) {
+        isApplied = applyModification(hidden, pfc->pendingNum1,
+                                      pfc->pendingNum2);
+
+        if (isApplied) {
+            free(pfc->pendingNum1);
+            free(pfc->pendingNum2);
+            pfc->pendingNum1 = NULL;
+            pfc->pendingNum2 = NULL;
+        }
+    }
+
+    isApplied = isApplied && applyModification(hidden, num1, num2);
+
+    if (isApplied) {
+        atomic_store(&(pfc->readCopy), 1 - readCopy);
+        waitForReaders(pfc);
+
+        if (!applyModification(pfc->copies[readCopy], num1, num2)) {
+            pfc->pendingNum1 = copiedNum1;
+            pfc->pendingNum2 = copiedNum2;
+            copiedNum1 = NULL;
+            copiedNum2 = NULL;
+        }
+    }
+
+    pthread_mutex_unlock(&(pfc->writerLock));
+
+    free(copiedNum1);
+    free(copiedNum2);
+
+    return isApplied;
+}
+
+bool phfwdConcurrentAdd(PhoneForwardConcurrent *pfc, char const *num1,
+                        char const *num2) {
+    return writeConcurrent(pfc, num1, num2 ? num2 : "");
+}
+
+bool phfwdConcurrentRemove(PhoneForwardConcurrent *pfc, char const *num) {
+    return writeConcurrent(pfc, num, NULL);
+}
@@ -0,0 +1,107 @@
+/** @file
+ * Interface of the class storing phone numbers forwards shared by threads
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __PHONE_FORWARD_CONCURRENT_H__
+#define __PHONE_FORWARD_CONCURRENT_H__
+
+#include <stdbool.h>
+#include "phone_forward.h"
+
+/**
+ * This is the structure storing phone numbers forwards which can be read
+ * by many threads while another thread modifies it.
+ */
+struct PhoneForwardConcurrent;
+typedef struct PhoneForwardConcurrent
+        PhoneForwardConcurrent;  ///< Stores phone forwards shared by threads
+
+/** @brief Creates a new structure.
+ * Creates a new structure which does not contain any redirections.
+ * The structure keeps two copies of the redirections: the readers use one
+ * of them while the modifying thread updates the other one, therefore it
+ * needs twice as much memory as @ref PhoneForward.
+ *
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
+ */
+PhoneForwardConcurrent * phfwdConcurrentNew(void);
+
+/** @brief Removes a structure.
+ * Removes a structure pointed to by @p pfc. It does nothing if this pointer
+ * is NULL. No other thread may use the structure anymore.
+ *
+ * @param[in] pfc - a pointer to the structure to be deleted.
+ */
+void phfwdConcurrentDelete(PhoneForwardConcurrent *pfc);
+
+/** @brief Adds a redirection.
+ * Works as @ref phfwdAdd. May be called by any thread, the modifications are
+ * applied one at a time. Waits until the readers which have started before
+ * the modification finish, without blocking the new ones.
+ *
+ * @param[in, out] pfc - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num1 - a pointer to the string representing the prefix of
+ *                   the redirected numbers;
+ * @param[in] num2 - a pointer to the string representing the prefix of
+ *                   the numbers to whom the redirection is performed.
+ * @return The value of @p true, if the redirection has been added.
+ *         The value of @p false in the cases described in @ref phfwdAdd.
+ */
+bool phfwdConcurrentAdd(PhoneForwardConcurrent *pfc, char const *num1,
+                        char const *num2);
+
+/** @brief Removes redirections.
+ * Works as @ref phfwdRemove, applied in the same way as
+ * @ref phfwdConcurrentAdd.
+ *
+ * @param[in, out] pfc - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the prefix of numbers.
+ * @return The value of @p false in case of memory allocation failure, in
+ *         which case nothing is removed, @p true otherwise.
+ */
+bool phfwdConcurrentRemove(PhoneForwardConcurrent *pfc, char const *num);
+
+/** @brief Determines the redirection of a number.
+ * Works as @ref phfwdGet. Many threads may call the reading functions at
+ * the same time; they never wait for each other nor for the modifications.
+ *
+ * @param[in, out] pfc - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the number.
+ * @return The result of @ref phfwdGet.
+ */
+PhoneNumbers * phfwdConcurrentGet(PhoneForwardConcurrent *pfc,
+                                  char const *num);
+
+/** @brief Determines the redirections to a number.
+ * Works as @ref phfwdReverse, called in the same way as
+ * @ref phfwdConcurrentGet.
+ *
+ * @param[in, out] pfc - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the number.
+ * @return The result of @ref phfwdReverse.
+ */
+PhoneNumbers * phfwdConcurrentReverse(PhoneForwardConcurrent *pfc,
+                                      char const *num);
+
+/** @brief Determines the numbers redirected to a number.
+ * Works as @ref phfwdGetReverse, called in the same way as
+ * @ref phfwdConcurrentGet.
+ *
+ * @param[in, out] pfc - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the number.
+ * @return The result of @ref phfwdGetReverse.
+ */
+PhoneNumbers * phfwdConcurrentGetReverse(PhoneForwardConcurrent *pfc,
+                                         char const *num);
+
+#endif /* __PHONE_FORWARD_CONCURRENT_H__ */
@@ -3,12 +3,163 @@
 #endif
 
 #include "phone_forward.h"
+#include "phone_forward_concurrent.h"
+#include "phone_forward_sharded.h"
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #define MAX_LEN 23
 
+// The concurrent structure is checked against a sequential model: a reader
+// has to see the state after some modification which had not finished
+// before its query started and had started before the query finished.
+#define CONCURRENT_READERS 4
+#define CONCURRENT_OPERATIONS 3000
+#define CONCURRENT_QUERIES 8
+
+static char const *concurrentQueries[CONCURRENT_QUERIES] = {
+  "1", "12", "123", "5", "56", "561", "7", "72"
+};
+
+static char concurrentNum1[CONCURRENT_OPERATIONS][4];
+static char concurrentNum2[CONCURRENT_OPERATIONS][4];
+static bool concurrentResults[CONCURRENT_OPERATIONS];
+static char *expectedGet[CONCURRENT_OPERATIONS + 1][CONCURRENT_QUERIES];
+static char *expectedReverse[CONCURRENT_OPERATIONS + 1][CONCURRENT_QUERIES];
+static atomic_size_t operationsStarted;
+static atomic_size_t operationsFinished;
+
+static char *joinNumbers(PhoneNumbers *pnum) {
+  size_t length = 1;
+  for (size_t i = 0; phnumGet(pnum, i) != NULL; i++)
+    length += strlen(phnumGet(pnum, i)) + 1;
+
+  char *result = malloc(length);
+  assert(result != NULL);
+  result[0] = '\0';
+  for (size_t i = 0; phnumGet(pnum, i) != NULL; i++) {
+    strcat(result, phnumGet(pnum, i));
+    strcat(result, ",");
+  }
+  phnumDelete(pnum);
+
+  return result;
+}
+
+static void prepareConcurrentModel(void) {
+  char const digits[] = "12567";
+  unsigned seed = 2022;
+  PhoneForward *model = phfwdNew();
+
+  for (size_t i = 0; i <= CONCURRENT_OPERATIONS; i++) {
+    for (size_t q = 0; q < CONCURRENT_QUERIES; q++) {
+      expectedGet[i][q] = joinNumbers(phfwdGet(model, concurrentQueries[q]));
+      expectedReverse[i][q] =
+          joinNumbers(phfwdReverse(model, concurrentQueries[q]));
+    }
+    if (i == CONCURRENT_OPERATIONS)
+      break;
+
+    seed = seed * 1103515245 + 12345;
+    size_t length1 = (seed >> 8) % 3 + 1;
+    size_t length2 = (seed >> 12) % 3 + 1;
+    for (size_t j = 0; j < length1; j++)
+      concurrentNum1[i][j] = digits[(seed >> (16 + 2 * j)) % 5];
+    // Every third operation is a removal, stored with an empty num2
+    if ((seed >> 24) % 3 != 0)
+      for (size_t j = 0; j < length2; j++)
+        concurrentNum2[i][j] = digits[(seed >> (22 + 2 * j)) % 5];
+
+    concurrentResults[i] = true;
+    if (concurrentNum2[i][0] == '\0')
+      phfwdRemove(model, concurrentNum1[i]);
+    else
+      concurrentResults[i] =
+          phfwdAdd(model, concurrentNum1[i], concurrentNum2[i]);
+  }
+
+  phfwdDelete(model);
+}
+
+static void *concurrentWriter(void *arg) {
+  PhoneForwardConcurrent *pfc = arg;
+
+  for (size_t i = 0; i < CONCURRENT_OPERATIONS; i++) {
+    bool result;
+    atomic_store(&operationsStarted, i + 1);
+    if (concurrentNum2[i][0] == '\0')
+      result = phfwdConcurrentRemove(pfc, concurrentNum1[i]);
+    else
+      result = phfwdConcurrentAdd(pfc, concurrentNum1[i], concurrentNum2[i]);
+    assert(result == concurrentResults[i]);
+    atomic_store(&operationsFinished, i + 1);
+  }
+
+  return NULL;
+}
+
+static bool matchesModel(char *expected[][CONCURRENT_QUERIES], size_t first,
+                         size_t last, size_t query, char const *found) {
+  for (size_t i = first; i <= last; i++)
+    if (strcmp(expected[i][query], found) == 0)
+      return true;
+
+  return false;
+}
+
+static void *concurrentReader(void *arg) {
+  PhoneForwardConcurrent *pfc = arg;
+  size_t query = 0;
+
+  while (atomic_load(&operationsFinished) < CONCURRENT_OPERATIONS) {
+    size_t first = atomic_load(&operationsFinished);
+    char *get = joinNumbers(phfwdConcurrentGet(pfc,
+                                               concurrentQueries[query]));
+    char *reverse = joinNumbers(phfwdConcurrentReverse(pfc,
+                                concurrentQueries[query]));
+    size_t last = atomic_load(&operationsStarted);
+
+    assert(matchesModel(expectedGet, first, last, query, get));
+    assert(matchesModel(expectedReverse, first, last, query, reverse));
+    free(get);
+    free(reverse);
+    query = (query + 1) % CONCURRENT_QUERIES;
+  }
+
+  return NULL;
+}
+
+static void checkConcurrentReaders(void) {
+  pthread_t writer, readers[CONCURRENT_READERS];
+  PhoneForwardConcurrent *pfc = phfwdConcurrentNew();
+  assert(pfc != NULL);
+
+  prepareConcurrentModel();
+  for (size_t i = 0; i < CONCURRENT_READERS; i++)
+    assert(pthread_create(&readers[i], NULL, concurrentReader, pfc) == 0);
+  assert(pthread_create(&writer, NULL, concurrentWriter, pfc) == 0);
+  assert(pthread_join(writer, NULL) == 0);
+  for (size_t i = 0; i < CONCURRENT_READERS; i++)
+    assert(pthread_join(readers[i], NULL) == 0);
+
+  for (size_t q = 0; q < CONCURRENT_QUERIES; q++) {
+    char *get = joinNumbers(phfwdConcurrentGet(pfc, concurrentQueries[q]));
+    assert(strcmp(get, expectedGet[CONCURRENT_OPERATIONS][q]) == 0);
+    free(get);
+  }
+  for (size_t i = 0; i <= CONCURRENT_OPERATIONS; i++)
+    for (size_t q = 0; q < CONCURRENT_QUERIES; q++) {
+      free(expectedGet[i][q]);
+      free(expectedReverse[i][q]);
+    }
+  phfwdConcurrentDelete(pfc);
+}
+
 int main() {
   char num1[MAX_LEN + 1], num2[MAX_LEN + 1];
   PhoneForward *pf;
@@ -142,5 +293,287 @@ printf("adteradd\n");
   assert(strcmp(phnumGet(pnum, 0), "7581") == 0);
   assert(phnumGet(pnum, 1) == NULL);
   phnumDelete(pnum);
+
+  char buffer[MAX_LEN + 1];
+  assert(phfwdGetInto(pf, "1234581", buffer, sizeof buffer) == 5);
+  assert(strcmp(buffer, "76581") == 0);
+  assert(phfwdGetInto(pf, "12345", buffer, 3) == 3);
+  assert(strcmp(buffer, "76581") == 0);
+  assert(phfwdGetInto(pf, "A", buffer, sizeof buffer) == 0);
+
+  char const *batch[] = {"1234581", "A", "7581", "12345"};
+  pnum = phfwdGetBatch(pf, batch, 4);
+  assert(strcmp(phnumGet(pnum, 0), "76581") == 0);
+  assert(phnumGet(pnum, 1) == NULL);
+  assert(strcmp(phnumGet(pnum, 2), "7581") == 0);
+  assert(strcmp(phnumGet(pnum, 3), "765") == 0);
+  assert(phnumGet(pnum, 4) == NULL);
+  assert(phnumAdd(pnum, "42"));
+  assert(phnumGet(pnum, 1) == NULL);
+  assert(strcmp(phnumGet(pnum, 0), "76581") == 0);
+  assert(strcmp(phnumGet(pnum, 4), "42") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "1234581");
+  assert(phnumAdd(pnum, "3") && phnumAdd(pnum, "33"));
+  assert(strcmp(phnumGet(pnum, 0), "76581") == 0);
+  assert(strcmp(phnumGet(pnum, 2), "33") == 0);
+  assert(phnumGet(pnum, 3) == NULL);
+  phnumDelete(pnum);
+
+  phfwdAdd(pf, "12", "7");
+  PhoneReverseIter *it = phfwdReverseIterNew(pf, "765", false);
+  assert(strcmp(phfwdReverseIterNext(it), "12345") == 0);
+  assert(strcmp(phfwdReverseIterNext(it), "1265") == 0);
+  assert(strcmp(phfwdReverseIterNext(it), "765") == 0);
+  assert(phfwdReverseIterNext(it) == NULL);
+  phfwdReverseIterFree(it);
+  it = phfwdReverseIterNew(pf, "7345", true);
+  assert(strcmp(phfwdReverseIterNext(it), "7345") == 0);
+  assert(phfwdReverseIterNext(it) == NULL);
+  phfwdReverseIterFree(it);
+
+  pnum = phfwdGet(pf, "7581");
+  assert(phfwdReverseReuse(pf, "765", false, pnum) == pnum);
+  assert(strcmp(phnumGet(pnum, 0), "12345") == 0);
+  assert(strcmp(phnumGet(pnum, 2), "765") == 0);
+  assert(phnumGet(pnum, 3) == NULL);
+  assert(phfwdGetReuse(pf, "1234581", pnum) == pnum);
+  assert(strcmp(phnumGet(pnum, 0), "76581") == 0);
+  assert(phnumGet(pnum, 1) == NULL);
+  assert(phfwdGetReuse(pf, "A", pnum) == pnum);
+  assert(phnumGet(pnum, 0) == NULL);
+  assert(phfwdReverseReuse(pf, "7345", true, pnum) == pnum);
+  assert(strcmp(phnumGet(pnum, 0), "7345") == 0);
+  assert(phnumGet(pnum, 1) == NULL);
+  phnumDelete(pnum);
+
+  assert(phfwdSave(pf, "phone_forward_example.snapshot"));
+  PhoneForward *mapped = phfwdLoadMapped("phone_forward_example.snapshot");
+  assert(mapped);
+  pnum = phfwdGet(mapped, "1234581");
+  assert(strcmp(phnumGet(pnum, 0), "76581") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(mapped, "1299");
+  assert(strcmp(phnumGet(pnum, 0), "799") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdReverse(mapped, "765");
+  assert(strcmp(phnumGet(pnum, 0), "12345") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "1265") == 0);
+  assert(strcmp(phnumGet(pnum, 2), "765") == 0);
+  assert(phnumGet(pnum, 3) == NULL);
+  phnumDelete(pnum);
+  assert(!phfwdAdd(mapped, "3", "4"));
+  assert(phfwdAdd(pf, "3", "4"));
+  assert(phfwdSave(pf, "phone_forward_example.snapshot"));
+  pnum = phfwdGet(mapped, "35");
+  assert(strcmp(phnumGet(pnum, 0), "35") == 0);
+  phnumDelete(pnum);
+  phfwdRemove(pf, "3");
+  assert(phfwdSetCache(pf, 2));
+  pnum = phfwdGet(pf, "1299");
+  assert(strcmp(phnumGet(pnum, 0), "799") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "1299");
+  assert(strcmp(phnumGet(pnum, 0), "799") == 0);
+  assert(phnumGet(pnum, 1) == NULL);
+  phnumDelete(pnum);
+  phfwdAdd(pf, "129", "8");
+  pnum = phfwdGet(pf, "1299");
+  assert(strcmp(phnumGet(pnum, 0), "89") == 0);
+  phnumDelete(pnum);
+  phfwdRemove(pf, "129");
+  assert(phfwdGetInto(pf, "1299", buffer, sizeof buffer) == 3);
+  assert(strcmp(buffer, "799") == 0);
+  assert(phfwdSetCache(pf, 0));
+  assert(phfwdCompile(pf));
+  pnum = phfwdGet(pf, "1299");
+  assert(strcmp(phnumGet(pnum, 0), "799") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdReverse(pf, "765");
+  assert(strcmp(phnumGet(pnum, 1), "1265") == 0);
+  phnumDelete(pnum);
+  phfwdAdd(pf, "1299", "3");
+  pnum = phfwdGet(pf, "12995");
+  assert(strcmp(phnumGet(pnum, 0), "35") == 0);
+  phnumDelete(pnum);
+  phfwdRemove(pf, "1299");
+  PhoneForwardStats stats, mappedStats;
+  assert(phfwdStats(pf, &stats));
+  assert(phfwdStats(mapped, &mappedStats));
+  assert(stats.initial.terminalNodes == 2);
+  assert(stats.forwarded.terminalNodes == 2);
+  assert(stats.initial.nodes == mappedStats.initial.nodes);
+  assert(stats.forwarded.nodes == mappedStats.forwarded.nodes);
+  assert(stats.initial.fanOuts[0] == mappedStats.initial.fanOuts[0]);
+  assert(stats.tombstones <= stats.forwardedArraySlots);
+  assert(stats.nodeBytes > 0 && stats.imageBytes == 0);
+  assert(mappedStats.nodeBytes == 0 && mappedStats.imageBytes > 0);
+  phfwdDelete(mapped);
+  remove("phone_forward_example.snapshot");
+  assert(phfwdCompile(pf));
+  PhoneForward *shared = phfwdSnapshot(pf);
+  assert(phfwdAdd(pf, "1299", "3"));
+  assert(phfwdStats(pf, &stats) && stats.imageBytes > 0);
+  phfwdDelete(shared);
+  assert(phfwdCompile(pf));
+  assert(phfwdAdd(pf, "1298", "3"));
+  assert(phfwdStats(pf, &stats) && stats.imageBytes == 0);
+  phfwdDelete(pf);
+
+  pf = phfwdNew();
+  PhoneForwardRule rules[] = {{"12", "5"}, {"3", "12"}, {"12", "6"},
+                              {"123", "9"}};
+  assert(phfwdAddBulk(pf, rules, 4));
+  pnum = phfwdGet(pf, "1245");
+  assert(strcmp(phnumGet(pnum, 0), "645") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "1234");
+  assert(strcmp(phnumGet(pnum, 0), "94") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "34");
+  assert(strcmp(phnumGet(pnum, 0), "124") == 0);
+  phnumDelete(pnum);
+  PhoneForwardRule wrong[] = {{"4", "5"}, {"6", "6"}};
+  assert(!phfwdAddBulk(pf, wrong, 2));
+  pnum = phfwdGet(pf, "4");
+  assert(strcmp(phnumGet(pnum, 0), "4") == 0);
+  phnumDelete(pnum);
+  PhoneForward *snapshot = phfwdSnapshot(pf);
+  PhoneForward *sameSnapshot = phfwdSnapshot(pf);
+  assert(snapshot && sameSnapshot);
+  phfwdRemove(pf, "12");
+  assert(phfwdAdd(pf, "34", "7"));
+  assert(!phfwdAdd(snapshot, "5", "6"));
+  phfwdRemove(snapshot, "3");
+  pnum = phfwdGet(snapshot, "1245");
+  assert(strcmp(phnumGet(pnum, 0), "645") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "1245");
+  assert(strcmp(phnumGet(pnum, 0), "1245") == 0);
+  phnumDelete(pnum);
+  PhoneForward *changedSnapshot = phfwdSnapshot(pf);
+  assert(changedSnapshot);
+  pnum = phfwdGet(changedSnapshot, "1245");
+  assert(strcmp(phnumGet(pnum, 0), "1245") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(changedSnapshot, "345");
+  assert(strcmp(phnumGet(pnum, 0), "75") == 0);
+  phnumDelete(pnum);
+  phfwdDelete(changedSnapshot);
+  phfwdDelete(pf);
+  pnum = phfwdReverse(sameSnapshot, "124");
+  assert(strcmp(phnumGet(pnum, 0), "124") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "34") == 0);
+  assert(phnumGet(pnum, 2) == NULL);
+  phnumDelete(pnum);
+  pf = phfwdSnapshot(snapshot);
+  phfwdDelete(snapshot);
+  phfwdDelete(sameSnapshot);
+  pnum = phfwdGet(pf, "34");
+  assert(strcmp(phnumGet(pnum, 0), "124") == 0);
+  phnumDelete(pnum);
+  phfwdDelete(pf);
+
+  remove("phone_forward_example.journal");
+  pf = phfwdNew();
+  assert(phfwdSetJournal(pf, "phone_forward_example.journal", 2));
+  assert(phfwdAddBulk(pf, rules, 4));
+  phfwdRemove(pf, "123");
+  assert(phfwdAdd(pf, "4", "12"));
+  assert(!phfwdAdd(pf, "4", "4"));
+  assert(phfwdJournalSync(pf));
+  phfwdDelete(pf);
+  pf = phfwdReplayJournal("phone_forward_example.journal");
+  pnum = phfwdGet(pf, "1234");
+  assert(strcmp(phnumGet(pnum, 0), "634") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "45");
+  assert(strcmp(phnumGet(pnum, 0), "125") == 0);
+  phnumDelete(pnum);
+  assert(phfwdSetJournal(pf, "phone_forward_example.journal", 0));
+  phfwdRemove(pf, "4");
+  phfwdDelete(pf);
+  pf = phfwdReplayJournal("phone_forward_example.journal");
+  pnum = phfwdGet(pf, "45");
+  assert(strcmp(phnumGet(pnum, 0), "45") == 0);
+  phnumDelete(pnum);
+  assert(!phfwdJournalSync(pf));
+  phfwdDelete(pf);
+  remove("phone_forward_example.journal");
+
+  PhoneForwardTransaction *tx = phfwdTransactionNew();
+  assert(phfwdTransactionAdd(tx, "12", "5"));
+  assert(phfwdTransactionAdd(tx, "123", "7"));
+  assert(phfwdTransactionRemove(tx, "12"));
+  assert(phfwdTransactionAdd(tx, "1", "9"));
+  assert(phfwdTransactionAdd(tx, "12", "6"));
+  assert(!phfwdTransactionAdd(tx, "3", "3"));
+  assert(!phfwdTransactionRemove(tx, "3a"));
+  pf = phfwdNew();
+  assert(phfwdAdd(pf, "1234", "8"));
+  assert(phfwdTransactionCommit(pf, tx));
+  pnum = phfwdGet(pf, "1234");
+  assert(strcmp(phnumGet(pnum, 0), "634") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdGet(pf, "1345");
+  assert(strcmp(phnumGet(pnum, 0), "9345") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdReverse(pf, "63");
+  assert(strcmp(phnumGet(pnum, 0), "123") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "63") == 0);
+  assert(phnumGet(pnum, 2) == NULL);
+  phnumDelete(pnum);
+  snapshot = phfwdSnapshot(pf);
+  assert(!phfwdTransactionCommit(snapshot, tx));
+  phfwdDelete(snapshot);
+  phfwdTransactionDelete(tx);
   phfwdDelete(pf);
+
+  PhoneForwardConcurrent *pfc = phfwdConcurrentNew();
+  assert(phfwdConcurrentAdd(pfc, "12", "5"));
+  assert(phfwdConcurrentAdd(pfc, "3", "5"));
+  assert(!phfwdConcurrentAdd(pfc, "3", "3"));
+  pnum = phfwdConcurrentGet(pfc, "123");
+  assert(strcmp(phnumGet(pnum, 0), "53") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdConcurrentReverse(pfc, "56");
+  assert(strcmp(phnumGet(pnum, 0), "126") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "36") == 0);
+  assert(strcmp(phnumGet(pnum, 2), "56") == 0);
+  phnumDelete(pnum);
+  assert(phfwdConcurrentRemove(pfc, "1"));
+  pnum = phfwdConcurrentGetReverse(pfc, "56");
+  assert(strcmp(phnumGet(pnum, 0), "36") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "56") == 0);
+  assert(phnumGet(pnum, 2) == NULL);
+  phnumDelete(pnum);
+  phfwdConcurrentDelete(pfc);
+  checkConcurrentReaders();
+
+  PhoneForwardSharded *pfs = phfwdShardedNew();
+  assert(phfwdShardedAdd(pfs, "12", "5"));
+  assert(phfwdShardedAdd(pfs, "3", "5"));
+  assert(phfwdShardedAdd(pfs, "5", "7"));
+  assert(!phfwdShardedAdd(pfs, "3", "3"));
+  pnum = phfwdShardedGet(pfs, "123");
+  assert(strcmp(phnumGet(pnum, 0), "53") == 0);
+  phnumDelete(pnum);
+  pnum = phfwdShardedReverse(pfs, "56");
+  assert(strcmp(phnumGet(pnum, 0), "126") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "36") == 0);
+  assert(strcmp(phnumGet(pnum, 2), "56") == 0);
+  assert(phnumGet(pnum, 3) == NULL);
+  phnumDelete(pnum);
+  pnum = phfwdShardedGetReverse(pfs, "56");
+  assert(strcmp(phnumGet(pnum, 0), "126") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "36") == 0);
+  assert(phnumGet(pnum, 2) == NULL);
+  phnumDelete(pnum);
+  phfwdShardedRemove(pfs, "1");
+  pnum = phfwdShardedReverse(pfs, "56");
+  assert(strcmp(phnumGet(pnum, 0), "36") == 0);
+  assert(strcmp(phnumGet(pnum, 1), "56") == 0);
+  assert(phnumGet(pnum, 2) == NULL);
+  phnumDelete(pnum);
+  phfwdShardedDelete(pfs);
 }
@@ -0,0 +1,335 @@
+/** @file
+ * Implementation of the class storing phone numbers forwards split into
+ * independently locked shards
+ *
+ * Every shard is a separate @ref PhoneForward storing the redirections of
+ * the prefixes starting with one digit. Both the redirection of a number and
+ * the removal of the prefixes starting with a given one concern a single
+ * shard. The redirections to a number may be stored in any shard, so
+ * the reverse queries combine the sorted results of the shards; every shard
+ * remembers the first digits of its redirection targets, which lets these
+ * queries skip the shards which could not contribute anything.
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "phone_forward_sharded.h"
+
+/**
+ * The number of the shards, one for every digit.
+ */
+#define NUM_SHARDS          12
+
+/**
+ * The assumed size of a cache line, separating the shards.
+ */
+#define CACHE_LINE_SIZE     64
+
+/** @struct Shard
+ * @brief The redirections of the prefixes starting with one digit, placed
+ *      in a separate cache line.
+ * @var Shard::lock
+ *      The lock held exclusively by the modifications of the shard and
+ *      shared by the queries.
+ * @var Shard::pf
+ *      The redirections.
+ * @var Shard::targetDigits
+ *      The set of the first digits of the prefixes the redirections have
+ *      ever been added to, one bit for every digit.
+ */
+typedef struct Shard {
+    _Alignas(CACHE_LINE_SIZE) pthread_rwlock_t lock;
+    PhoneForward* pf;
+    atomic_uint targetDigits;
+} Shard;  ///< The redirections of the prefixes starting with one digit
+
+/** @struct PhoneForwardSharded
+ * @brief The shards of the redirections.
+ * @var PhoneForwardSharded::shards
+ *      The shards, indexed by the first digit of the redirected prefixes.
+ */
+struct PhoneForwardSharded {
+    Shard shards[NUM_SHARDS];
+};
+
+/** @brief Determines the shard of a digit.
+ * The shards follow the order of the digits in the numbers,
+ * i.e. '*' and '#' come after '9'.
+ *
+ * @param[in] digit - a character.
+ * @return The index of the shard of @p digit or -1 if @p digit is not
+ *         a digit.
+ */
+static int shardOf(char digit) {
+    if (digit >= '0' && digit <= '9') {
+        return digit - '0';
+    }
+    else if (digit == '*') {
+        return 10;
+    }
+    else if (digit == '#') {
+        return 11;
+    }
+
+    return -1;
+}
+
+/** @brief Compares the numbers.
+ * Compares the numbers in the order of the results of @ref phfwdReverse.
+ *
+ * @param[in] first - a pointer to the string representing a number;
+ * @param[in] second - a pointer to the string representing a number.
+ * @return A negative value if @p first precedes @p second, zero if they are
+ *         equal and a positive value otherwise.
+ */
+static int compareNumbers(char const * first, char const * second) {
+    while (*first && *first == *second) {
+        first++;
+        second++;
+    }
+
+    if (!*first || !*second) {
+        return (*first != '\0') - (*second != '\0');
+    }
+
+    return shardOf(*first) - shardOf(*second);
+}
+
+PhoneForwardSharded * phfwdShardedNew(void) {
+    PhoneForwardSharded * result = aligned_alloc(
+            CACHE_LINE_SIZE, sizeof(PhoneForwardSharded));
+    if (!result) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < NUM_SHARDS; i++) {
+        Shard * shard = &(result->shards[i]);
+        shard->pf = phfwdNew();
+
+        if (!shard->pf || pthread_rwlock_init(&(shard->lock), NULL) != 0) {
+            phfwdDelete(shard->pf);
+
+            while (i-- > 0) {
+                phfwdDelete(result->shards[i].pf);
+                pthread_rwlock_destroy(&(result->shards[i].lock));
+            }
+
+            free(result);
+
+            return NULL;
+        }
+
+        atomic_init(&(shard->targetDigits), 0);
+    }
+
+    return result;
+}
+
+void phfwdShardedDelete(PhoneForwardSharded *pfs) {
+    if (pfs) {
+        for (size_t i = 0; i < NUM_SHARDS; i++) {
+            phfwdDelete(pfs->shards[i].pf);
+            pthread_rwlock_destroy(&(pfs->shards[i].lock));
+        }
+
+        free(pfs);
+    }
+}
+
+bool phfwdShardedAdd(PhoneForwardSharded *pfs, char const *num1,
+                     char const *num2) {
+    if (!pfs || !num1 || !num2) {
+        return false;
+    }
+
+    int index = shardOf(num1[0]);
+    int target = shardOf(num2[0]);
+
+    if (index < 0 || target < 0) {
+        return false;
+    }
+
+    Shard * shard = &(pfs->shards[index]);
+    pthread_rwlock_wrlock(&(shard->lock));
+
+    // Marked before the addition, so a reader seeing the redirection sees it
+    atomic_fetch_or(&(shard->targetDigits), 1u << target);
+    bool isAdded = phfwdAdd(shard->pf, num1, num2);
+
+    pthread_rwlock_unlock(&(shard->lock));
+
+    return isAdded;
+}
+
+void phfwdShardedRemove(PhoneForwardSharded *pfs, char const *num) {
+    if (!pfs || !num || shardOf(num[0]) < 0) {
+        return;
+    }
+
+    Shard * shard = &(pfs->shards[shardOf(num[0])]);
+
+    pthread_rwlock_wrlock(&(shard->lock));
+    phfwdRemove(shard->pf, num);
+    pthread_rwlock_unlock(&(shard->lock));
+}
+
+PhoneNumbers * phfwdShardedGet(PhoneForwardSharded *pfs, char const *num) {
+    if (!pfs) {
+        return NULL;
+    }
+
+    // A string which is not a number is rejected by any shard
+    int index = num ? shardOf(num[0]) : -1;
+    Shard * shard = &(pfs->shards[index < 0 ? 0 : index]);
+
+    pthread_rwlock_rdlock(&(shard->lock));
+    PhoneNumbers * result = phfwdGet(shard->pf, num);
+    pthread_rwlock_unlock(&(shard->lock));
+
+    return result;
+}
+
+/** @brief Merges the results of the shards.
+ * Merges the sorted sequences into one, skipping the repetitions. Every
+ * shard includes @p num itself in the result of @ref phfwdReverse;
+ * in the result of @ref phfwdGetReverse only the shard of its first digit
+ * may decide correctly whether the number is not redirected.
+ *
+ * @param[in] parts - the results of the shards, NULL for the omitted ones;
+ * @param[in] num - a pointer to the string representing the number;
+ * @param[in] home - the index of the shard of the first digit of @p num;
+ * @param[in] isGetReverse - indicates whether the results come from
+ *                           @ref phfwdGetReverse.
+ * @return A pointer to the structure storing the sequence of numbers
+ *         or NULL in case of memory allocation failure.
+ */
+static PhoneNumbers * mergeShardResults(PhoneNumbers * const * parts,
+                                        char const * num, size_t home,
+                                        bool isGetReverse) {
+    PhoneNumbers * result = phnumNew();
+    if (!result) {
+        return NULL;
+    }
+
+    size_t positions[NUM_SHARDS] = {0};
+    char const * last = NULL;
+
+    while (true) {
+        char const * smallest = NULL;
+        size_t smallestShard = 0;
+
+        for (size_t i = 0; i < NUM_SHARDS; i++) {
+            char const * head = phnumGet(parts[i], positions[i]);
+
+            if (head && (!smallest || compareNumbers(head, smallest) < 0)) {
+                smallest = head;
+                smallestShard = i;
+            }
+        }
+
+        if (!smallest) {
+            return result;
+        }
+
+        positions[smallestShard]++;
+
+        bool isRepeated = last && strcmp(last, smallest) == 0;
+        bool isForeignNum = isGetReverse && smallestShard != home
+                            && strcmp(smallest, num) == 0;
+
+        if (!isRepeated && !isForeignNum) {
+            if (!phnumAdd(result, smallest)) {
+                phnumDelete(result);
+
+                return NULL;
+            }
+
+            last = smallest;
+        }
+    }
+}
+
+/** @brief Answers a reverse query.
+ * Locks the shard of the first digit of @p num and the shards which may
+ * store a redirection to a prefix of @p num in increasing order, queries
+ * all of them before unlocking any, and merges their results.
+ *
+ * @param[in, out] pfs - a pointer to the structure;
+ * @param[in] num - a pointer to the string representing the number;
+ * @param[in] isGetReverse - indicates whether the query is
+ *                           @ref phfwdGetReverse or @ref phfwdReverse.
+ * @return A pointer to the structure storing the sequence of numbers
+ *         or NULL if @p pfs is NULL or in case of memory allocation failure.
+ */
+static PhoneNumbers * reverseSharded(PhoneForwardSharded * pfs,
+                                     char const * num, bool isGetReverse) {
+    if (!pfs) {
+        return NULL;
+    }
+
+    int first = num ? shardOf(num[0]) : -1;
+    size_t home = first < 0 ? 0 : (size_t) first;
+    uint32_t touched = 1u << home;
+
+    for (size_t i = 0; i < NUM_SHARDS && first >= 0; i++) {
+        if (atomic_load(&(pfs->shards[i].targetDigits)) & (1u << first)) {
+            touched |= 1u << i;
+        }
+    }
+
+    PhoneNumbers * parts[NUM_SHARDS] = {NULL};
+    bool isFailed = false;
+
+    for (size_t i = 0; i < NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            pthread_rwlock_rdlock(&(pfs->shards[i].lock));
+        }
+    }
+
+    for (size_t i = 0; i < NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            PhoneForward const * pf = pfs->shards[i].pf;
+            parts[i] = isGetReverse ? phfwdGetReverse(pf, num)
+                                    : phfwdReverse(pf, num);
+            isFailed = isFailed || !parts[i];
+        }
+    }
+
+    for (size_t i = 0; i < NUM_SHARDS; i++) {
+        if (touched & (1u << i)) {
+            pthread_rwlock_unlock(&(pfs->shards[i].lock));
+        }
+    }
+
+    // The result of a single shard needs no merging
+    if (!isFailed && touched == 1u << home) {
+        return parts[home];
+    }
+
+    PhoneNumbers * result = isFailed ? NULL
+                            : mergeShardResults(parts, num, home,
+                                                isGetReverse);
+
+    for (size_t i = 0; i < NUM_SHARDS; i++) {
+        phnumDelete(parts[i]);
+    }
+
+    return result;
+}
+
+PhoneNumbers * phfwdShardedReverse(PhoneForwardSharded *pfs, char const *num) {
+    return reverseSharded(pfs, num, false);
+}
+
+PhoneNumbers * phfwdShardedGetReverse(PhoneForwardSharded *pfs,
+                                      char const *num) {
+    return reverseSharded(pfs, num, true);
+}
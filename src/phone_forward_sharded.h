@@ -0,0 +1,104 @@
+/** @file
+ * Interface of the class storing phone numbers forwards split into
+ * independently locked shards
+ *
+ * @author Agata Momot <a.momot4@student.uw.edu.pl>
+ * @copyright Uniwersytet Warszawski
+ * @date 2022
+ */
+
+#ifndef __PHONE_FORWARD_SHARDED_H__
+#define __PHONE_FORWARD_SHARDED_H__
+
+#include <stdbool.h>
+#include "phone_forward.h"
+
+/**
+ * This is the structure storing phone numbers forwards which can be modified
+ * by many threads at the same time. The redirections are split among shards
+ * by the first digit of the redirected prefix, each shard locked separately.
+ */
+struct PhoneForwardSharded;
+typedef struct PhoneForwardSharded
+        PhoneForwardSharded;  ///< Stores phone forwards split into shards
+
+/** @brief Creates a new structure.
+ * Creates a new structure which does not contain any redirections.
+ *
+ * @return A pointer to the created structure or NULL in case of memory
+ *         allocation failure.
+ */
+PhoneForwardSharded * phfwdShardedNew(void);
+
+/** @brief Removes a structure.
+ * Removes a structure pointed to by @p pfs. It does nothing if this pointer
+ * is NULL. No other thread may use the structure anymore.
+ *
+ * @param[in] pfs - a pointer to the structure to be deleted.
+ */
+void phfwdShardedDelete(PhoneForwardSharded *pfs);
+
+/** @brief Adds a redirection.
+ * Works as @ref phfwdAdd. Locks only the shard of the first digit of
+ * @p num1, so the additions of prefixes starting with different digits
+ * are performed in parallel.
+ *
+ * @param[in, out] pfs - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num1 - a pointer to the string representing the prefix of
+ *                   the redirected numbers;
+ * @param[in] num2 - a pointer to the string representing the prefix of
+ *                   the numbers to whom the redirection is performed.
+ * @return The value of @p true, if the redirection has been added.
+ *         The value of @p false in the cases described in @ref phfwdAdd.
+ */
+bool phfwdShardedAdd(PhoneForwardSharded *pfs, char const *num1,
+                     char const *num2);
+
+/** @brief Removes redirections.
+ * Works as @ref phfwdRemove, locking only the shard of the first digit of
+ * @p num.
+ *
+ * @param[in, out] pfs - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the prefix of numbers.
+ */
+void phfwdShardedRemove(PhoneForwardSharded *pfs, char const *num);
+
+/** @brief Determines the redirection of a number.
+ * Works as @ref phfwdGet. All the prefixes of @p num start with the same
+ * digit, therefore only its shard is locked, shared with other readers.
+ *
+ * @param[in, out] pfs - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the number.
+ * @return The result of @ref phfwdGet.
+ */
+PhoneNumbers * phfwdShardedGet(PhoneForwardSharded *pfs, char const *num);
+
+/** @brief Determines the redirections to a number.
+ * Works as @ref phfwdReverse. Locks, shared with other readers, the shard
+ * of the first digit of @p num and the shards which have ever stored
+ * a redirection to a prefix starting with this digit, all of them for
+ * the whole query, so the result reflects a single state of these shards.
+ *
+ * @param[in, out] pfs - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the number.
+ * @return The result of @ref phfwdReverse.
+ */
+PhoneNumbers * phfwdShardedReverse(PhoneForwardSharded *pfs, char const *num);
+
+/** @brief Determines the numbers redirected to a number.
+ * Works as @ref phfwdGetReverse, locking the shards in the same way as
+ * @ref phfwdShardedReverse.
+ *
+ * @param[in, out] pfs - a pointer to the structure storing number
+ *                       redirections;
+ * @param[in] num - a pointer to the string representing the number.
+ * @return The result of @ref phfwdGetReverse.
+ */
+PhoneNumbers * phfwdShardedGetReverse(PhoneForwardSharded *pfs,
+                                      char const *num);
+
+#endif /* __PHONE_FORWARD_SHARDED_H__ */